@@ -0,0 +1,71 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+// Axis-aligned bounding box, stored as the two opposite corners
+class aabb {
+    public:
+        aabb() {}
+        aabb(const point3& a, const point3& b): minimum(a), maximum(b) {}
+
+        point3 min() const { return minimum; }
+        point3 max() const { return maximum; }
+
+        bool hit(const ray& r, real t_min, real t_max) const {
+            // Slab test: clip the [t_min, t_max] interval of our ray against
+            // the pair of planes bounding the box on every axis, if the
+            // interval becomes empty the ray misses the box
+            for (int a = 0; a < 3; a++) {
+                auto inv_d = 1.0 / r.direction()[a];
+                auto t0 = (minimum[a] - r.origin()[a]) * inv_d;
+                auto t1 = (maximum[a] - r.origin()[a]) * inv_d;
+                // Ray travelling in the negative direction
+                // reaches the max plane first
+                if (inv_d < 0.0) std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max <= t_min) return false;
+            }
+            return true;
+        }
+
+        real surface_area() const {
+            vec3 d = maximum - minimum;
+            return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+        }
+
+        point3 centroid() const {
+            return 0.5 * (minimum + maximum);
+        }
+
+        // Index of the axis the box is widest along
+        int longest_axis() const {
+            vec3 d = maximum - minimum;
+            if (d.x() > d.y() && d.x() > d.z()) return 0;
+            return d.y() > d.z() ? 1 : 2;
+        }
+
+        // Box that contains nothing, growing it by any box gives that box
+        static aabb empty() {
+            return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+        }
+
+    public:
+        point3 minimum;
+        point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    point3 small(fmin(box0.min().x(), box1.min().x()),
+                 fmin(box0.min().y(), box1.min().y()),
+                 fmin(box0.min().z(), box1.min().z()));
+
+    point3 big(fmax(box0.max().x(), box1.max().x()),
+               fmax(box0.max().y(), box1.max().y()),
+               fmax(box0.max().z(), box1.max().z()));
+
+    return aabb(small, big);
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "render.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+struct adaptive_settings {
+    int min_samples = 32;           // samples every pixel gets before we judge it
+    int pass_samples = 16;          // samples added to each unconverged pixel per pass
+    int max_samples = 100;          // hard cap per pixel
+    double noise_threshold = 0.02;  // allowed 95% confidence half width, display units
+};
+
+struct adaptive_stats {
+    int passes = 0;
+    long samples = 0;               // samples actually taken
+    long budget = 0;                // max_samples for every pixel
+    long converged_pixels = 0;      // pixels that stopped before max_samples
+};
+
+// Progressive renderer that spends samples where the image is noisy.
+// Every pass adds pass_samples to each pixel that hasn't converged yet, a
+// pixel converges once the 95% confidence interval of its mean luminance,
+// measured after the gamma 2 output curve, is narrower than the noise
+// threshold for it and its neighbours. Flat sky pixels stop after the first pass while glass edges
+// and soft shadows keep going up to max_samples.
+// Sample s of pixel p is always seeded from (seed, p, s), so the samples a
+// pixel does take are the same ones the fixed spp renderer would take.
+class adaptive_renderer {
+    public:
+        adaptive_renderer(const camera& cam, const hittable& world, const material_table& materials,
+                          const light_list& lights, int image_width, int image_height, int max_depth, uint64_t seed,
+                          const adaptive_settings& settings, const roulette_settings& roulette = roulette_settings())
+            : cam(cam), world(world), materials(materials), lights(lights), image_width(image_width), image_height(image_height),
+              max_depth(max_depth), seed(seed), settings(settings), roulette(roulette) {}
+
+        // Runs passes over tiles until every pixel has converged or hit the
+        // sample cap, accumulating into fb. worker_paths, one per pool
+        // worker, collects path lengths.
+        adaptive_stats render(thread_pool& pool, const std::vector<tile>& tiles, framebuffer& fb,
+                              std::vector<path_stats>& worker_paths) const;
+
+        // Half width of the 95% confidence interval of pixel p's mean
+        // luminance, measured after the gamma 2 output curve
+        double pixel_error(const framebuffer& fb, size_t p) const {
+            uint32_t n = fb.samples[p];
+            if (n < 2) return infinity;
+            double half_width = 1.96 * sqrt(fb.variance(p) / n);
+            // Output is sqrt(mean), so an error of dx in linear luminance
+            // shows up as dx / (2 sqrt(mean)). The floor keeps near black
+            // pixels from needing an impossible amount of samples.
+            double slope = 0.5 / std::max(sqrt(std::max(double(fb.lum_mean[p]), 0.0)), 0.05);
+            return half_width * slope;
+        }
+
+    private:
+        const camera& cam;
+        const hittable& world;
+        const material_table& materials;
+        const light_list& lights;
+        int image_width, image_height;
+        int max_depth;
+        uint64_t seed;
+        adaptive_settings settings;
+        roulette_settings roulette;
+};
+
+adaptive_stats adaptive_renderer::render(thread_pool& pool, const std::vector<tile>& tiles, framebuffer& fb,
+                                         std::vector<path_stats>& worker_paths) const {
+    adaptive_stats stats;
+    stats.budget = long(image_width) * image_height * settings.max_samples;
+
+    const size_t pixel_count = size_t(image_width) * image_height;
+    std::vector<uint8_t> active(pixel_count, 1);
+    std::vector<float> error(pixel_count);
+    std::vector<int> pending(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++) pending[t] = static_cast<int>(t);
+
+    while (!pending.empty()) {
+        RT_SPAN("adaptive pass");
+        // First pass brings everything up to min_samples
+        int pass_samples = stats.passes == 0 ? std::max(settings.min_samples, settings.pass_samples)
+                                             : settings.pass_samples;
+        std::atomic<long> pass_total(0);
+
+        pool.run(static_cast<int>(pending.size()), [&](int k, int worker) {
+            RT_SPAN("tile");
+            const tile& tl = tiles[pending[k]];
+            long taken = 0;
+            for (int j = tl.y0; j < tl.y1; j++) {
+                for (int i = tl.x0; i < tl.x1; i++) {
+                    size_t p = size_t(j) * image_width + i;
+                    if (!active[p]) continue;
+                    int first = static_cast<int>(fb.samples[p]);
+                    int last = std::min(first + pass_samples, settings.max_samples);
+                    for (int s = first; s < last; s++) {
+                        seed_pixel_sample(seed, p, s);
+                        double du, dv;
+                        sample_2d(du, dv);
+                        auto u = double(i + du) / (image_width - 1);
+                        auto v = double(j + dv) / (image_height - 1);
+                        fb.add_sample(i, j, ray_color(cam.get_ray(u, v), world, materials, lights, max_depth,
+                                                       roulette, &worker_paths[worker]));
+                    }
+                    taken += last - first;
+                    error[p] = static_cast<float>(pixel_error(fb, p));
+                }
+            }
+            pass_total += taken;
+        });
+        stats.passes++;
+        stats.samples += pass_total;
+
+        // A pixel keeps sampling while it or any of its 8 neighbours is
+        // above the threshold. The variance estimate from a few dozen
+        // samples is itself noisy, and a pixel that happened to see a
+        // quiet run next to a noisy one is usually just as noisy.
+        long pixels_left = 0;
+        std::vector<uint8_t> next_active(pixel_count, 0);
+        for (int j = 0; j < image_height; j++) {
+            for (int i = 0; i < image_width; i++) {
+                size_t p = size_t(j) * image_width + i;
+                if (fb.samples[p] >= static_cast<uint32_t>(settings.max_samples)) continue;
+                float worst = 0;
+                for (int y = std::max(j - 1, 0); y <= std::min(j + 1, image_height - 1); y++) {
+                    for (int x = std::max(i - 1, 0); x <= std::min(i + 1, image_width - 1); x++) {
+                        worst = std::max(worst, error[size_t(y) * image_width + x]);
+                    }
+                }
+                if (worst > settings.noise_threshold) {
+                    next_active[p] = 1;
+                    pixels_left++;
+                }
+            }
+        }
+        active.swap(next_active);
+        std::cerr << "\rPass " << stats.passes << ": " << pixels_left << " pixels still sampling " << std::flush;
+
+        // Only tiles with something left to do go into the next pass
+        std::vector<int> next;
+        for (int t : pending) {
+            const tile& tl = tiles[t];
+            bool busy = false;
+            for (int j = tl.y0; j < tl.y1 && !busy; j++) {
+                for (int i = tl.x0; i < tl.x1 && !busy; i++) busy = active[size_t(j) * image_width + i];
+            }
+            if (busy) next.push_back(t);
+        }
+        pending.swap(next);
+    }
+
+    for (size_t p = 0; p < fb.samples.size(); p++) {
+        if (fb.samples[p] < static_cast<uint32_t>(settings.max_samples)) stats.converged_pixels++;
+    }
+    return stats;
+}
+
+#endif
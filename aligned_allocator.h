@@ -0,0 +1,35 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+// std::vector allocator that hands out memory aligned to Alignment bytes,
+// so SIMD code can use aligned loads on the vector's data()
+template <typename T, std::size_t Alignment>
+struct aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = aligned_allocator<U, Alignment>; };
+
+    aligned_allocator() {}
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+};
+
+template <typename T, typename U, std::size_t A>
+bool operator ==(const aligned_allocator<T, A>&, const aligned_allocator<U, A>&) { return true; }
+
+template <typename T, typename U, std::size_t A>
+bool operator !=(const aligned_allocator<T, A>&, const aligned_allocator<U, A>&) { return false; }
+
+#endif
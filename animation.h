@@ -0,0 +1,127 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "profile.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Batch rendering of a camera path. The scene and its acceleration
+// structure are built once and the frames render back to back, each one
+// handed to a frame_writer whose thread encodes and writes it while the
+// next frame traces.
+
+// Output path of frame n. A printf style %d in the pattern (%04d and the
+// like) is replaced by the frame number, without one the number goes in
+// front of the extension: anim.png becomes anim_0000.png. "-" writes
+// every frame to stdout one after the other.
+std::string frame_output_path(const std::string& pattern, int n) {
+    if (pattern == "-") return pattern;
+    size_t percent = pattern.find('%');
+    if (percent != std::string::npos) {
+        // Only %d with an optional 0 flag and width, anything else is taken literally
+        size_t d = pattern.find_first_not_of("0123456789", percent + 1);
+        if (d != std::string::npos && pattern[d] == 'd') {
+            char number[32];
+            snprintf(number, sizeof(number), ("%" + pattern.substr(percent + 1, d - percent)).c_str(), n);
+            return pattern.substr(0, percent) + number + pattern.substr(d + 1);
+        }
+    }
+    char number[32];
+    snprintf(number, sizeof(number), "_%04d", n);
+    size_t slash = pattern.rfind('/');
+    size_t dot = pattern.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = pattern.size();
+    return pattern.substr(0, dot) + number + pattern.substr(dot);
+}
+
+// Writes frames on its own thread. It holds one frame at a time, so the
+// renderer and the writer trade two framebuffers back and forth.
+class frame_writer {
+    public:
+        explicit frame_writer(image_format format): format(format), writer(&frame_writer::run, this) {}
+
+        frame_writer(const frame_writer&) = delete;
+        frame_writer& operator=(const frame_writer&) = delete;
+
+        ~frame_writer() { finish(); }
+
+        // Queues fb to be written to path and returns a framebuffer for the
+        // next frame: the one written before this, or an empty one (width 0)
+        // the first time. Waits if the last frame is still being written.
+        framebuffer write(framebuffer&& fb, const std::string& path) {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto wait_start = std::chrono::steady_clock::now();
+            idle.wait(lock, [this] { return !busy; });
+            wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+            framebuffer written = std::move(frame);
+            frame = std::move(fb);
+            frame_path = path;
+            busy = true;
+            wake.notify_one();
+            return written;
+        }
+
+        // Waits for the last frame and stops the thread, false if any write
+        // failed (failed_path has the first one)
+        bool finish() {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (stopping) return failed_path.empty();
+                idle.wait(lock, [this] { return !busy; });
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+            return failed_path.empty();
+        }
+
+        // Encoding and writing time, and how much of it the renderer
+        // spent waiting because the writer was still busy
+        double write_seconds = 0;
+        double wait_seconds = 0;
+        std::string failed_path;
+
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this] { return busy || stopping; });
+                if (!busy) return;
+                // frame and frame_path are left alone while busy
+                lock.unlock();
+                auto start = std::chrono::steady_clock::now();
+                bool ok;
+                {
+                    RT_SPAN("write image");
+                    ok = write_image(frame, frame_path, format);
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                lock.lock();
+                write_seconds += seconds;
+                if (!ok && failed_path.empty()) failed_path = frame_path;
+                busy = false;
+                idle.notify_one();
+            }
+        }
+
+    private:
+        image_format format;
+        framebuffer frame;
+        std::string frame_path;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        bool busy = false;
+        bool stopping = false;
+        std::thread writer;
+};
+
+#endif
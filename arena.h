@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for things that live as long as the scene. Allocation
+// is a pointer increment inside a large block, neighbouring objects end
+// up next to each other in memory and everything is released at once
+// when the arena goes away. Objects are never destroyed one by one, so
+// only trivially destructible types may be made here.
+class arena {
+    public:
+        explicit arena(size_t block_size = size_t(1) << 20): block_size(block_size) {}
+
+        arena(const arena&) = delete;
+        arena& operator=(const arena&) = delete;
+
+        ~arena() {
+            for (char* b : blocks) ::operator delete(b);
+        }
+
+        void* allocate(size_t size, size_t align) {
+            uintptr_t p = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~uintptr_t(align - 1);
+            if (!cursor || p + size > reinterpret_cast<uintptr_t>(block_end)) {
+                // New block, big enough even for oversized requests
+                size_t n = size + align > block_size ? size + align : block_size;
+                char* b = static_cast<char*>(::operator new(n));
+                blocks.push_back(b);
+                cursor = b;
+                block_end = b + n;
+                reserved += n;
+                p = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~uintptr_t(align - 1);
+            }
+            cursor = reinterpret_cast<char*>(p + size);
+            used += size;
+            return reinterpret_cast<void*>(p);
+        }
+
+        template <typename T, typename... Args>
+        T* make(Args&&... args) {
+            static_assert(std::is_trivially_destructible<T>::value, "arena never runs destructors");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        size_t bytes_used() const { return used; }
+        size_t bytes_reserved() const { return reserved; }
+
+    private:
+        size_t block_size;
+        std::vector<char*> blocks;
+        char* cursor = nullptr;
+        char* block_end = nullptr;
+        size_t used = 0;
+        size_t reserved = 0;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// Benchmark for the BVH, builds a bvh_node over N random spheres and
+// compares its traversal rate against testing the plain hittable_list
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// N small spheres scattered through a cube around the origin
+hittable_list random_spheres(int n) {
+    hittable_list world;
+    // Only intersections are timed, every sphere shares material 0
+    const uint32_t mat = 0;
+    // Keep the density about constant as n grows
+    double extent = cbrt(static_cast<double>(n)) * 2.0;
+    for (int i = 0; i < n; i++) {
+        point3 center = vec3::random(-extent, extent);
+        world.add(make_shared<sphere>(center, random_double(0.2, 0.6), mat));
+    }
+    return world;
+}
+
+// Rays from a shell around the scene aimed at random points inside it
+std::vector<ray> random_rays(int n, double extent) {
+    std::vector<ray> rays;
+    for (int i = 0; i < n; i++) {
+        point3 origin = 3 * extent * random_unit_vector();
+        point3 target = vec3::random(-extent, extent);
+        rays.push_back(ray(origin, target - origin));
+    }
+    return rays;
+}
+
+// Traces every ray, returns rays per second and
+// the number of rays that hit something
+double trace(const hittable& world, const std::vector<ray>& rays, int& hits, double& t_sum) {
+    hit_record rec;
+    hits = 0;
+    t_sum = 0;
+    auto start = bench_clock::now();
+    for (const auto& r : rays) {
+        if (world.hit(r, 0.001, infinity, rec)) {
+            hits++;
+            t_sum += rec.t;
+        }
+    }
+    return rays.size() / seconds_since(start);
+}
+
+int main(int argc, char** argv) {
+    int n = 100000;
+    int ray_count = 1000000;
+    int list_ray_count = 2000;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--spheres") && a + 1 < argc) n = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rays") && a + 1 < argc) ray_count = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--list-rays") && a + 1 < argc) list_ray_count = atoi(argv[++a]);
+    }
+
+    seed_random(1, 0);
+    hittable_list world = random_spheres(n);
+    double extent = cbrt(static_cast<double>(n)) * 2.0;
+
+    auto start = bench_clock::now();
+    bvh_node bvh(world);
+    double build_time = seconds_since(start);
+
+    start = bench_clock::now();
+    linear_bvh flat(world);
+    double flat_build_time = seconds_since(start);
+
+    std::vector<ray> rays = random_rays(ray_count, extent);
+    std::vector<ray> list_rays(rays.begin(), rays.begin() + std::min(list_ray_count, ray_count));
+
+    int bvh_hits, flat_hits, list_hits, check_hits, flat_check_hits;
+    double bvh_t, flat_t, list_t, check_t, flat_check_t;
+    double list_rate = trace(world, list_rays, list_hits, list_t);
+    double bvh_rate = trace(bvh, rays, bvh_hits, bvh_t);
+    double flat_rate = trace(flat, rays, flat_hits, flat_t);
+    // Same rays through the BVHs to make sure they all agree
+    trace(bvh, list_rays, check_hits, check_t);
+    trace(flat, list_rays, flat_check_hits, flat_check_t);
+    auto agrees = [&](int hits, double t) {
+        return hits == list_hits && fabs(t - list_t) < 1e-6 * (1 + list_t);
+    };
+
+    printf("spheres:            %d\n", n);
+    printf("bvh build:          %.3f s (%u hardware threads)\n", build_time, std::thread::hardware_concurrency());
+    printf("list traversal:     %.0f rays/s (%zu rays)\n", list_rate, list_rays.size());
+    printf("linear bvh build:   %.3f s (%zu nodes, %zu bytes)\n", flat_build_time,
+        flat.nodes.size(), flat.nodes.size() * sizeof(linear_bvh_node));
+    printf("bvh traversal:      %.0f rays/s (%zu rays)\n", bvh_rate, rays.size());
+    printf("linear bvh:         %.0f rays/s (%zu rays)\n", flat_rate, rays.size());
+    printf("speedup vs list:    %.1fx bvh, %.1fx linear bvh\n", bvh_rate / list_rate, flat_rate / list_rate);
+    printf("hits agree:         %s (%d/%d bvh, %d/%d linear bvh)\n",
+        (agrees(check_hits, check_t) && agrees(flat_check_hits, flat_check_t)) ? "yes" : "NO",
+        check_hits, list_hits, flat_check_hits, list_hits);
+}
@@ -0,0 +1,192 @@
+// Convergence benchmark for the --lights modes on the lit room scene,
+// whose only light comes from two small emissive spheres. Renders an mis
+// reference with many samples, then every mode at a range of spp, and
+// reports each image's RMSE against the reference and its mean (all
+// three modes are unbiased, so the means should agree). The summary is
+// how many spp and seconds nee and mis need for the error plain bsdf
+// sampling reaches at the highest spp. The reference's own noise puts a
+// floor under the errors, so once nee and mis flatten out give it more
+// samples. Arguments after the options go to every render, e.g.
+//   ./bench_lights --max-spp 256 -- --sampler sobol
+#include "scenes.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct float_image {
+    int width = 0, height = 0;
+    std::vector<float> rgb;
+};
+
+// Reads the little endian PFM files main writes
+bool read_pfm(const std::string& path, float_image& image) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char magic[3] = {};
+    double scale;
+    bool ok = fscanf(f, "%2s %d %d %lf", magic, &image.width, &image.height, &scale) == 4 && !strcmp(magic, "PF") && scale < 0;
+    if (ok) {
+        fgetc(f);
+        image.rgb.resize(size_t(image.width) * image.height * 3);
+        ok = fread(image.rgb.data(), sizeof(float), image.rgb.size(), f) == image.rgb.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+// Runs one render, returns wall seconds or a negative value on failure
+double render(const std::string& args, const std::string& output) {
+    std::string command = "./main " + args + " --format pfm --output " + output + " 2>/dev/null";
+    auto start = bench_clock::now();
+    int status = system(command.c_str());
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return status == 0 ? seconds : -1.0;
+}
+
+// In 8 bit display units after gamma, like the images people look at
+double rmse(const float_image& a, const float_image& b) {
+    auto display = [](float v) { return std::fmin(std::sqrt(std::fmax(double(v), 0.0)), 0.999) * 256; };
+    double sum = 0;
+    for (size_t k = 0; k < a.rgb.size(); k++) {
+        double d = display(a.rgb[k]) - display(b.rgb[k]);
+        sum += d * d;
+    }
+    return std::sqrt(sum / a.rgb.size());
+}
+
+// Linear, unclamped, so fireflies count at their full weight
+double mean(const float_image& image) {
+    double sum = 0;
+    for (float v : image.rgb) sum += v;
+    return sum / image.rgb.size();
+}
+
+struct point {
+    int spp;
+    double seconds;
+    double rmse;
+};
+
+// spp where the error curve crosses target, interpolated in log-log
+double spp_for_error(const std::vector<point>& curve, double target) {
+    for (size_t k = 0; k < curve.size(); k++) {
+        if (curve[k].rmse > target) continue;
+        if (k == 0) return curve[0].spp;
+        const point& a = curve[k - 1];
+        const point& b = curve[k];
+        double t = std::log(a.rmse / target) / std::log(a.rmse / b.rmse);
+        return std::exp(std::log(double(a.spp)) + t * std::log(double(b.spp) / a.spp));
+    }
+    return -1;
+}
+
+// Seconds at the same crossing, interpolated the same way
+double seconds_for_error(const std::vector<point>& curve, double target) {
+    for (size_t k = 0; k < curve.size(); k++) {
+        if (curve[k].rmse > target) continue;
+        if (k == 0) return curve[0].seconds;
+        const point& a = curve[k - 1];
+        const point& b = curve[k];
+        double t = std::log(a.rmse / target) / std::log(a.rmse / b.rmse);
+        return std::exp(std::log(a.seconds) + t * std::log(b.seconds / a.seconds));
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    int reference_spp = 1024;
+    int max_spp = 128;
+    int width = 100;
+    std::string args;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--reference-spp") && a + 1 < argc) {
+            reference_spp = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--max-spp") && a + 1 < argc) {
+            max_spp = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--width") && a + 1 < argc) {
+            width = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--")) {
+            for (a++; a < argc; a++) args += std::string(" ") + argv[a];
+        } else {
+            fprintf(stderr, "Usage: %s [--reference-spp N] [--max-spp N] [--width W] [-- render options]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // The room with a smaller image, a later image statement overrides
+    const std::string scene_path = "bench_lights_room.scene";
+    FILE* f = fopen(scene_path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", scene_path.c_str());
+        return 1;
+    }
+    fprintf(f, "%s\nimage width %d\n", lit_room_scene, width);
+    fclose(f);
+    args = " --scene " + scene_path + args;
+
+    // The reference gets its own seed so no mode shares its noise
+    const std::string reference_path = "bench_lights_reference.pfm";
+    printf("rendering the %d spp mis reference\n", reference_spp);
+    fflush(stdout);
+    float_image reference;
+    if (render(args + " --lights mis --seed 1000003 --spp " + std::to_string(reference_spp), reference_path) < 0 ||
+        !read_pfm(reference_path, reference)) {
+        fprintf(stderr, "./main failed, build it with make first\n");
+        remove(scene_path.c_str());
+        return 1;
+    }
+    remove(reference_path.c_str());
+
+    const char* modes[] = {"bsdf", "nee", "mis"};
+    const int mode_count = 3;
+    std::vector<point> curves[mode_count];
+    double means[mode_count] = {};
+
+    printf("render:%s\n", args.c_str());
+    printf("%-6s %6s %9s %9s %10s %9s\n", "lights", "spp", "seconds", "rmse", "vs bsdf", "mean");
+    for (int spp = 1; spp <= max_spp; spp *= 2) {
+        for (int k = 0; k < mode_count; k++) {
+            std::string output = "bench_lights_image.pfm";
+            double seconds = render(args + " --lights " + modes[k] + " --spp " + std::to_string(spp), output);
+            float_image image;
+            if (seconds < 0 || !read_pfm(output, image) || image.width != reference.width ||
+                image.height != reference.height) {
+                fprintf(stderr, "%s at %d spp failed\n", modes[k], spp);
+                remove(scene_path.c_str());
+                return 1;
+            }
+            remove(output.c_str());
+            double e = rmse(image, reference);
+            means[k] = mean(image);
+            curves[k].push_back({spp, seconds, e});
+            printf("%-6s %6d %9.3f %9.3f %9.2fx %9.4f\n", modes[k], spp, seconds, e, curves[0].back().rmse / e, means[k]);
+        }
+    }
+    remove(scene_path.c_str());
+
+    printf("\nreference mean %.4f\n", mean(reference));
+    // Same error as bsdf sampling at the top spp, for how much less work
+    const point& target = curves[0].back();
+    printf("spp and seconds for the error bsdf sampling has at %d spp (%.3f, %.2f s):\n", target.spp, target.rmse,
+           target.seconds);
+    for (int k = 0; k < mode_count; k++) {
+        double spp = spp_for_error(curves[k], target.rmse);
+        double seconds = seconds_for_error(curves[k], target.rmse);
+        if (spp < 0) {
+            printf("  %-6s not reached by %d spp\n", modes[k], max_spp);
+        } else if (k > 0 && spp == curves[k][0].spp) {
+            printf("  %-6s already below it at %d spp (over %.0fx fewer), %6.2f s\n", modes[k], curves[k][0].spp,
+                   target.spp / spp, seconds);
+        } else {
+            printf("  %-6s %7.1f spp (%.1fx fewer), %6.2f s (%.1fx less)\n", modes[k], spp, target.spp / spp, seconds,
+                   target.seconds / seconds);
+        }
+    }
+}
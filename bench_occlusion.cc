@@ -0,0 +1,156 @@
+// Benchmark for occluded() against hit() on growing random sphere
+// scenes, through every accelerator. Shadow rays are segments between
+// two points inside the scene: short ones (a few sphere spacings, mostly
+// clear) and long ones across the whole scene (mostly blocked). Blocked
+// and clear rays are timed apart: stopping at the first blocker only
+// helps the blocked ones, a clear ray has to look at everything along
+// it either way. Also checks that both queries agree on every ray.
+//   ./bench_occlusion --sizes 1000,100000,1000000 --rays 200000
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// A unit direction ray from a to b with the distance to b
+struct segment {
+    ray r;
+    real length;
+};
+
+// Segments between random points of the cube, at most max_length long
+std::vector<segment> random_segments(int n, double extent, double max_length) {
+    std::vector<segment> segments;
+    for (int i = 0; i < n; i++) {
+        point3 a = vec3::random(-extent, extent);
+        point3 b = a + random_double(0.5, max_length) * random_unit_vector();
+        vec3 d = b - a;
+        segments.push_back({ray(a, unit_vector(d)), d.length()});
+    }
+    return segments;
+}
+
+struct query_result {
+    double ns_per_ray;
+    std::vector<uint8_t> blocked;
+};
+
+// Best of 3 passes over the segments, with hit() or occluded()
+query_result run(const hittable& world, const std::vector<segment>& segments, bool any_hit) {
+    query_result res;
+    res.blocked.resize(segments.size());
+    double best = infinity;
+    for (int pass = 0; pass < 3; pass++) {
+        hit_record rec;
+        auto start = bench_clock::now();
+        for (size_t k = 0; k < segments.size(); k++) {
+            const segment& s = segments[k];
+            res.blocked[k] = any_hit ? world.occluded(s.r, ray_epsilon, s.length)
+                                     : world.hit(s.r, ray_epsilon, s.length, rec);
+        }
+        best = std::min(best, seconds_since(start));
+    }
+    res.ns_per_ray = best * 1e9 / segments.size();
+    return res;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes = {1000, 100000, 1000000};
+    int ray_count = 200000;
+    // The list and sphere_soa test every sphere, they only run up to this
+    int flat_limit = 10000;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--sizes") && a + 1 < argc) {
+            sizes.clear();
+            for (char* p = argv[++a]; *p;) {
+                sizes.push_back(static_cast<int>(strtol(p, &p, 10)));
+                if (*p == ',') p++;
+                else if (*p) break;
+            }
+        } else if (!strcmp(argv[a], "--rays") && a + 1 < argc) {
+            ray_count = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--flat-limit") && a + 1 < argc) {
+            flat_limit = atoi(argv[++a]);
+        } else {
+            fprintf(stderr, "Usage: %s [--sizes N,N,...] [--rays N] [--flat-limit N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%9s %-11s %-6s %8s | %-25s | %-25s | %5s\n", "", "", "", "", "  blocked rays, ns/ray", "  clear rays, ns/ray", "");
+    printf("%9s %-11s %-6s %8s | %7s %7s %9s | %7s %7s %9s | %5s\n", "spheres", "accel", "rays", "blocked",
+           "hit", "occl.", "speedup", "hit", "occl.", "speedup", "agree");
+    bool all_agree = true;
+    for (int n : sizes) {
+        scene sc;
+        random_sphere_scene(sc, n, 1);
+        double extent = cbrt(static_cast<double>(n)) * 2.0;
+
+        // Accelerators to compare, the mapped cache is what huge scenes use
+        std::vector<std::pair<std::string, shared_ptr<hittable>>> accels;
+        if (n <= flat_limit) {
+            accels.push_back({"list", make_shared<hittable_list>(sc.world)});
+            accels.push_back({"soa", make_shared<sphere_soa>(sc.world)});
+        }
+        accels.push_back({"bvh", make_shared<bvh_node>(sc.world)});
+        accels.push_back({"linear_bvh", make_shared<linear_bvh>(sc.world)});
+        const std::string cache_path = "bench_occlusion.cache";
+        std::string why;
+        scene_cache cache;
+        if (write_scene_cache(cache_path, sc, 0, why) && cache.open(cache_path, 0, why)) {
+            accels.push_back({"cache", cache.accelerator()});
+        } else {
+            fprintf(stderr, "scene cache: %s\n", why.c_str());
+        }
+
+        seed_random(2, 0);
+        std::vector<segment> short_rays = random_segments(ray_count, extent, 4.0);
+        std::vector<segment> long_rays = random_segments(ray_count, extent, 2 * extent);
+        for (const auto& accel : accels) {
+            // The flat structures get a tenth of the rays, they are slow
+            size_t count = n <= flat_limit && (accel.first == "list" || accel.first == "soa") ? ray_count / 10 : ray_count;
+            for (int set = 0; set < 2; set++) {
+                const std::vector<segment>& all = set ? long_rays : short_rays;
+                std::vector<segment> rays(all.begin(), all.begin() + count);
+                query_result closest = run(*accel.second, rays, false);
+                query_result any = run(*accel.second, rays, true);
+                bool agree = closest.blocked == any.blocked;
+                all_agree &= agree;
+
+                // Split by what hit() found and time each side on its own
+                std::vector<segment> split[2];
+                for (size_t k = 0; k < rays.size(); k++) split[closest.blocked[k]].push_back(rays[k]);
+                double hit_ns[2] = {}, any_ns[2] = {};
+                for (int b = 0; b < 2; b++) {
+                    if (split[b].empty()) continue;
+                    hit_ns[b] = run(*accel.second, split[b], false).ns_per_ray;
+                    any_ns[b] = run(*accel.second, split[b], true).ns_per_ray;
+                }
+                printf("%9d %-11s %-6s %7.1f%% | %7.0f %7.0f %8.2fx | %7.0f %7.0f %8.2fx | %5s\n", n, accel.first.c_str(),
+                       set ? "long" : "short", 100.0 * split[1].size() / rays.size(),
+                       hit_ns[1], any_ns[1], any_ns[1] > 0 ? hit_ns[1] / any_ns[1] : 0,
+                       hit_ns[0], any_ns[0], any_ns[0] > 0 ? hit_ns[0] / any_ns[0] : 0, agree ? "yes" : "NO");
+                fflush(stdout);
+            }
+        }
+        remove(cache_path.c_str());
+    }
+    return all_agree ? 0 : 1;
+}
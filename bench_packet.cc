@@ -0,0 +1,153 @@
+// Benchmark for packet tracing, intersects the camera rays of 8x8 pixel
+// blocks one ray at a time and as ray packets, then does the same for
+// the first bounce rays, which are much less coherent
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "ray_packet.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+// The random sphere field from the cover of the book
+hittable_list random_scene(material_table& materials) {
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            if ((center - point3(4, 0.2, 0)).length() <= 0.9) continue;
+            material m;
+            if (choose_mat < 0.8) m = lambertian(color::random() * color::random());
+            else if (choose_mat < 0.95) m = metal(color::random(0.5, 1), random_double(0, 0.5));
+            else m = dielectric(1.5);
+            world.add(make_shared<sphere>(center, 0.2, materials.add(m)));
+        }
+    }
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, materials.add(dielectric(1.5))));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, materials.add(lambertian(color(0.4, 0.2, 0.1)))));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, materials.add(metal(color(0.7, 0.6, 0.5), 0.0))));
+    return world;
+}
+
+struct packet_batch {
+    std::vector<ray_packet> packets;
+    std::vector<uint64_t> masks;
+    long ray_count = 0;
+};
+
+// Times one hit() per live lane against one hit_packet() per packet,
+// returns rays per second for both
+void measure(const hittable& world, const packet_batch& batch, int repeats, double& scalar_rate, double& packet_rate) {
+    hit_record rec;
+    hit_packet_record recs;
+    long hits_scalar = 0, hits_packet = 0;
+
+    auto start = bench_clock::now();
+    for (int k = 0; k < repeats; k++) {
+        for (size_t p = 0; p < batch.packets.size(); p++) {
+            for (uint64_t m = batch.masks[p]; m; m &= m - 1) {
+                int l = first_lane(m);
+                if (world.hit(batch.packets[p].get(l), 0.001, infinity, rec)) hits_scalar++;
+            }
+        }
+    }
+    double scalar_time = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    start = bench_clock::now();
+    for (int k = 0; k < repeats; k++) {
+        for (size_t p = 0; p < batch.packets.size(); p++) {
+            recs.reset(infinity);
+            world.hit_packet(batch.packets[p], batch.masks[p], 0.001, recs);
+            hits_packet += __builtin_popcountll(recs.hit);
+        }
+    }
+    double packet_time = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    if (hits_scalar != hits_packet) printf("  MISMATCH: %ld scalar hits, %ld packet hits\n", hits_scalar, hits_packet);
+    scalar_rate = repeats * batch.ray_count / scalar_time;
+    packet_rate = repeats * batch.ray_count / packet_time;
+}
+
+int main(int argc, char** argv) {
+    int image_width = 400;
+    int repeats = 4;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--width") && a + 1 < argc) image_width = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--repeats") && a + 1 < argc) repeats = atoi(argv[++a]);
+    }
+    const auto aspect_ratio = 16.0 / 9.0;
+    int image_height = static_cast<int>(image_width / aspect_ratio);
+
+    seed_random(1, 0);
+    material_table materials;
+    hittable_list world = random_scene(materials);
+    linear_bvh bvh(world);
+    point3 lookfrom(13, 2, 3), lookat(0, 0, 0);
+    camera cam(lookfrom, lookat, vec3(0, 1, 0), 20, aspect_ratio, 0.1, 10.0);
+
+    // Camera rays, one packet per 8x8 block
+    packet_batch primary;
+    for (int y = 0; y < image_height; y += 8) {
+        for (int x = 0; x < image_width; x += 8) {
+            ray_packet p;
+            uint64_t mask = 0;
+            for (int l = 0; l < ray_packet::size; l++) {
+                int i = x + l % 8, j = y + l / 8;
+                if (i >= image_width || j >= image_height) continue;
+                p.set(l, cam.get_ray((i + random_double()) / (image_width - 1), (j + random_double()) / (image_height - 1)));
+                mask |= lane_bit(l);
+                primary.ray_count++;
+            }
+            primary.packets.push_back(p);
+            primary.masks.push_back(mask);
+        }
+    }
+
+    // First bounce rays, scattered off whatever each camera ray hit
+    packet_batch secondary;
+    hit_packet_record recs;
+    for (size_t p = 0; p < primary.packets.size(); p++) {
+        recs.reset(infinity);
+        bvh.hit_packet(primary.packets[p], primary.masks[p], 0.001, recs);
+        ray_packet bounce;
+        uint64_t mask = 0;
+        for (uint64_t m = recs.hit; m; m &= m - 1) {
+            int l = first_lane(m);
+            ray scattered;
+            color attenuation;
+            if (scatter(materials[recs.rec[l].material_id], primary.packets[p].get(l), recs.rec[l], attenuation, scattered)) {
+                bounce.set(l, scattered);
+                mask |= lane_bit(l);
+                secondary.ray_count++;
+            }
+        }
+        if (mask) {
+            secondary.packets.push_back(bounce);
+            secondary.masks.push_back(mask);
+        }
+    }
+
+    printf("scene: %zu spheres, %dx%d, %ld primary rays, %ld secondary rays\n",
+        world.objects.size(), image_width, image_height, primary.ray_count, secondary.ray_count);
+    printf("%-12s %-10s %14s %14s %9s\n", "accel", "rays", "scalar Mray/s", "packet Mray/s", "speedup");
+
+    const hittable* accels[] = {&bvh, &world};
+    const char* names[] = {"linear_bvh", "list"};
+    for (int k = 0; k < 2; k++) {
+        double scalar_rate, packet_rate;
+        measure(*accels[k], primary, repeats, scalar_rate, packet_rate);
+        printf("%-12s %-10s %14.3f %14.3f %8.2fx\n", names[k], "primary", scalar_rate / 1e6, packet_rate / 1e6, packet_rate / scalar_rate);
+        measure(*accels[k], secondary, repeats, scalar_rate, packet_rate);
+        printf("%-12s %-10s %14.3f %14.3f %8.2fx\n", names[k], "secondary", scalar_rate / 1e6, packet_rate / 1e6, packet_rate / scalar_rate);
+    }
+}
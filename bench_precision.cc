@@ -0,0 +1,118 @@
+// Benchmark for the float build, renders the same scene with the double
+// build (./main) and the float builds (./main_float, ./main_float_padded)
+// and reports the speedup and how far the float images are from the
+// double one. Arguments after the options go to every render, e.g.
+//   ./bench_precision -- --scene big.scene --spp 16
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct float_image {
+    int width = 0, height = 0;
+    std::vector<float> rgb;
+};
+
+// Reads the little endian PFM files main writes
+bool read_pfm(const std::string& path, float_image& image) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char magic[3] = {};
+    double scale;
+    bool ok = fscanf(f, "%2s %d %d %lf", magic, &image.width, &image.height, &scale) == 4 && !strcmp(magic, "PF") && scale < 0;
+    if (ok) {
+        fgetc(f);
+        image.rgb.resize(size_t(image.width) * image.height * 3);
+        ok = fread(image.rgb.data(), sizeof(float), image.rgb.size(), f) == image.rgb.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+// Runs one render, returns wall seconds or a negative value on failure
+double render(const std::string& binary, const std::string& args, const std::string& output) {
+    std::string command = binary + " " + args + " --output " + output + " 2>/dev/null";
+    auto start = bench_clock::now();
+    int status = system(command.c_str());
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return status == 0 ? seconds : -1.0;
+}
+
+struct image_error {
+    double rmse = 0;        // in 8 bit display units, after gamma
+    double max = 0;
+    double psnr = 0;
+    double differing = 0;   // fraction of 8 bit channel values that changed
+};
+
+image_error compare(const float_image& a, const float_image& b) {
+    image_error e;
+    double sum = 0;
+    long changed = 0;
+    for (size_t k = 0; k < a.rgb.size(); k++) {
+        // Same mapping as resolve_8bit
+        auto display = [](float v) { return std::fmin(std::sqrt(std::fmax(double(v), 0.0)), 0.999) * 256; };
+        double da = display(a.rgb[k]), db = display(b.rgb[k]);
+        double d = da - db;
+        sum += d * d;
+        e.max = std::fmax(e.max, std::fabs(d));
+        if (int(da) != int(db)) changed++;
+    }
+    e.rmse = std::sqrt(sum / a.rgb.size());
+    e.psnr = e.rmse > 0 ? 20 * std::log10(255.0 / e.rmse) : INFINITY;
+    e.differing = double(changed) / a.rgb.size();
+    return e;
+}
+
+int main(int argc, char** argv) {
+    int repeats = 1;
+    std::string args;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--repeats") && a + 1 < argc) {
+            repeats = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--")) {
+            for (a++; a < argc; a++) args += std::string(" ") + argv[a];
+        } else {
+            fprintf(stderr, "Usage: %s [--repeats N] [-- render options]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const char* builds[] = {"./main", "./main_float", "./main_float_padded"};
+    float_image images[3];
+    double times[3];
+    for (int b = 0; b < 3; b++) {
+        std::string output = std::string("bench_precision_") + std::to_string(b) + ".pfm";
+        times[b] = INFINITY;
+        for (int k = 0; k < repeats; k++) {
+            double t = render(builds[b], args, output);
+            if (t < 0) {
+                fprintf(stderr, "%s failed, build it with make first\n", builds[b]);
+                return 1;
+            }
+            times[b] = std::fmin(times[b], t);
+        }
+        if (!read_pfm(output, images[b])) {
+            fprintf(stderr, "cannot read %s\n", output.c_str());
+            return 1;
+        }
+        remove(output.c_str());
+    }
+
+    printf("render:%s\n", args.empty() ? " default scene" : args.c_str());
+    printf("%-22s %9s %8s %10s %10s %9s %10s\n", "build", "seconds", "speedup", "rmse", "max err", "psnr dB", "changed");
+    for (int b = 0; b < 3; b++) {
+        if (images[b].width != images[0].width || images[b].height != images[0].height) {
+            printf("%-22s image size differs\n", builds[b]);
+            continue;
+        }
+        image_error e = compare(images[b], images[0]);
+        printf("%-22s %9.3f %7.2fx %10.4f %10.2f %9.1f %9.2f%%\n", builds[b], times[b], times[0] / times[b],
+               e.rmse, e.max, e.psnr, 100 * e.differing);
+    }
+}
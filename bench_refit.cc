@@ -0,0 +1,148 @@
+// Benchmark for refitting the linear BVH after spheres move, against
+// building it again from scratch every frame. For 1%, 10% and 100% of
+// the spheres moving it times both, tracks how far the refitted tree's
+// SAH cost drifts from a fresh build, traces the same rays through both
+// and counts the rebuilds the automatic policy falls back to.
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Rays from a shell around the scene aimed at random points inside it
+std::vector<ray> random_rays(int n, double extent) {
+    std::vector<ray> rays;
+    for (int i = 0; i < n; i++) {
+        point3 origin = 3 * extent * random_unit_vector();
+        point3 target = vec3::random(-extent, extent);
+        rays.push_back(ray(origin, target - origin));
+    }
+    return rays;
+}
+
+// Rays per second, plus the hit count and summed hit distances to compare trees
+double trace(const hittable& world, const std::vector<ray>& rays, int& hits, double& t_sum) {
+    hit_record rec;
+    hits = 0;
+    t_sum = 0;
+    auto start = bench_clock::now();
+    for (const auto& r : rays) {
+        if (world.hit(r, 0.001, infinity, rec)) {
+            hits++;
+            t_sum += rec.t;
+        }
+    }
+    return rays.size() / seconds_since(start);
+}
+
+struct refit_result {
+    double refit_seconds = 0;       // per frame, refit only
+    double rebuild_seconds = 0;     // per frame, full build
+    double auto_seconds = 0;        // per frame, refit with automatic rebuilds
+    int auto_rebuilds = 0;
+    double cost_growth = 0;         // refitted SAH cost over a fresh build's, last frame
+    double refit_rate = 0;          // rays/s through the refitted tree, last frame
+    double rebuilt_rate = 0;        // rays/s through a fresh build, last frame
+    bool agree = false;
+};
+
+refit_result run(int n, double fraction, int frames, double speed, const std::vector<ray>& rays) {
+    // Same spheres for every fraction, only how many of them move differs
+    seed_random(1, 0);
+    double extent = cbrt(static_cast<double>(n)) * 2.0;
+    hittable_list world;
+    std::vector<sphere*> spheres;
+    for (int i = 0; i < n; i++) {
+        auto s = make_shared<sphere>(vec3::random(-extent, extent), random_double(0.2, 0.6), 0);
+        spheres.push_back(s.get());
+        world.add(s);
+    }
+    std::vector<uint32_t> moving(n);
+    for (int i = 0; i < n; i++) moving[i] = i;
+    for (int i = n - 1; i > 0; i--) std::swap(moving[i], moving[static_cast<int>(random_double() * (i + 1))]);
+    moving.resize(std::max(1, static_cast<int>(fraction * n)));
+    std::vector<vec3> velocity;
+    for (size_t k = 0; k < moving.size(); k++) velocity.push_back(speed * random_unit_vector());
+
+    linear_bvh refitted(world);
+    refitted.rebuild_growth = infinity;
+    linear_bvh automatic(world);
+
+    refit_result result;
+    for (int f = 0; f < frames; f++) {
+        for (size_t k = 0; k < moving.size(); k++) {
+            sphere* s = spheres[moving[k]];
+            s->move_to(s->center + velocity[k]);
+            world.mark_dirty(moving[k]);
+        }
+        // Both trees consume the dirty set, so it is marked again in between
+        std::vector<uint32_t> dirty = world.dirty;
+
+        auto start = bench_clock::now();
+        refitted.refit(world);
+        result.refit_seconds += seconds_since(start);
+
+        for (uint32_t index : dirty) world.mark_dirty(index);
+        start = bench_clock::now();
+        if (automatic.refit(world)) result.auto_rebuilds++;
+        result.auto_seconds += seconds_since(start);
+
+        start = bench_clock::now();
+        linear_bvh fresh(world);
+        result.rebuild_seconds += seconds_since(start);
+
+        if (f == frames - 1) {
+            result.cost_growth = refitted.sah_cost() / fresh.sah_cost();
+            int refit_hits, fresh_hits;
+            double refit_t, fresh_t;
+            result.refit_rate = trace(refitted, rays, refit_hits, refit_t);
+            result.rebuilt_rate = trace(fresh, rays, fresh_hits, fresh_t);
+            result.agree = refit_hits == fresh_hits && fabs(refit_t - fresh_t) < 1e-6 * (1 + fresh_t);
+        }
+    }
+    result.refit_seconds /= frames;
+    result.rebuild_seconds /= frames;
+    result.auto_seconds /= frames;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    int n = 200000;
+    int frames = 10;
+    int ray_count = 200000;
+    // Distance a moving sphere travels per frame, about its radius
+    double speed = 0.4;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--spheres") && a + 1 < argc) n = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--frames") && a + 1 < argc) frames = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rays") && a + 1 < argc) ray_count = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--speed") && a + 1 < argc) speed = atof(argv[++a]);
+    }
+
+    seed_random(2, 0);
+    std::vector<ray> rays = random_rays(ray_count, cbrt(static_cast<double>(n)) * 2.0);
+
+    printf("spheres: %d, frames: %d, speed: %.2f per frame, rays: %d\n", n, frames, speed, ray_count);
+    printf("%8s %10s %11s %8s %10s %9s %12s %12s %7s\n", "moving", "refit ms", "rebuild ms", "speedup",
+           "auto ms", "rebuilds", "SAH growth", "trace loss", "agree");
+    const double fractions[] = {0.01, 0.1, 1.0};
+    for (double fraction : fractions) {
+        refit_result r = run(n, fraction, frames, speed, rays);
+        printf("%7.0f%% %10.3f %11.3f %7.1fx %10.3f %9d %11.3fx %11.1f%% %7s\n", 100 * fraction,
+               1e3 * r.refit_seconds, 1e3 * r.rebuild_seconds, r.rebuild_seconds / r.refit_seconds,
+               1e3 * r.auto_seconds, r.auto_rebuilds, r.cost_growth,
+               100 * (1 - r.refit_rate / r.rebuilt_rate), r.agree ? "yes" : "NO");
+    }
+}
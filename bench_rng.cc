@@ -0,0 +1,84 @@
+// Microbenchmark for the random number path, compares the old
+// rand() based random_double() against the per-thread generators
+// in rng.h, both for raw draws and for random_in_unit_sphere
+// style samples (what lambertian/metal actually consume)
+#include "rtweekend.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// The old rtweekend.h random_double()
+inline double rand_double() {
+    return rand() / (RAND_MAX + 1.0);
+}
+
+template <typename F>
+vec3 rejection_sample(F next) {
+    while (true) {
+        vec3 p(2 * next() - 1, 2 * next() - 1, 2 * next() - 1);
+        if (p.length_squared() < 1) return p;
+    }
+}
+
+// Runs body(count) on every thread of the pool at once and returns
+// the combined samples per second
+template <typename F>
+double measure(thread_pool& pool, long count, F body) {
+    auto start = std::chrono::steady_clock::now();
+    pool.run(pool.size(), [&](int, int) { body(count); });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return pool.size() * count / elapsed.count();
+}
+
+// Sink so the compiler can't drop the loops
+volatile double sink;
+
+template <typename G>
+void bench_generator(thread_pool& pool, long count, const char* name) {
+    double draws = measure(pool, count, [](long n) {
+        G g;
+        g.seed(1, 2);
+        double acc = 0;
+        for (long k = 0; k < n; k++) acc += g.next_double();
+        sink = acc;
+    });
+    double spheres = measure(pool, count / 4, [](long n) {
+        G g;
+        g.seed(1, 2);
+        vec3 acc;
+        for (long k = 0; k < n; k++) acc += rejection_sample([&] { return g.next_double(); });
+        sink = acc.x();
+    });
+    printf("%-14s %14.1f %14.1f\n", name, draws / 1e6, spheres / 1e6);
+}
+
+int main(int argc, char** argv) {
+    int threads = 1;
+    long count = 20000000;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--threads") && a + 1 < argc) threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--count") && a + 1 < argc) count = atol(argv[++a]);
+    }
+
+    thread_pool pool(threads);
+    printf("threads: %d, draws per thread: %ld\n", pool.size(), count);
+    printf("%-14s %14s %14s\n", "generator", "Mdraws/s", "Msphere/s");
+
+    double draws = measure(pool, count, [](long n) {
+        double acc = 0;
+        for (long k = 0; k < n; k++) acc += rand_double();
+        sink = acc;
+    });
+    double spheres = measure(pool, count / 4, [](long n) {
+        vec3 acc;
+        for (long k = 0; k < n; k++) acc += rejection_sample(rand_double);
+        sink = acc.x();
+    });
+    printf("%-14s %14.1f %14.1f\n", "rand()", draws / 1e6, spheres / 1e6);
+
+    bench_generator<pcg32>(pool, count, "pcg32");
+    bench_generator<xoshiro256pp>(pool, count, "xoshiro256++");
+}
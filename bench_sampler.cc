@@ -0,0 +1,156 @@
+// Convergence benchmark for the samplers. Renders a reference with many
+// samples, then every sampler at a range of spp, and reports each
+// image's RMSE against the reference with the wall time it took, so the
+// error can be plotted against both spp and seconds (--csv). The summary
+// is how many spp each sampler needs for the error independent sampling
+// reaches at the highest spp. Arguments after the options go to every
+// render, e.g.
+//   ./bench_sampler --reference-spp 4096 -- --scene glass.scene
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+struct float_image {
+    int width = 0, height = 0;
+    std::vector<float> rgb;
+};
+
+// Reads the little endian PFM files main writes
+bool read_pfm(const std::string& path, float_image& image) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char magic[3] = {};
+    double scale;
+    bool ok = fscanf(f, "%2s %d %d %lf", magic, &image.width, &image.height, &scale) == 4 && !strcmp(magic, "PF") && scale < 0;
+    if (ok) {
+        fgetc(f);
+        image.rgb.resize(size_t(image.width) * image.height * 3);
+        ok = fread(image.rgb.data(), sizeof(float), image.rgb.size(), f) == image.rgb.size();
+    }
+    fclose(f);
+    return ok;
+}
+
+// Runs one render, returns wall seconds or a negative value on failure
+double render(const std::string& args, const std::string& output) {
+    std::string command = "./main " + args + " --format pfm --output " + output + " 2>/dev/null";
+    auto start = bench_clock::now();
+    int status = system(command.c_str());
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return status == 0 ? seconds : -1.0;
+}
+
+// In 8 bit display units after gamma, like the images people look at
+double rmse(const float_image& a, const float_image& b) {
+    auto display = [](float v) { return std::fmin(std::sqrt(std::fmax(double(v), 0.0)), 0.999) * 256; };
+    double sum = 0;
+    for (size_t k = 0; k < a.rgb.size(); k++) {
+        double d = display(a.rgb[k]) - display(b.rgb[k]);
+        sum += d * d;
+    }
+    return std::sqrt(sum / a.rgb.size());
+}
+
+struct point {
+    int spp;
+    double seconds;
+    double rmse;
+};
+
+// spp where the error curve crosses target, interpolated in log-log
+double spp_for_error(const std::vector<point>& curve, double target) {
+    for (size_t k = 0; k < curve.size(); k++) {
+        if (curve[k].rmse > target) continue;
+        if (k == 0) return curve[0].spp;
+        const point& a = curve[k - 1];
+        const point& b = curve[k];
+        double t = std::log(a.rmse / target) / std::log(a.rmse / b.rmse);
+        return std::exp(std::log(double(a.spp)) + t * std::log(double(b.spp) / a.spp));
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    int reference_spp = 1024;
+    int max_spp = 64;
+    std::string reference_path;
+    std::string csv_path;
+    std::string args;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--reference-spp") && a + 1 < argc) {
+            reference_spp = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--max-spp") && a + 1 < argc) {
+            max_spp = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--reference") && a + 1 < argc) {
+            reference_path = argv[++a];
+        } else if (!strcmp(argv[a], "--csv") && a + 1 < argc) {
+            csv_path = argv[++a];
+        } else if (!strcmp(argv[a], "--")) {
+            for (a++; a < argc; a++) args += std::string(" ") + argv[a];
+        } else {
+            fprintf(stderr, "Usage: %s [--reference-spp N] [--reference FILE] [--max-spp N] [--csv FILE] [-- render options]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    // The reference gets its own seed so no sampler shares its noise
+    float_image reference;
+    bool own_reference = reference_path.empty();
+    if (own_reference) {
+        reference_path = "bench_sampler_reference.pfm";
+        printf("rendering the %d spp reference\n", reference_spp);
+        fflush(stdout);
+        if (render(args + " --seed 1000003 --spp " + std::to_string(reference_spp), reference_path) < 0) {
+            fprintf(stderr, "./main failed, build it with make first\n");
+            return 1;
+        }
+    }
+    if (!read_pfm(reference_path, reference)) {
+        fprintf(stderr, "cannot read %s\n", reference_path.c_str());
+        return 1;
+    }
+    if (own_reference) remove(reference_path.c_str());
+
+    const char* samplers[] = {"independent", "sobol", "halton", "blue_noise"};
+    const int sampler_count = 4;
+    std::vector<point> curves[sampler_count];
+    FILE* csv = csv_path.empty() ? nullptr : fopen(csv_path.c_str(), "w");
+    if (csv) fprintf(csv, "sampler,spp,seconds,rmse\n");
+
+    printf("render:%s\n", args.empty() ? " default scene" : args.c_str());
+    printf("%-12s %6s %9s %9s %12s\n", "sampler", "spp", "seconds", "rmse", "vs indep.");
+    for (int spp = 1; spp <= max_spp; spp *= 2) {
+        for (int k = 0; k < sampler_count; k++) {
+            std::string output = "bench_sampler_image.pfm";
+            double seconds = render(args + " --sampler " + samplers[k] + " --spp " + std::to_string(spp), output);
+            float_image image;
+            if (seconds < 0 || !read_pfm(output, image) || image.width != reference.width ||
+                image.height != reference.height) {
+                fprintf(stderr, "%s at %d spp failed\n", samplers[k], spp);
+                return 1;
+            }
+            remove(output.c_str());
+            double e = rmse(image, reference);
+            curves[k].push_back({spp, seconds, e});
+            printf("%-12s %6d %9.3f %9.3f %11.2fx\n", samplers[k], spp, seconds, e, curves[0].back().rmse / e);
+            if (csv) fprintf(csv, "%s,%d,%.4f,%.5f\n", samplers[k], spp, seconds, e);
+        }
+    }
+    if (csv) fclose(csv);
+
+    // Same error as independent sampling at the top spp, for how much less work
+    const point& target = curves[0].back();
+    printf("\nspp for the error independent sampling has at %d spp (%.3f):\n", target.spp, target.rmse);
+    for (int k = 0; k < sampler_count; k++) {
+        double spp = spp_for_error(curves[k], target.rmse);
+        if (spp < 0) printf("  %-12s not reached by %d spp\n", samplers[k], max_spp);
+        else printf("  %-12s %6.1f spp (%.2fx fewer)\n", samplers[k], spp, target.spp / spp);
+    }
+}
@@ -0,0 +1,292 @@
+// Microbenchmarks and distribution checks for the sampling kernels in
+// sampling.h, against the rejection loops and library math they
+// replaced, plus the SSE inverse square root estimate that didn't make
+// it in. Every kernel is timed in ns per call on the thread's
+// generator, the way scattering calls it. Every shape, old and new, gets
+// a chi-square test over equal probability cells, and the approximations
+// get their worst error against the exact functions. Exits with 1 if a
+// distribution check fails.
+#include "rtweekend.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <xmmintrin.h>
+
+using bench_clock = std::chrono::steady_clock;
+
+// The rejection versions vec3.h had, as the baseline
+vec3 rejection_in_unit_sphere() {
+    while (true) {
+        auto p = vec3::random(-1, 1);
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
+vec3 rejection_unit_vector() {
+    return unit_vector(rejection_in_unit_sphere());
+}
+
+vec3 rejection_in_unit_disk() {
+    while (true) {
+        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
+// The book's lambertian direction, unnormalized
+vec3 sphere_offset_direction(const vec3& n) {
+    vec3 d = n + rejection_unit_vector();
+    return d.near_zero() ? n : d;
+}
+
+// 1/sqrt from the SSE estimate and Newton steps, the usual fast inverse
+// square root. It's measured here rather than used: at the build's
+// SSE2 baseline it is no quicker than sqrt and a division.
+double estimate_rsqrt(double x) {
+    double y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(static_cast<float>(x))));
+    y = y * (1.5 - 0.5 * x * y * y);
+    return y * (1.5 - 0.5 * x * y * y);
+}
+
+real pow_reflectance(real cosine, real ref_idx) {
+    auto r0 = (1 - ref_idx) / (1 + ref_idx);
+    r0 = r0 * r0;
+    return r0 + (1 - r0) * pow((1 - cosine), 5);
+}
+
+// What time_ns adds up ends here, so the calls can't be dropped
+volatile double sink;
+
+// ns per call of f, which returns something to add up so it can't be dropped
+template <typename F>
+double time_ns(long count, F f) {
+    seed_random(1, 0);
+    double acc = 0;
+    auto start = bench_clock::now();
+    for (long k = 0; k < count; k++) acc += f(k);
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    sink = acc;
+    return 1e9 * seconds / count;
+}
+
+// Uniform draws one call takes, averaged
+template <typename F>
+double draws_per_call(F f) {
+    const int calls = 100000;
+    seed_random(2, 0);
+    long draws = 0;
+    // The generator's state tells how far it went, replay a copy to count
+    for (int k = 0; k < calls; k++) {
+        rng before = thread_rng();
+        f();
+        rng after = thread_rng();
+        thread_rng() = before;
+        while (memcmp(&thread_rng(), &after, sizeof(rng)) != 0) {
+            random_double();
+            draws++;
+        }
+    }
+    return double(draws) / calls;
+}
+
+void report_speed(const char* name, double old_ns, double new_ns, double old_draws, double new_draws) {
+    printf("%-22s %9.2f %9.2f %8.2fx", name, old_ns, new_ns, old_ns / new_ns);
+    if (old_draws > 0) printf(" %7.2f %7.2f", old_draws, new_draws);
+    printf("\n");
+}
+
+// Chi-square with the given degrees of freedom that chance exceeds one
+// time in a thousand (Wilson-Hilferty)
+double chi_square_limit(int dof) {
+    const double z = 3.090;
+    double a = 2.0 / (9.0 * dof);
+    double t = 1 - a + z * std::sqrt(a);
+    return dof * t * t * t;
+}
+
+// Maps a sample to a cell in [0, cells) that every correct sample lands in
+// with the same probability, or -1 if it's outside the shape
+using cell_function = std::function<int(const vec3&)>;
+
+bool chi_square(const char* name, int cells, int count, const std::function<vec3()>& sample,
+                const cell_function& cell) {
+    std::vector<long> counts(cells, 0);
+    long outside = 0;
+    seed_random(3, 0);
+    for (int k = 0; k < count; k++) {
+        int c = cell(sample());
+        if (c < 0 || c >= cells) outside++;
+        else counts[c]++;
+    }
+    double expected = double(count) / cells;
+    double chi2 = 0;
+    for (long n : counts) chi2 += (n - expected) * (n - expected) / expected;
+    double limit = chi_square_limit(cells - 1);
+    bool ok = outside == 0 && chi2 < limit;
+    printf("%-34s %10.1f %10.1f %8ld %6s\n", name, chi2, limit, outside, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Index of x in [0,1) cut into n equal parts
+int slot(double x, int n) {
+    int i = static_cast<int>(x * n);
+    return i < 0 || i >= n ? -1 : i;
+}
+
+double angle_fraction(double y, double x) {
+    return (atan2(y, x) + pi) / (2 * pi);
+}
+
+int joined(int a, int b, int n) {
+    return a < 0 || b < 0 ? -1 : a * n + b;
+}
+
+// Disk: r^2 and the angle are uniform
+int disk_cell(const vec3& p) {
+    if (p.z() != 0) return -1;
+    return joined(slot(p.x() * p.x() + p.y() * p.y(), 8), slot(angle_fraction(p.y(), p.x()), 16), 16);
+}
+
+// Sphere: z and the angle around it are uniform (Archimedes), and the length is 1
+int sphere_cell(const vec3& p) {
+    if (fabs(p.length() - 1) > 1e-6) return -1;
+    return joined(slot((p.z() + 1) / 2, 8), slot(angle_fraction(p.y(), p.x()), 16), 16);
+}
+
+// Ball: r^3, and the direction like the sphere's
+int ball_cell(const vec3& p) {
+    double r = p.length();
+    if (r >= 1) return -1;
+    if (r == 0) return 0;
+    int shell = slot(r * r * r, 4);
+    return joined(shell, joined(slot((p.z() / r + 1) / 2, 4), slot(angle_fraction(p.y(), p.x()), 8), 8), 32);
+}
+
+// Cosine weighted around n: sin^2 of the angle to n is uniform, and so is
+// the angle around n
+cell_function cosine_cell(const vec3& n, bool normalize) {
+    vec3 t = unit_vector(cross(fabs(n.x()) > 0.5 ? vec3(0, 1, 0) : vec3(1, 0, 0), n));
+    vec3 b = cross(n, t);
+    return [n, t, b, normalize](const vec3& direction) {
+        vec3 d = normalize ? unit_vector(direction) : direction;
+        if (fabs(d.length() - 1) > 1e-6) return -1;
+        double c = dot(d, n);
+        if (c <= 0) return -1;
+        return joined(slot(1 - c * c, 8), slot(angle_fraction(dot(d, b), dot(d, t)), 16), 16);
+    };
+}
+
+int main(int argc, char** argv) {
+    long count = 20000000;
+    int test_count = 1000000;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--count") && a + 1 < argc) count = atol(argv[++a]);
+        else if (!strcmp(argv[a], "--samples") && a + 1 < argc) test_count = atoi(argv[++a]);
+    }
+
+    // Normals and directions like a scene's, made up front
+    const int table = 4096;
+    std::vector<vec3> normals, directions;
+    std::vector<real> cosines;
+    seed_random(4, 0);
+    for (int k = 0; k < table; k++) {
+        normals.push_back(rejection_unit_vector());
+        directions.push_back(vec3::random(-2, 2));
+        cosines.push_back(random_double());
+    }
+    const int mask = table - 1;
+
+    printf("calls: %ld\n", count);
+    printf("%-22s %9s %9s %9s %7s %7s\n", "kernel", "old ns", "new ns", "speedup", "old dr.", "new dr.");
+    report_speed("in unit disk",
+                 time_ns(count, [](long) { return rejection_in_unit_disk().x(); }),
+                 time_ns(count, [](long) { return random_in_unit_disk().x(); }),
+                 draws_per_call(rejection_in_unit_disk), draws_per_call(random_in_unit_disk));
+    report_speed("unit vector",
+                 time_ns(count, [](long) { return rejection_unit_vector().x(); }),
+                 time_ns(count, [](long) { return random_unit_vector().x(); }),
+                 draws_per_call(rejection_unit_vector), draws_per_call(random_unit_vector));
+    report_speed("in unit sphere",
+                 time_ns(count, [](long) { return rejection_in_unit_sphere().x(); }),
+                 time_ns(count, [](long) { return random_in_unit_sphere().x(); }),
+                 draws_per_call(rejection_in_unit_sphere), draws_per_call(random_in_unit_sphere));
+    report_speed("lambertian direction",
+                 time_ns(count, [&](long k) { return unit_vector(sphere_offset_direction(normals[k & mask])).x(); }),
+                 time_ns(count, [&](long k) {
+                     double u = random_double();
+                     return cosine_direction(normals[k & mask], u, random_double()).x();
+                 }),
+                 0, 0);
+    report_speed("normalize, rsqrt est.",
+                 time_ns(count, [&](long k) { return unit_vector(directions[k & mask]).x(); }),
+                 time_ns(count, [&](long k) {
+                     const vec3& d = directions[k & mask];
+                     return (d * estimate_rsqrt(d.length_squared())).x();
+                 }),
+                 0, 0);
+    report_speed("cube root",
+                 time_ns(count, [&](long k) { return std::cbrt(cosines[k & mask]); }),
+                 time_ns(count, [&](long k) { return cbrt_unit(cosines[k & mask]); }),
+                 0, 0);
+    report_speed("schlick",
+                 time_ns(count, [&](long k) { return pow_reflectance(cosines[k & mask], 1.5); }),
+                 time_ns(count, [&](long k) { return 0.04 + 0.96 * schlick_weight(cosines[k & mask]); }),
+                 0, 0);
+    report_speed("sin+cos, |t| < pi/4",
+                 time_ns(count, [&](long k) {
+                     double t = (pi / 2) * (cosines[k & mask] - 0.5);
+                     return std::sin(t) + std::cos(t);
+                 }),
+                 time_ns(count, [&](long k) {
+                     double s, c;
+                     sincos_quarter((pi / 2) * (cosines[k & mask] - 0.5), s, c);
+                     return s + c;
+                 }),
+                 0, 0);
+
+    // Worst error of the approximations against the exact functions
+    double sincos_error = 0, cbrt_error = 0, rsqrt_error = 0, schlick_error = 0;
+    for (int k = 0; k <= 100000; k++) {
+        double t = (pi / 4) * (2.0 * k / 100000 - 1);
+        double s, c;
+        sincos_quarter(t, s, c);
+        sincos_error = std::fmax(sincos_error, std::fmax(fabs(s - std::sin(t)), fabs(c - std::cos(t))));
+        double w = std::pow(10.0, -12.0 * k / 100000);
+        cbrt_error = std::fmax(cbrt_error, fabs(cbrt_unit(w) / std::cbrt(w) - 1));
+        double x = std::pow(10.0, -30 + 60.0 * k / 100000);
+        rsqrt_error = std::fmax(rsqrt_error, fabs(estimate_rsqrt(x) * std::sqrt(x) - 1));
+        double cosine = double(k) / 100000;
+        schlick_error = std::fmax(schlick_error, fabs(schlick_weight(cosine) - std::pow(1 - cosine, 5)));
+    }
+    printf("\nworst error: sincos_quarter %.2g, cbrt_unit %.2g relative, rsqrt estimate %.2g relative, "
+           "schlick_weight %.2g\n", sincos_error, cbrt_error, rsqrt_error, schlick_error);
+
+    // Old and new through the same tests, at the same sample count
+    printf("\n%-34s %10s %10s %8s %6s\n", "distribution", "chi2", "p=0.001", "outside", "");
+    bool ok = true;
+    ok &= chi_square("in unit disk, rejection", 128, test_count, rejection_in_unit_disk, disk_cell);
+    ok &= chi_square("in unit disk, concentric", 128, test_count, random_in_unit_disk, disk_cell);
+    ok &= chi_square("unit vector, rejection", 128, test_count, rejection_unit_vector, sphere_cell);
+    ok &= chi_square("unit vector, disk lifted", 128, test_count, random_unit_vector, sphere_cell);
+    ok &= chi_square("in unit sphere, rejection", 128, test_count, rejection_in_unit_sphere, ball_cell);
+    ok &= chi_square("in unit sphere, cbrt radius", 128, test_count, random_in_unit_sphere, ball_cell);
+    // A normal near each pole and one in between, the frame flips sign at z = 0
+    const vec3 test_normals[] = {vec3(0, 0, 1), vec3(0, 0, -1), unit_vector(vec3(0.3, -0.8, 0.1)),
+                                 unit_vector(vec3(1e-4, 2e-4, -1))};
+    for (const vec3& n : test_normals) {
+        char name[64];
+        snprintf(name, sizeof(name), "cosine (%.2g,%.2g,%.2g), n + unit", n.x(), n.y(), n.z());
+        ok &= chi_square(name, 128, test_count, [&] { return sphere_offset_direction(n); }, cosine_cell(n, true));
+        snprintf(name, sizeof(name), "cosine (%.2g,%.2g,%.2g), Malley", n.x(), n.y(), n.z());
+        ok &= chi_square(name, 128, test_count, [&] {
+            double u = random_double();
+            return cosine_direction(n, u, random_double());
+        }, cosine_cell(n, false));
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+// Benchmark for sphere_soa, intersects random rays against batches of
+// spheres with every instruction set the CPU supports and checks each
+// one against the scalar sphere::hit path in hittable_list
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_soa.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double trace(const hittable& world, const std::vector<ray>& rays, std::vector<hit_record>& out, std::vector<bool>& hit) {
+    hit_record rec;
+    auto start = bench_clock::now();
+    for (size_t k = 0; k < rays.size(); k++) {
+        hit[k] = world.hit(rays[k], 0.001, infinity, rec);
+        if (hit[k]) out[k] = rec;
+    }
+    return rays.size() / std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    int n = 64;
+    int ray_count = 200000;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--spheres") && a + 1 < argc) n = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rays") && a + 1 < argc) ray_count = atoi(argv[++a]);
+    }
+
+    seed_random(1, 0);
+    hittable_list world;
+    // Only intersections are timed, every sphere shares material 0
+    const uint32_t mat = 0;
+    double extent = cbrt(static_cast<double>(n)) * 2.0;
+    for (int i = 0; i < n; i++) {
+        world.add(make_shared<sphere>(vec3::random(-extent, extent), random_double(0.2, 0.6), mat));
+    }
+    std::vector<ray> rays;
+    for (int i = 0; i < ray_count; i++) {
+        point3 origin = 3 * extent * random_unit_vector();
+        rays.push_back(ray(origin, vec3::random(-extent, extent) - origin));
+    }
+
+    std::vector<hit_record> ref(ray_count), got(ray_count);
+    std::vector<bool> ref_hit(ray_count), got_hit(ray_count);
+    double list_rate = trace(world, rays, ref, ref_hit);
+
+    printf("spheres: %d, rays: %d, detected isa: %s\n", n, ray_count, simd_isa_name(detect_simd_isa()));
+    printf("%-16s %14s %10s %14s\n", "path", "Mrays/s", "speedup", "max t error");
+    printf("%-16s %14.3f %10s %14s\n", "hittable_list", list_rate / 1e6, "1.0x", "-");
+
+    simd_isa best = detect_simd_isa();
+    for (simd_isa isa : {simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512}) {
+        if (isa > best) break;
+        sphere_soa soa(world, isa);
+        double rate = trace(soa, rays, got, got_hit);
+
+        double max_error = 0;
+        int mismatches = 0;
+        for (int k = 0; k < ray_count; k++) {
+            if (ref_hit[k] != got_hit[k]) { mismatches++; continue; }
+            if (!ref_hit[k]) continue;
+            max_error = fmax(max_error, fabs(ref[k].t - got[k].t) / ref[k].t);
+            if ((ref[k].normal - got[k].normal).length() > 1e-9) mismatches++;
+        }
+        printf("%-16s %14.3f %9.1fx %14.2e", (std::string("sphere_soa ") + simd_isa_name(isa)).c_str(),
+            rate / 1e6, rate / list_rate, max_error);
+        if (mismatches) printf("  %d MISMATCHES", mismatches);
+        printf("\n");
+    }
+}
@@ -0,0 +1,320 @@
+// Benchmark suite for tracking performance across commits. Renders a
+// fixed set of scenes at a fixed size, spp and seed through the default
+// path (linear_bvh, one ray at a time on the thread pool) and reports
+// for every scene the time of each phase, the rays traced, ns per hit()
+// and peak memory as JSON or CSV. Each scene runs in its own forked
+// process so its peak RSS isn't hidden by a bigger scene before it.
+//   ./bench_suite [--threads N] [--only NAME] [--format json|csv]
+//                 [--output FILE] [--label TEXT]
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "linear_bvh.h"
+#include "render.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// One entry of the suite, the render settings override the scene's own
+// so the workload only changes when this table does
+struct bench_case {
+    const char* name;
+    int image_width;
+    int samples_per_pixel;
+    int max_depth;
+    void (*build)(scene& sc, uint64_t seed);
+};
+
+const uint64_t bench_seed = 1;
+
+const bench_case suite[] = {
+    {"three_spheres", 400, 32, 50, [](scene& sc, uint64_t) { scene_loader(sc).load_string(default_scene); }},
+    {"final_scene", 400, 16, 50, final_scene},
+    {"million_spheres", 200, 4, 16, [](scene& sc, uint64_t seed) { random_sphere_scene(sc, 1000000, seed); }},
+    {"glass", 400, 16, 50, glass_scene},
+};
+
+// Forwards to the accelerator and counts calls on the calling thread.
+// ray_color() tests the whole world once per bounce, so this is the
+// number of rays traced.
+class counting_hittable: public hittable {
+    public:
+        explicit counting_hittable(const hittable& inner): inner(inner) {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            calls++;
+            return inner.hit(r, t_min, t_max, rec);
+        }
+        virtual bool bounding_box(aabb& output_box) const override { return inner.bounding_box(output_box); }
+
+    public:
+        static thread_local uint64_t calls;
+
+    private:
+        const hittable& inner;
+};
+
+thread_local uint64_t counting_hittable::calls = 0;
+
+// Keeps a copy of every ray it is asked about, for replaying them later
+class recording_hittable: public hittable {
+    public:
+        recording_hittable(const hittable& inner, std::vector<ray>& rays): inner(inner), rays(rays) {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            rays.push_back(r);
+            return inner.hit(r, t_min, t_max, rec);
+        }
+        virtual bool bounding_box(aabb& output_box) const override { return inner.bounding_box(output_box); }
+
+    private:
+        const hittable& inner;
+        std::vector<ray>& rays;
+};
+
+// Plain old data so the child can hand it to the parent through a pipe
+struct bench_result {
+    char name[32];
+    bool ok;
+    int width, height, samples_per_pixel, max_depth, threads;
+    long objects;
+    // Phases, wall seconds
+    double scene_seconds, accel_seconds, render_seconds, encode_seconds;
+    uint64_t primary_rays, secondary_rays;
+    double rays_per_second;
+    double ns_per_hit;
+    double peak_rss_mib;
+    // Of the 8 bit image, changes whenever the rendered image does
+    uint64_t image_checksum;
+};
+
+// Builds, renders and measures one scene
+bench_result run_case(const bench_case& bc, int thread_count) {
+    bench_result res = {};
+    snprintf(res.name, sizeof(res.name), "%s", bc.name);
+
+    auto start = bench_clock::now();
+    scene sc;
+    bc.build(sc, bench_seed);
+    sc.image_width = bc.image_width;
+    sc.samples_per_pixel = bc.samples_per_pixel;
+    sc.max_depth = bc.max_depth;
+    res.scene_seconds = seconds_since(start);
+    res.objects = static_cast<long>(sc.world.objects.size());
+
+    start = bench_clock::now();
+    linear_bvh accel(sc.world);
+    res.accel_seconds = seconds_since(start);
+
+    const int image_width = sc.image_width;
+    const int image_height = sc.image_height();
+    const int spp = sc.samples_per_pixel;
+    const int max_depth = sc.max_depth;
+    camera cam = sc.make_camera();
+    res.width = image_width;
+    res.height = image_height;
+    res.samples_per_pixel = spp;
+    res.max_depth = max_depth;
+
+    // Same loop as main's fixed spp path, through the counting wrapper
+    counting_hittable counted(accel);
+    framebuffer fb(image_width, image_height);
+    std::vector<tile> tiles = make_tiles(image_width, image_height, 16);
+    thread_pool pool(thread_count);
+    res.threads = pool.size();
+    std::vector<uint64_t> worker_rays(pool.size(), 0);
+    start = bench_clock::now();
+    pool.run(static_cast<int>(tiles.size()), [&](int t, int worker) {
+        const tile& tl = tiles[t];
+        uint64_t calls_before = counting_hittable::calls;
+        for (int j = tl.y0; j < tl.y1; j++) {
+            for (int i = tl.x0; i < tl.x1; i++) {
+                color pixel_color(0, 0, 0);
+                for (int s = 0; s < spp; s++) {
+                    seed_pixel_sample(bench_seed, j * image_width + i, s);
+                    auto u = double(i + random_double()) / (image_width - 1);
+                    auto v = double(j + random_double()) / (image_height - 1);
+                    pixel_color += ray_color(cam.get_ray(u, v), counted, sc.materials, sc.lights, max_depth);
+                }
+                fb.add(i, j, pixel_color, spp);
+            }
+        }
+        worker_rays[worker] += counting_hittable::calls - calls_before;
+    });
+    res.render_seconds = seconds_since(start);
+
+    uint64_t rays = 0;
+    for (uint64_t n : worker_rays) rays += n;
+    res.primary_rays = uint64_t(image_width) * image_height * spp;
+    res.secondary_rays = rays - res.primary_rays;
+    res.rays_per_second = rays / res.render_seconds;
+
+    start = bench_clock::now();
+    std::vector<uint8_t> image = encode_image(fb, image_format::ppm);
+    res.encode_seconds = seconds_since(start);
+    res.image_checksum = checksum64(image.data(), image.size());
+
+    // ns per hit() on its own, without shading or sampling: record the
+    // primary and bounce rays of one sample on every 4th pixel each way,
+    // then time the accelerator over them until it has run long enough
+    std::vector<ray> recorded;
+    recording_hittable recorder(accel, recorded);
+    for (int j = 0; j < image_height; j += 4) {
+        for (int i = 0; i < image_width; i += 4) {
+            seed_pixel_sample(bench_seed, j * image_width + i, 0);
+            auto u = double(i + random_double()) / (image_width - 1);
+            auto v = double(j + random_double()) / (image_height - 1);
+            ray_color(cam.get_ray(u, v), recorder, sc.materials, sc.lights, max_depth);
+        }
+    }
+    hit_record rec;
+    uint64_t replayed = 0, hits = 0;
+    start = bench_clock::now();
+    double elapsed = 0;
+    do {
+        for (const ray& r : recorded) hits += accel.hit(r, ray_t_min(r), infinity, rec);
+        replayed += recorded.size();
+        elapsed = seconds_since(start);
+    } while (elapsed < 0.25 && !recorded.empty());
+    res.ns_per_hit = replayed ? 1e9 * elapsed / replayed : 0;
+    // Keeps the replay loop from being thrown away
+    if (hits > replayed) res.ns_per_hit = -1;
+
+    res.peak_rss_mib = peak_rss_mib();
+    res.ok = true;
+    return res;
+}
+
+// Runs the case in a child process and collects its result
+bench_result run_isolated(const bench_case& bc, int thread_count) {
+    bench_result res = {};
+    snprintf(res.name, sizeof(res.name), "%s", bc.name);
+    int fds[2];
+    if (pipe(fds) != 0) return res;
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return res;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        bench_result child = run_case(bc, thread_count);
+        bool sent = write(fds[1], &child, sizeof(child)) == sizeof(child);
+        _exit(sent ? 0 : 1);
+    }
+    close(fds[1]);
+    bench_result child;
+    if (read(fds[0], &child, sizeof(child)) == sizeof(child)) res = child;
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) res.ok = false;
+    return res;
+}
+
+void write_json(FILE* f, const std::vector<bench_result>& results, const std::string& label) {
+    fprintf(f, "[\n");
+    for (size_t k = 0; k < results.size(); k++) {
+        const bench_result& r = results[k];
+        fprintf(f, "  {\"label\": \"%s\", \"scene\": \"%s\", \"ok\": %s, \"width\": %d, \"height\": %d, "
+                   "\"spp\": %d, \"max_depth\": %d, \"threads\": %d, \"objects\": %ld,\n"
+                   "   \"scene_seconds\": %.6f, \"accel_seconds\": %.6f, \"render_seconds\": %.6f, \"encode_seconds\": %.6f,\n"
+                   "   \"primary_rays\": %llu, \"secondary_rays\": %llu, \"rays_per_second\": %.0f, "
+                   "\"ns_per_hit\": %.2f, \"peak_rss_mib\": %.1f, \"image_checksum\": \"%016llx\"}%s\n",
+                label.c_str(), r.name, r.ok ? "true" : "false", r.width, r.height,
+                r.samples_per_pixel, r.max_depth, r.threads, r.objects,
+                r.scene_seconds, r.accel_seconds, r.render_seconds, r.encode_seconds,
+                (unsigned long long)r.primary_rays, (unsigned long long)r.secondary_rays, r.rays_per_second,
+                r.ns_per_hit, r.peak_rss_mib, (unsigned long long)r.image_checksum,
+                k + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+void write_csv(FILE* f, const std::vector<bench_result>& results, const std::string& label) {
+    fprintf(f, "label,scene,ok,width,height,spp,max_depth,threads,objects,scene_seconds,accel_seconds,"
+               "render_seconds,encode_seconds,primary_rays,secondary_rays,rays_per_second,ns_per_hit,"
+               "peak_rss_mib,image_checksum\n");
+    for (const bench_result& r : results) {
+        fprintf(f, "%s,%s,%d,%d,%d,%d,%d,%d,%ld,%.6f,%.6f,%.6f,%.6f,%llu,%llu,%.0f,%.2f,%.1f,%016llx\n",
+                label.c_str(), r.name, r.ok ? 1 : 0, r.width, r.height, r.samples_per_pixel, r.max_depth,
+                r.threads, r.objects, r.scene_seconds, r.accel_seconds, r.render_seconds, r.encode_seconds,
+                (unsigned long long)r.primary_rays, (unsigned long long)r.secondary_rays, r.rays_per_second,
+                r.ns_per_hit, r.peak_rss_mib, (unsigned long long)r.image_checksum);
+    }
+}
+
+int main(int argc, char** argv) {
+    int thread_count = thread_pool::default_thread_count();
+    std::string only;
+    std::string format = "json";
+    std::string output_path = "-";
+    std::string label;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--threads") && a + 1 < argc) thread_count = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--only") && a + 1 < argc) only = argv[++a];
+        else if (!strcmp(argv[a], "--format") && a + 1 < argc) format = argv[++a];
+        else if (!strcmp(argv[a], "--output") && a + 1 < argc) output_path = argv[++a];
+        else if (!strcmp(argv[a], "--label") && a + 1 < argc) label = argv[++a];
+        else {
+            fprintf(stderr, "Usage: %s [--threads N] [--only NAME] [--format json|csv] [--output FILE] [--label TEXT]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (format != "json" && format != "csv") {
+        fprintf(stderr, "unknown format %s\n", format.c_str());
+        return 1;
+    }
+
+    // Human readable progress on stderr, the results go to --output
+    std::vector<bench_result> results;
+    fprintf(stderr, "%-16s %9s %8s %8s %9s %12s %9s %9s\n",
+            "scene", "objects", "scene s", "accel s", "render s", "Mrays/s", "ns/hit", "peak MiB");
+    for (const bench_case& bc : suite) {
+        if (!only.empty() && only != bc.name) continue;
+        bench_result r = run_isolated(bc, thread_count);
+        if (r.ok) {
+            fprintf(stderr, "%-16s %9ld %8.3f %8.3f %9.3f %12.3f %9.1f %9.1f\n", r.name, r.objects, r.scene_seconds,
+                    r.accel_seconds, r.render_seconds, r.rays_per_second / 1e6, r.ns_per_hit, r.peak_rss_mib);
+        } else {
+            fprintf(stderr, "%-16s failed\n", r.name);
+        }
+        results.push_back(r);
+    }
+    if (results.empty()) {
+        fprintf(stderr, "no scene named %s\n", only.c_str());
+        return 1;
+    }
+
+    FILE* f = output_path == "-" ? stdout : fopen(output_path.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", output_path.c_str());
+        return 1;
+    }
+    if (format == "json") write_json(f, results, label);
+    else write_csv(f, results, label);
+    if (f != stdout) fclose(f);
+
+    for (const bench_result& r : results) {
+        if (!r.ok) return 1;
+    }
+}
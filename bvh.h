@@ -0,0 +1,241 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Object plus the box info the builder needs, cached once so
+// the SAH sweep doesn't keep calling bounding_box()
+struct bvh_primitive {
+    shared_ptr<hittable> object;
+    aabb box;
+    point3 centroid;
+    uint32_t index;     // position in the source list
+};
+
+// Number of bins per axis the SAH sweep sorts centroids into
+const int bvh_sah_bins = 16;
+
+// A box with NaN or inf corners can't be binned or split, the builders
+// leave such objects out
+inline bool box_is_finite(const aabb& b) {
+    for (int a = 0; a < 3; a++) {
+        if (!std::isfinite(b.min()[a]) || !std::isfinite(b.max()[a])) return false;
+    }
+    return true;
+}
+
+// Bin of a centroid coordinate, clamped to the bins on both sides before
+// the cast (a NaN lands in bin 0) so it can never index out of bounds
+inline int sah_bin(double c, double lo, double extent) {
+    double x = bvh_sah_bins * (c - lo) / extent;
+    if (!(x >= 0)) return 0;
+    return x >= bvh_sah_bins ? bvh_sah_bins - 1 : static_cast<int>(x);
+}
+
+// Partitions prims[start, end) in place around the cheapest split and returns the
+// split index. When split_cost isn't null it gets the SAH cost of that split
+// (sum of child area * child count) so callers can weigh it against a leaf,
+// and split_axis gets the axis the left side is the lower half of.
+inline size_t sah_split(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                        double* split_cost = nullptr, int* split_axis = nullptr) {
+    // Surface area heuristic: the chance a ray hitting the parent also
+    // hits a child is proportional to the child's surface area, so the
+    // expected cost of a split is area_left * count_left + area_right * count_right.
+    // We bin centroids along each axis and pick the cheapest bin boundary.
+    aabb centroid_bounds = aabb::empty();
+    for (size_t i = start; i < end; i++) {
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    int best_axis = -1;
+    int best_bin = 0;
+    double best_cost = infinity;
+
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = centroid_bounds.min()[axis];
+        double extent = centroid_bounds.max()[axis] - lo;
+        // All centroids on one plane, nothing to split on this axis
+        if (extent <= 0) continue;
+
+        aabb bin_box[bvh_sah_bins];
+        size_t bin_count[bvh_sah_bins] = {};
+        for (int b = 0; b < bvh_sah_bins; b++) bin_box[b] = aabb::empty();
+
+        for (size_t i = start; i < end; i++) {
+            int b = sah_bin(prims[i].centroid[axis], lo, extent);
+            bin_count[b]++;
+            bin_box[b] = surrounding_box(bin_box[b], prims[i].box);
+        }
+
+        // Sweep from the right to get the area and count of every
+        // suffix, then from the left to cost every boundary
+        double right_area[bvh_sah_bins];
+        size_t right_count[bvh_sah_bins];
+        aabb acc = aabb::empty();
+        size_t count = 0;
+        for (int b = bvh_sah_bins - 1; b > 0; b--) {
+            acc = surrounding_box(acc, bin_box[b]);
+            count += bin_count[b];
+            right_area[b] = count ? acc.surface_area() : 0;
+            right_count[b] = count;
+        }
+        acc = aabb::empty();
+        count = 0;
+        for (int b = 0; b < bvh_sah_bins - 1; b++) {
+            acc = surrounding_box(acc, bin_box[b]);
+            count += bin_count[b];
+            if (count == 0 || right_count[b + 1] == 0) continue;
+            double cost = count * acc.surface_area() + right_count[b + 1] * right_area[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    size_t mid = start + (end - start) / 2;
+    if (split_cost) *split_cost = best_cost;
+    if (split_axis) *split_axis = best_axis < 0 ? 0 : best_axis;
+    if (best_axis < 0) {
+        // Every centroid is in the same spot, any split is as good as another
+        return mid;
+    }
+
+    double lo = centroid_bounds.min()[best_axis];
+    double extent = centroid_bounds.max()[best_axis] - lo;
+    auto split = std::partition(prims.begin() + start, prims.begin() + end,
+        [&](const bvh_primitive& p) {
+            return sah_bin(p.centroid[best_axis], lo, extent) <= best_bin;
+        });
+    size_t split_index = split - prims.begin();
+    // Binning always leaves both sides non-empty, but guard
+    // against it anyway so the recursion always terminates
+    if (split_index == start || split_index == end) return mid;
+    return split_index;
+}
+
+// Bounding volume hierarchy, a binary tree of boxes where every node's
+// box encloses its two children. A ray that misses a node's box can skip
+// everything underneath it so a hit costs O(log N) box tests instead
+// of testing every object in a hittable_list.
+class bvh_node: public hittable {
+    public:
+        bvh_node() {}
+        // Builds in parallel when the list is big enough to be worth it
+        bvh_node(const hittable_list& list): bvh_node(list.objects) {}
+        bvh_node(const std::vector<shared_ptr<hittable>>& src_objects);
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+
+    public:
+        shared_ptr<hittable> left;
+        shared_ptr<hittable> right;
+        aabb box;
+
+    private:
+        // Below this many objects a subtree is built on the current thread
+        static const size_t parallel_threshold = 8192;
+
+        bvh_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, int spawn_depth);
+        void build(std::vector<bvh_primitive>& prims, size_t start, size_t end, int spawn_depth);
+};
+
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects) {
+    std::vector<bvh_primitive> prims;
+    prims.reserve(src_objects.size());
+    for (size_t i = 0; i < src_objects.size(); i++) {
+        const shared_ptr<hittable>& object = src_objects[i];
+        aabb b;
+        if (!object->bounding_box(b)) {
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+            continue;
+        }
+        if (!box_is_finite(b)) {
+            std::cerr << "Non-finite bounding box in bvh_node constructor.\n";
+            continue;
+        }
+        prims.push_back({object, b, b.centroid(), static_cast<uint32_t>(i)});
+    }
+    if (prims.empty()) {
+        std::cerr << "Empty bvh_node.\n";
+        box = aabb();
+        return;
+    }
+    // Every level of spawning doubles the number of
+    // subtrees being built at once, stop once the cores are full
+    int spawn_depth = 0;
+    for (unsigned n = std::thread::hardware_concurrency(); n > 1; n >>= 1) spawn_depth++;
+    build(prims, 0, prims.size(), spawn_depth);
+}
+
+bvh_node::bvh_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, int spawn_depth) {
+    build(prims, start, end, spawn_depth);
+}
+
+void bvh_node::build(std::vector<bvh_primitive>& prims, size_t start, size_t end, int spawn_depth) {
+    size_t object_span = end - start;
+
+    if (object_span == 1) {
+        // Leaf with a single object, both sides point at it
+        left = right = prims[start].object;
+    } else if (object_span == 2) {
+        left = prims[start].object;
+        right = prims[start + 1].object;
+    } else {
+        size_t mid = sah_split(prims, start, end);
+        if (spawn_depth > 0 && object_span >= parallel_threshold) {
+            // Build the left half on another thread while this one does
+            // the right half, the halves touch disjoint ranges of prims
+            auto left_future = std::async(std::launch::async, [&prims, start, mid, spawn_depth] {
+                return shared_ptr<bvh_node>(new bvh_node(prims, start, mid, spawn_depth - 1));
+            });
+            right = shared_ptr<bvh_node>(new bvh_node(prims, mid, end, spawn_depth - 1));
+            left = left_future.get();
+        } else {
+            left = shared_ptr<bvh_node>(new bvh_node(prims, start, mid, 0));
+            right = shared_ptr<bvh_node>(new bvh_node(prims, mid, end, 0));
+        }
+    }
+
+    aabb box_left, box_right;
+    left->bounding_box(box_left);
+    right->bounding_box(box_right);
+    box = surrounding_box(box_left, box_right);
+}
+
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RT_COUNT(bvh_nodes);
+    // Missing this box means missing everything below it
+    if (!box.hit(r, t_min, t_max)) return false;
+
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    // Only accept a right hit closer than the left one
+    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+    return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const {
+    RT_COUNT(bvh_nodes);
+    if (!box.hit(r, t_min, t_max)) return false;
+    // Any hit will do, the right side only gets looked at if the left is clear
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+#endif
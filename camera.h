@@ -9,10 +9,10 @@ class camera {
             point3 lookfrom,
             point3 lookat,
             vec3 vup, 
-            double vfov, 
-            double aspect_ratio,
-            double aperture,
-            double focus_dist
+            real vfov, 
+            real aspect_ratio,
+            real aperture,
+            real focus_dist
         ) {
             auto theta = degrees_to_radians(vfov);
             auto h = tan(theta / 2);
@@ -48,17 +48,18 @@ class camera {
             lens_radius = aperture / 2;
         }
 
-        ray get_ray(double s, double t) const {
+        ray get_ray(real s, real t) const {
             // Lens depth of field
-            vec3 rd = lens_radius * random_in_unit_disk();
+            vec3 rd = lens_radius * sample_in_unit_disk();
             vec3 offset = u * rd.x() + v * rd.y();
             // Generates the 'ray' for each pixel starting at left top,
             // moving right horizontally, and moving down vertically,
             // - origin for origin offset
-            // origin first, then direction of our pixel from our origin
+            // origin first, then direction of our pixel from our origin,
+            // unit length like every ray the materials scatter
             return ray(
                 origin + offset,
-                lower_left_corner + s * horizontal + t * vertical - origin - offset
+                unit_vector(lower_left_corner + s * horizontal + t * vertical - origin - offset)
             );
         }
 
@@ -68,7 +69,7 @@ class camera {
         vec3 horizontal;
         vec3 vertical;
         vec3 u, v, w;
-        double lens_radius;
+        real lens_radius;
 };
 
 #endif
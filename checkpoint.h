@@ -0,0 +1,319 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "render.h"
+#include "scene_cache.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Checkpoints of a fixed spp render, so a killed render can pick up where
+// it stopped. Tiles are the unit: a finished tile's pixels never change
+// again, so a checkpoint only needs the tiles finished since the last
+// one and the file is an append only log:
+//
+//   checkpoint_header   what is being rendered, must match to resume
+//   tile record         tile index, pixel count, the tile's float color
+//                       sums and sample counts, checksum of the record
+//   tile record ...
+//
+// A record only counts once its checksum matches, so a crash in the
+// middle of a write costs that record and nothing before it. Sample
+// streams are seeded from (seed, pixel, sample), so the seed in the
+// header is all the random state there is, and the rerendered tiles come
+// out exactly as they would have.
+
+const char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\r', '\n'};
+const uint32_t checkpoint_version = 3;
+
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t real_size;             // float and double builds render differently
+    int32_t width, height;
+    int32_t samples_per_pixel, max_depth;
+    int32_t tile_size, tile_count;
+    uint64_t seed;
+    uint64_t scene_stamp;
+    int32_t roulette_min_bounces;
+    float roulette_threshold;
+    int32_t sampler;
+    int32_t light_sampling;
+    char accelerator[16];
+    uint64_t checksum;              // of everything above
+};
+
+// Everything that decides the image, zeroed first so padding hashes the same
+inline checkpoint_header make_checkpoint_header(int width, int height, int samples_per_pixel, int max_depth,
+                                                int tile_size, int tile_count, uint64_t seed, uint64_t scene_stamp,
+                                                const roulette_settings& roulette, const std::string& accelerator,
+                                                sampler_kind sampler, light_sampling lights) {
+    checkpoint_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, checkpoint_magic, sizeof(h.magic));
+    h.version = checkpoint_version;
+    h.real_size = sizeof(real);
+    h.width = width;
+    h.height = height;
+    h.samples_per_pixel = samples_per_pixel;
+    h.max_depth = max_depth;
+    h.tile_size = tile_size;
+    h.tile_count = tile_count;
+    h.seed = seed;
+    h.scene_stamp = scene_stamp;
+    h.roulette_min_bounces = roulette.min_bounces;
+    h.roulette_threshold = static_cast<float>(roulette.threshold);
+    h.sampler = static_cast<int32_t>(sampler);
+    h.light_sampling = static_cast<int32_t>(lights);
+    snprintf(h.accelerator, sizeof(h.accelerator), "%s", accelerator.c_str());
+    h.checksum = checksum64(&h, offsetof(checkpoint_header, checksum));
+    return h;
+}
+
+class checkpoint_file {
+    public:
+        // Tile states, only ever move forward
+        enum : uint8_t { tile_pending = 0, tile_rendered = 1, tile_saved = 2 };
+
+        checkpoint_file() {}
+        checkpoint_file(const checkpoint_file&) = delete;
+        checkpoint_file& operator=(const checkpoint_file&) = delete;
+        ~checkpoint_file() {
+            if (fd >= 0) close(fd);
+        }
+
+        // Starts a new checkpoint at path, replacing any old one. The header
+        // goes to a temporary file that is renamed into place, so path is
+        // always either the old checkpoint or a valid new one.
+        bool create(const std::string& path, const checkpoint_header& header, std::string& error);
+
+        // Opens the checkpoint at path, which has to be for the same render,
+        // adds its tiles to fb and marks them saved in states. A torn last
+        // record is cut off and new tiles get appended after the good ones.
+        bool resume(const std::string& path, const checkpoint_header& header, const std::vector<tile>& tiles,
+                    framebuffer& fb, std::vector<uint8_t>& states, std::string& error);
+
+        // Appends tile t's pixels from fb, the tile must be finished
+        bool append(int t, const tile& tl, const framebuffer& fb);
+        // Flushes appended records to the disk
+        bool sync() { return fdatasync(fd) == 0; }
+        // Once the image is out the checkpoint is no longer needed
+        void remove();
+
+        int tiles_loaded = 0;
+
+    private:
+        std::string path;
+        int fd = -1;
+        std::vector<unsigned char> record;
+};
+
+bool checkpoint_file::create(const std::string& path, const checkpoint_header& header, std::string& error) {
+    this->path = path;
+    std::string temp_path = path + ".tmp";
+    fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "cannot create " + temp_path;
+        return false;
+    }
+    if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)) || fdatasync(fd) != 0 ||
+        rename(temp_path.c_str(), path.c_str()) != 0) {
+        error = "cannot write " + path;
+        close(fd);
+        fd = -1;
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool checkpoint_file::resume(const std::string& path, const checkpoint_header& header, const std::vector<tile>& tiles,
+                             framebuffer& fb, std::vector<uint8_t>& states, std::string& error) {
+    this->path = path;
+    fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        error = "missing";
+        return false;
+    }
+    checkpoint_header found;
+    if (read(fd, &found, sizeof(found)) != static_cast<ssize_t>(sizeof(found)) ||
+        memcmp(found.magic, checkpoint_magic, sizeof(found.magic)) != 0) {
+        error = "is not a checkpoint";
+        return false;
+    }
+    if (found.version != checkpoint_version) {
+        error = "is from another version";
+        return false;
+    }
+    if (memcmp(&found, &header, sizeof(header)) != 0) {
+        error = "is for a different scene or settings";
+        return false;
+    }
+
+    // Load records until the end or the first bad one
+    off_t good_end = sizeof(header);
+    while (true) {
+        uint32_t head[2];
+        if (read(fd, head, sizeof(head)) != static_cast<ssize_t>(sizeof(head))) break;
+        uint32_t t = head[0], pixel_count = head[1];
+        if (t >= tiles.size()) break;
+        const tile& tl = tiles[t];
+        if (pixel_count != uint32_t(tl.x1 - tl.x0) * (tl.y1 - tl.y0)) break;
+        size_t payload = pixel_count * (3 * sizeof(float) + sizeof(uint32_t));
+        record.resize(sizeof(head) + payload + sizeof(uint64_t));
+        memcpy(record.data(), head, sizeof(head));
+        size_t rest = payload + sizeof(uint64_t);
+        if (read(fd, record.data() + sizeof(head), rest) != static_cast<ssize_t>(rest)) break;
+        uint64_t checksum;
+        memcpy(&checksum, record.data() + sizeof(head) + payload, sizeof(checksum));
+        if (checksum != checksum64(record.data(), sizeof(head) + payload) || states[t] != tile_pending) break;
+
+        const float* sum = reinterpret_cast<const float*>(record.data() + sizeof(head));
+        const unsigned char* counts = record.data() + sizeof(head) + pixel_count * 3 * sizeof(float);
+        const int width = tl.x1 - tl.x0;
+        for (int j = tl.y0; j < tl.y1; j++) {
+            for (int i = tl.x0; i < tl.x1; i++) {
+                size_t p = size_t(j - tl.y0) * width + (i - tl.x0);
+                size_t q = size_t(j) * fb.width + i;
+                fb.sum[3 * q + 0] += sum[3 * p + 0];
+                fb.sum[3 * q + 1] += sum[3 * p + 1];
+                fb.sum[3 * q + 2] += sum[3 * p + 2];
+                uint32_t n;
+                memcpy(&n, counts + p * sizeof(uint32_t), sizeof(n));
+                fb.samples[q] += n;
+            }
+        }
+        states[t] = tile_saved;
+        tiles_loaded++;
+        good_end += static_cast<off_t>(record.size());
+    }
+
+    // Drop whatever a crash left half written
+    if (ftruncate(fd, good_end) != 0 || lseek(fd, good_end, SEEK_SET) != good_end) {
+        error = "cannot be truncated";
+        return false;
+    }
+    return true;
+}
+
+bool checkpoint_file::append(int t, const tile& tl, const framebuffer& fb) {
+    const int width = tl.x1 - tl.x0;
+    const uint32_t pixel_count = uint32_t(width) * (tl.y1 - tl.y0);
+    const size_t head = 2 * sizeof(uint32_t);
+    const size_t payload = pixel_count * (3 * sizeof(float) + sizeof(uint32_t));
+    record.resize(head + payload + sizeof(uint64_t));
+    uint32_t header[2] = {static_cast<uint32_t>(t), pixel_count};
+    memcpy(record.data(), header, head);
+    unsigned char* sum = record.data() + head;
+    unsigned char* counts = sum + pixel_count * 3 * sizeof(float);
+    for (int j = tl.y0; j < tl.y1; j++) {
+        size_t p = size_t(j - tl.y0) * width;
+        size_t q = size_t(j) * fb.width + tl.x0;
+        memcpy(sum + 3 * p * sizeof(float), &fb.sum[3 * q], 3 * width * sizeof(float));
+        memcpy(counts + p * sizeof(uint32_t), &fb.samples[q], width * sizeof(uint32_t));
+    }
+    uint64_t checksum = checksum64(record.data(), head + payload);
+    memcpy(record.data() + head + payload, &checksum, sizeof(checksum));
+    return write(fd, record.data(), record.size()) == static_cast<ssize_t>(record.size());
+}
+
+void checkpoint_file::remove() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+    unlink(path.c_str());
+}
+
+// Saves finished tiles from a background thread so the render threads
+// never wait on the disk. A render thread only marks its tile rendered,
+// every interval the saver appends the newly rendered tiles and syncs.
+class checkpoint_saver {
+    public:
+        checkpoint_saver(checkpoint_file& file, const std::vector<tile>& tiles, const framebuffer& fb,
+                         const std::vector<uint8_t>& initial_states, double interval_seconds)
+            : file(file), tiles(tiles), fb(fb), states(new std::atomic<uint8_t>[tiles.size()]),
+              interval(interval_seconds) {
+            for (size_t t = 0; t < tiles.size(); t++) states[t].store(initial_states[t], std::memory_order_relaxed);
+            saver = std::thread(&checkpoint_saver::run, this);
+        }
+
+        ~checkpoint_saver() { finish(); }
+
+        // Called by a render thread once every pixel of tile t is in fb
+        void tile_rendered(int t) {
+            states[t].store(checkpoint_file::tile_rendered, std::memory_order_release);
+        }
+
+        // Saves the last tiles and stops the thread, false if any write failed
+        bool finish() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) return ok;
+                stopping = true;
+            }
+            wake.notify_one();
+            saver.join();
+            return ok;
+        }
+
+        long tiles_saved = 0;
+        int checkpoints = 0;
+
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                wake.wait_for(lock, std::chrono::duration<double>(interval));
+                lock.unlock();
+                save();
+                lock.lock();
+            }
+        }
+
+        // Appends every tile rendered since the last save. The acquire
+        // load pairs with tile_rendered(), so the tile's pixels are all
+        // visible here, and nothing writes them again.
+        void save() {
+            bool wrote = false;
+            for (size_t t = 0; t < tiles.size(); t++) {
+                if (states[t].load(std::memory_order_acquire) != checkpoint_file::tile_rendered) continue;
+                if (!file.append(static_cast<int>(t), tiles[t], fb)) ok = false;
+                states[t].store(checkpoint_file::tile_saved, std::memory_order_relaxed);
+                tiles_saved++;
+                wrote = true;
+            }
+            if (wrote) {
+                if (!file.sync()) ok = false;
+                checkpoints++;
+            }
+        }
+
+    private:
+        checkpoint_file& file;
+        const std::vector<tile>& tiles;
+        const framebuffer& fb;
+        std::unique_ptr<std::atomic<uint8_t>[]> states;
+        double interval;
+
+        std::thread saver;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        bool ok = true;
+};
+
+#endif
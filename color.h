@@ -2,28 +2,41 @@
 #define COLOR_H
 
 #include "vec3.h"
+#include "framebuffer.h"
 
-#include <iostream>
+#include <cstdint>
+#include <vector>
 
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
+// Turns the framebuffer into 8 bit rgb, top row first, as one pass over
+// the whole image instead of formatting pixel by pixel. Each row is a
+// flat loop over its floats with no branches so the compiler vectorizes it.
+void resolve_8bit(const framebuffer& fb, std::vector<uint8_t>& out) {
+    const int row_floats = 3 * fb.width;
+    out.resize(size_t(row_floats) * fb.height);
+    std::vector<double> scale(row_floats);
 
-    // Divide the color by the number of samples.
-    // averaging for various rays hitting this pixel
-    // also gamma-correct for gamma 2.0
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
+    for (int j = 0; j < fb.height; j++) {
+        const float* src = &fb.sum[size_t(j) * row_floats];
+        const uint32_t* n = &fb.samples[size_t(j) * fb.width];
+        // PPM and PNG go from the top row down
+        uint8_t* dst = &out[size_t(fb.height - 1 - j) * row_floats];
 
-    // Write the translated [0,255] value of each color component.
-    // Casting clamps down so using 255.99 preserves rgb's 0-1 range
-    // when mapping to 0-255
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+        // Divide the color by the number of samples.
+        // averaging for various rays hitting this pixel
+        for (int i = 0; i < fb.width; i++) {
+            double s = n[i] ? 1.0 / n[i] : 0.0;
+            scale[3 * i] = scale[3 * i + 1] = scale[3 * i + 2] = s;
+        }
+        for (int k = 0; k < row_floats; k++) {
+            // also gamma-correct for gamma 2.0
+            double v = sqrt(scale[k] * src[k]);
+            // Write the translated [0,255] value of each color component.
+            // Casting clamps down so using 255.99 preserves rgb's 0-1 range
+            // when mapping to 0-255
+            v = v < 0.0 ? 0.0 : (v > 0.999 ? 0.999 : v);
+            dst[k] = static_cast<uint8_t>(256 * v);
+        }
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
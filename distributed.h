@@ -0,0 +1,306 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "render.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Renders one frame with several worker processes on this machine. The
+// coordinator forks the workers after the scene is loaded, so every
+// worker already has the scene and the acceleration structure (copy on
+// write), and talks to each one over its own Unix socket pair:
+//
+//   coordinator -> worker   render_task: a tile and a range of samples
+//   worker -> coordinator   task_result_header, then the tile's summed
+//                           colors (3 floats per pixel) and sample counts
+//
+// The frame is cut into tasks either by tile (every task has all samples
+// of a tile) or by tile and sample range. Pixel sums and counts add up,
+// so the merged framebuffer averages to the right value however the
+// samples were split. A worker that dies (read or write fails) has its
+// unfinished tasks put back in the queue for the others, and if every
+// worker is gone the coordinator renders what is left itself.
+
+// Color of sample s of pixel (i, j)
+using sample_fn = std::function<color(int i, int j, int sample)>;
+
+struct render_task {
+    int32_t tile;
+    int32_t sample_begin;
+    int32_t sample_end;
+};
+
+struct task_result_header {
+    render_task task;
+    int32_t pixel_count;
+};
+
+enum class split_mode { tiles, samples };
+
+// Every tile with all its samples, or with the samples cut into chunks
+std::vector<render_task> make_render_tasks(int tile_count, int samples_per_pixel, split_mode mode, int chunks) {
+    std::vector<render_task> tasks;
+    if (mode == split_mode::tiles || chunks < 2) {
+        for (int t = 0; t < tile_count; t++) tasks.push_back({t, 0, samples_per_pixel});
+        return tasks;
+    }
+    chunks = std::min(chunks, samples_per_pixel);
+    for (int c = 0; c < chunks; c++) {
+        int begin = samples_per_pixel * c / chunks, end = samples_per_pixel * (c + 1) / chunks;
+        for (int t = 0; t < tile_count; t++) tasks.push_back({t, begin, end});
+    }
+    return tasks;
+}
+
+// Full reads and writes, false once the other side is gone
+inline bool send_all(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        // No SIGPIPE when the peer died, the failed send says enough
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t k = read(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= size_t(k);
+    }
+    return true;
+}
+
+// Sums the task's samples for every pixel of its tile, rows from tl.y0
+// up, in the same order as the single process renderer so a task with
+// all samples gives bit for bit the same sums
+void render_task_pixels(const tile& tl, const render_task& task, const sample_fn& sample,
+                        std::vector<float>& sum, std::vector<uint32_t>& samples) {
+    const int width = tl.x1 - tl.x0;
+    const size_t pixel_count = size_t(width) * (tl.y1 - tl.y0);
+    sum.assign(3 * pixel_count, 0.0f);
+    samples.assign(pixel_count, 0);
+    for (int j = tl.y0; j < tl.y1; j++) {
+        for (int i = tl.x0; i < tl.x1; i++) {
+            color pixel_color(0, 0, 0);
+            for (int s = task.sample_begin; s < task.sample_end; s++) pixel_color += sample(i, j, s);
+            size_t p = size_t(j - tl.y0) * width + (i - tl.x0);
+            sum[3 * p + 0] = static_cast<float>(pixel_color.x());
+            sum[3 * p + 1] = static_cast<float>(pixel_color.y());
+            sum[3 * p + 2] = static_cast<float>(pixel_color.z());
+            samples[p] = task.sample_end - task.sample_begin;
+        }
+    }
+}
+
+// Adds a finished task's pixels into the frame
+void merge_task_pixels(const tile& tl, const std::vector<float>& sum, const std::vector<uint32_t>& samples,
+                       framebuffer& fb) {
+    const int width = tl.x1 - tl.x0;
+    for (int j = tl.y0; j < tl.y1; j++) {
+        for (int i = tl.x0; i < tl.x1; i++) {
+            size_t p = size_t(j - tl.y0) * width + (i - tl.x0);
+            size_t q = size_t(j) * fb.width + i;
+            fb.sum[3 * q + 0] += sum[3 * p + 0];
+            fb.sum[3 * q + 1] += sum[3 * p + 1];
+            fb.sum[3 * q + 2] += sum[3 * p + 2];
+            fb.samples[q] += samples[p];
+        }
+    }
+}
+
+// Worker process loop, renders tasks until the coordinator hangs up
+void run_render_worker(int fd, const std::vector<tile>& tiles, const sample_fn& sample) {
+    std::vector<float> sum;
+    std::vector<uint32_t> samples;
+    render_task task;
+    while (recv_all(fd, &task, sizeof(task))) {
+        if (task.tile < 0 || task.tile >= static_cast<int>(tiles.size())) break;
+        render_task_pixels(tiles[task.tile], task, sample, sum, samples);
+        task_result_header header = {task, static_cast<int32_t>(samples.size())};
+        if (!send_all(fd, &header, sizeof(header)) ||
+            !send_all(fd, sum.data(), sum.size() * sizeof(float)) ||
+            !send_all(fd, samples.data(), samples.size() * sizeof(uint32_t))) {
+            break;
+        }
+    }
+}
+
+struct distributed_stats {
+    int workers_started = 0;
+    int workers_lost = 0;
+    long tasks_reassigned = 0;
+    long tasks_rendered_locally = 0;
+};
+
+class render_coordinator {
+    public:
+        // Tasks in flight per worker, the second one hides the round trip
+        static const int tasks_per_worker = 2;
+
+        render_coordinator(const std::vector<tile>& tiles, const sample_fn& sample, int worker_count)
+            : tiles(tiles), sample(sample), worker_count(worker_count) {}
+
+        // Renders every task into fb. Forks the workers, so call it before
+        // any threads are started. progress gets the number of tasks left.
+        distributed_stats render(const std::vector<render_task>& tasks, framebuffer& fb,
+                                 const std::function<void(size_t)>& progress) const;
+
+    private:
+        struct worker {
+            pid_t pid;
+            int fd;
+            std::deque<render_task> in_flight;
+        };
+
+        const std::vector<tile>& tiles;
+        sample_fn sample;
+        int worker_count;
+};
+
+distributed_stats render_coordinator::render(const std::vector<render_task>& tasks, framebuffer& fb,
+                                             const std::function<void(size_t)>& progress) const {
+    distributed_stats stats;
+    std::deque<render_task> pending(tasks.begin(), tasks.end());
+    size_t remaining = tasks.size();
+
+    std::vector<worker> workers;
+    for (int w = 0; w < worker_count; w++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+        // Flush before forking so buffered output isn't written twice
+        std::cerr << std::flush;
+        fflush(nullptr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            break;
+        }
+        if (pid == 0) {
+            // Worker, drop the coordinator's end of every socket
+            close(fds[0]);
+            for (const worker& other : workers) close(other.fd);
+            run_render_worker(fds[1], tiles, sample);
+            _exit(0);
+        }
+        close(fds[1]);
+        workers.push_back({pid, fds[0], {}});
+        stats.workers_started++;
+    }
+
+    auto lose_worker = [&](worker& wk) {
+        // Its unfinished tasks go first so the frame doesn't end waiting on them
+        stats.tasks_reassigned += static_cast<long>(wk.in_flight.size());
+        for (auto it = wk.in_flight.rbegin(); it != wk.in_flight.rend(); ++it) pending.push_front(*it);
+        wk.in_flight.clear();
+        close(wk.fd);
+        wk.fd = -1;
+        waitpid(wk.pid, nullptr, 0);
+        stats.workers_lost++;
+        std::cerr << "\nWorker " << wk.pid << " died, reassigning its tasks";
+    };
+
+    std::vector<float> sum;
+    std::vector<uint32_t> samples;
+    std::vector<pollfd> polls;
+    std::vector<worker*> polled;
+    while (remaining > 0) {
+        // Keep every live worker busy
+        for (worker& wk : workers) {
+            while (wk.fd >= 0 && !pending.empty() && static_cast<int>(wk.in_flight.size()) < tasks_per_worker) {
+                render_task task = pending.front();
+                if (!send_all(wk.fd, &task, sizeof(task))) {
+                    lose_worker(wk);
+                    break;
+                }
+                pending.pop_front();
+                wk.in_flight.push_back(task);
+            }
+        }
+
+        polls.clear();
+        polled.clear();
+        for (worker& wk : workers) {
+            if (wk.fd >= 0 && !wk.in_flight.empty()) {
+                polls.push_back({wk.fd, POLLIN, 0});
+                polled.push_back(&wk);
+            }
+        }
+
+        if (polls.empty()) {
+            // Every worker is gone, finish the frame here
+            while (!pending.empty()) {
+                render_task task = pending.front();
+                pending.pop_front();
+                render_task_pixels(tiles[task.tile], task, sample, sum, samples);
+                merge_task_pixels(tiles[task.tile], sum, samples, fb);
+                stats.tasks_rendered_locally++;
+                progress(--remaining);
+            }
+            break;
+        }
+
+        if (poll(polls.data(), polls.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (size_t k = 0; k < polls.size(); k++) {
+            if (!(polls[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            worker& wk = *polled[k];
+            task_result_header header;
+            // A result is only merged once all of it has arrived
+            bool ok = recv_all(wk.fd, &header, sizeof(header)) &&
+                      header.task.tile == wk.in_flight.front().tile &&
+                      header.task.sample_begin == wk.in_flight.front().sample_begin;
+            if (ok) {
+                const tile& tl = tiles[header.task.tile];
+                size_t pixel_count = size_t(tl.x1 - tl.x0) * (tl.y1 - tl.y0);
+                ok = header.pixel_count == static_cast<int32_t>(pixel_count);
+                if (ok) {
+                    sum.resize(3 * pixel_count);
+                    samples.resize(pixel_count);
+                    ok = recv_all(wk.fd, sum.data(), sum.size() * sizeof(float)) &&
+                         recv_all(wk.fd, samples.data(), samples.size() * sizeof(uint32_t));
+                }
+            }
+            if (!ok) {
+                lose_worker(wk);
+                continue;
+            }
+            merge_task_pixels(tiles[header.task.tile], sum, samples, fb);
+            wk.in_flight.pop_front();
+            progress(--remaining);
+        }
+    }
+
+    // Closing the socket is the workers' signal to exit
+    for (worker& wk : workers) {
+        if (wk.fd < 0) continue;
+        close(wk.fd);
+        waitpid(wk.pid, nullptr, 0);
+    }
+    return stats;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Linear radiance accumulated per pixel, plus how many samples went into
+// each pixel. Rows are stored bottom up (j = 0 is the bottom row) to match
+// the camera's v coordinate, writers flip them as their format needs.
+// Pixels fed one sample at a time through add_sample also keep a running
+// mean and variance of the sample luminance for adaptive sampling.
+class framebuffer {
+    public:
+        framebuffer() {}
+        framebuffer(int width, int height): width(width), height(height),
+            sum(size_t(width) * height * 3, 0.0f), samples(size_t(width) * height, 0),
+            lum_mean(size_t(width) * height, 0.0f), lum_m2(size_t(width) * height, 0.0f) {}
+
+        int pixel_count() const { return width * height; }
+
+        // Adds the sum of n samples to pixel (i, j)
+        void add(int i, int j, const color& sample_sum, uint32_t n) {
+            size_t p = size_t(j) * width + i;
+            sum[3 * p + 0] += static_cast<float>(sample_sum.x());
+            sum[3 * p + 1] += static_cast<float>(sample_sum.y());
+            sum[3 * p + 2] += static_cast<float>(sample_sum.z());
+            samples[p] += n;
+        }
+
+        // Adds a single sample to pixel (i, j) and updates its luminance
+        // statistics with Welford's update, which stays accurate in float
+        // where a sum of squares would cancel badly
+        void add_sample(int i, int j, const color& sample) {
+            size_t p = size_t(j) * width + i;
+            sum[3 * p + 0] += static_cast<float>(sample.x());
+            sum[3 * p + 1] += static_cast<float>(sample.y());
+            sum[3 * p + 2] += static_cast<float>(sample.z());
+            uint32_t n = ++samples[p];
+            double y = luminance(sample);
+            double delta = y - lum_mean[p];
+            lum_mean[p] += static_cast<float>(delta / n);
+            lum_m2[p] += static_cast<float>(delta * (y - lum_mean[p]));
+        }
+
+        // Unbiased variance of the luminance of the samples in pixel p
+        double variance(size_t p) const {
+            return samples[p] > 1 ? lum_m2[p] / (samples[p] - 1) : 0.0;
+        }
+
+        static double luminance(const color& c) {
+            return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        }
+
+        // Mean radiance of pixel (i, j)
+        color average(int i, int j) const {
+            size_t p = size_t(j) * width + i;
+            double scale = samples[p] ? 1.0 / samples[p] : 0.0;
+            return scale * color(sum[3 * p + 0], sum[3 * p + 1], sum[3 * p + 2]);
+        }
+
+        void clear() {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            std::fill(samples.begin(), samples.end(), 0u);
+            std::fill(lum_mean.begin(), lum_mean.end(), 0.0f);
+            std::fill(lum_m2.begin(), lum_m2.end(), 0.0f);
+        }
+
+    public:
+        int width = 0;
+        int height = 0;
+        std::vector<float> sum;          // rgb sums, 3 floats per pixel
+        std::vector<uint32_t> samples;   // sample count per pixel
+        std::vector<float> lum_mean;     // running luminance mean (add_sample only)
+        std::vector<float> lum_m2;       // sum of squared deviations from the mean
+};
+
+#endif
@@ -3,15 +3,17 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
 
-class material;
+#include <cstdint>
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    uint32_t material_id;   // index into the scene's material_table
+    real t;
     bool front_face;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -22,9 +24,47 @@ struct hit_record {
     }
 };
 
+// Hit records for every lane of a ray_packet. t_max is the closest hit
+// so far per lane, objects only report hits closer than it, and hit has
+// the bit set for every lane that hit anything.
+struct hit_packet_record {
+    hit_record rec[ray_packet::size];
+    real t_max[ray_packet::size];
+    uint64_t hit;
+
+    void reset(real t) {
+        for (int l = 0; l < ray_packet::size; l++) t_max[l] = t;
+        hit = 0;
+    }
+};
+
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+        // Box enclosing the whole object, false if it has none (empty list)
+        virtual bool bounding_box(aabb& output_box) const = 0;
+
+        // True if anything is in the way of the ray between t_min and
+        // t_max. Shadow rays only need that answer, not the closest hit or
+        // its record, so objects that can stop at the first hit override
+        // it. The fallback finds the closest hit like hit() does.
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // Intersects the active lanes of a packet, updating the records of
+        // lanes that hit closer than their t_max. Falls back to one hit()
+        // per lane, objects that can do better override it.
+        virtual void hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const {
+            for (uint64_t m = active; m; m &= m - 1) {
+                int l = first_lane(m);
+                if (hit(packet.get(l), t_min, recs.t_max[l], recs.rec[l])) {
+                    recs.t_max[l] = recs.rec[l].t;
+                    recs.hit |= lane_bit(l);
+                }
+            }
+        }
 };
 
 #endif
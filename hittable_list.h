@@ -13,16 +13,38 @@ class hittable_list: public hittable {
         hittable_list() {}
         hittable_list(shared_ptr<hittable> object) { add(object); }
 
-        void clear() { objects.clear(); }
+        void clear() { objects.clear(); clear_dirty(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        // Whoever moves objects[index] marks it here, accelerators built
+        // over the list catch up with linear_bvh::refit()
+        void mark_dirty(size_t index) {
+            if (dirty_flags.size() < objects.size()) dirty_flags.resize(objects.size(), false);
+            if (dirty_flags[index]) return;
+            dirty_flags[index] = true;
+            dirty.push_back(static_cast<uint32_t>(index));
+        }
+
+        void clear_dirty() {
+            for (uint32_t index : dirty) dirty_flags[index] = false;
+            dirty.clear();
+        }
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const override;
 
     public:
         std::vector<shared_ptr<hittable>> objects;
+        // Indices of the objects moved since the last clear_dirty(), each once
+        std::vector<uint32_t> dirty;
+
+    private:
+        std::vector<bool> dirty_flags;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     bool hit_anything = false;
     auto closes_so_far = t_max;
@@ -43,4 +65,34 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    // Any object in the way will do, no need to look at the rest
+    for (const auto& object: objects) {
+        if (object->occluded(r, t_min, t_max)) return true;
+    }
+    return false;
+}
+
+void hittable_list::hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const {
+    // Every object narrows the per lane t_max of the records,
+    // so after the last one each lane holds its closest hit
+    for (const auto& object: objects) {
+        object->hit_packet(packet, active, t_min, recs);
+    }
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+    if (objects.empty()) return false;
+
+    // Grow one box around every object's box
+    aabb temp_box;
+    bool first_box = true;
+    for (const auto& object: objects) {
+        if (!object->bounding_box(temp_box)) return false;
+        output_box = first_box ? temp_box : surrounding_box(output_box, temp_box);
+        first_box = false;
+    }
+    return true;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,321 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Output formats. Every encoder builds the whole file in memory so it
+// goes out with a single write.
+//   ppm  binary P6, 8 bit gamma corrected
+//   png  8 bit gamma corrected, deflate compressed
+//   pfm  portable float map, linear 32 bit float radiance
+enum class image_format { ppm, png, pfm };
+
+inline bool image_format_from_name(const std::string& name, image_format& format) {
+    if (name == "ppm") format = image_format::ppm;
+    else if (name == "png") format = image_format::png;
+    else if (name == "pfm") format = image_format::pfm;
+    else return false;
+    return true;
+}
+
+// Format from the file extension, binary PPM when there is none (stdout)
+inline image_format image_format_for_path(const std::string& path) {
+    image_format format = image_format::ppm;
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos) image_format_from_name(path.substr(dot + 1), format);
+    return format;
+}
+
+inline void append(std::vector<uint8_t>& out, const std::string& s) {
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+inline void append_be32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+std::vector<uint8_t> encode_ppm(const framebuffer& fb) {
+    std::vector<uint8_t> pixels;
+    resolve_8bit(fb, pixels);
+    std::vector<uint8_t> out;
+    // P6 is the binary flavour of PPM, one byte per channel after the header
+    append(out, "P6\n" + std::to_string(fb.width) + " " + std::to_string(fb.height) + "\n255\n");
+    out.insert(out.end(), pixels.begin(), pixels.end());
+    return out;
+}
+
+std::vector<uint8_t> encode_pfm(const framebuffer& fb) {
+    std::vector<uint8_t> out;
+    // Negative scale means little endian floats, rows go bottom to top
+    // which is already how the framebuffer stores them
+    append(out, "PF\n" + std::to_string(fb.width) + " " + std::to_string(fb.height) + "\n-1.0\n");
+    size_t header = out.size();
+    out.resize(header + size_t(fb.pixel_count()) * 3 * sizeof(float));
+    float* dst = reinterpret_cast<float*>(&out[header]);
+    for (int p = 0; p < fb.pixel_count(); p++) {
+        float scale = fb.samples[p] ? 1.0f / fb.samples[p] : 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float v = fb.sum[3 * p + c] * scale;
+            memcpy(&dst[3 * p + c], &v, sizeof(float));
+        }
+    }
+    return out;
+}
+
+// Minimal PNG pieces: CRC-32 for chunks, Adler-32 and a deflate
+// encoder (fixed Huffman codes plus LZ77 matching) for the zlib stream
+
+inline std::array<uint32_t, 256> make_crc_table() {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+inline uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+    // Built once, the static's initialization is thread safe, so frame
+    // writers and server connections can encode at the same time
+    static const std::array<uint32_t, 256> table = make_crc_table();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t adler32(const uint8_t* data, size_t n) {
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        // 5552 bytes is the most we can add before the sums overflow
+        size_t chunk = n < 5552 ? n : 5552;
+        n -= chunk;
+        while (chunk--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Writes bits least significant first, as deflate wants
+class bit_writer {
+    public:
+        explicit bit_writer(std::vector<uint8_t>& out): out(out) {}
+
+        void put(uint32_t bits, int count) {
+            buffer |= uint64_t(bits) << filled;
+            filled += count;
+            while (filled >= 8) {
+                out.push_back(static_cast<uint8_t>(buffer));
+                buffer >>= 8;
+                filled -= 8;
+            }
+        }
+
+        // Huffman codes are defined most significant bit first
+        void put_code(uint32_t code, int length) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+            put(reversed, length);
+        }
+
+        void flush() {
+            if (filled > 0) out.push_back(static_cast<uint8_t>(buffer));
+            buffer = 0;
+            filled = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        uint64_t buffer = 0;
+        int filled = 0;
+};
+
+// Deflate with one fixed Huffman block and hash chain LZ77 matching
+void deflate_fixed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out) {
+    static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const int dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                      8193, 12289, 16385, 24577};
+    static const int dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    const int window = 32768, min_match = 3, max_match = 258, max_chain = 32;
+    const int hash_bits = 15;
+
+    bit_writer bits(out);
+    // Final block, fixed Huffman codes
+    bits.put(1, 1);
+    bits.put(1, 2);
+
+    auto put_symbol = [&](int sym) {
+        if (sym < 144) bits.put_code(0x30 + sym, 8);
+        else if (sym < 256) bits.put_code(0x190 + sym - 144, 9);
+        else if (sym < 280) bits.put_code(sym - 256, 7);
+        else bits.put_code(0xc0 + sym - 280, 8);
+    };
+
+    std::vector<int> head(1 << hash_bits, -1);
+    std::vector<int> prev(data.size(), -1);
+    auto hash_at = [&](size_t i) {
+        uint32_t h = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8) | data[i + 2];
+        return (h * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](size_t i) {
+        if (i + min_match > data.size()) return;
+        uint32_t h = hash_at(i);
+        prev[i] = head[h];
+        head[h] = static_cast<int>(i);
+    };
+
+    size_t i = 0;
+    while (i < data.size()) {
+        int best_length = 0, best_dist = 0;
+        if (i + min_match <= data.size()) {
+            int limit = static_cast<int>(std::min<size_t>(max_match, data.size() - i));
+            int candidate = head[hash_at(i)];
+            for (int chain = 0; candidate >= 0 && chain < max_chain; chain++) {
+                int dist = static_cast<int>(i) - candidate;
+                if (dist > window) break;
+                int length = 0;
+                while (length < limit && data[candidate + length] == data[i + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_dist = dist;
+                    if (length == limit) break;
+                }
+                candidate = prev[candidate];
+            }
+        }
+
+        if (best_length >= min_match) {
+            int code = 0;
+            while (code < 28 && length_base[code + 1] <= best_length) code++;
+            put_symbol(257 + code);
+            bits.put(best_length - length_base[code], length_extra[code]);
+            int dcode = 0;
+            while (dcode < 29 && dist_base[dcode + 1] <= best_dist) dcode++;
+            bits.put_code(dcode, 5);
+            bits.put(best_dist - dist_base[dcode], dist_extra[dcode]);
+            for (int k = 0; k < best_length; k++) insert(i + k);
+            i += best_length;
+        } else {
+            put_symbol(data[i]);
+            insert(i);
+            i++;
+        }
+    }
+    // End of block
+    put_symbol(256);
+    bits.flush();
+}
+
+inline void append_png_chunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    append_be32(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    append_be32(out, crc32(&out[start], out.size() - start));
+}
+
+std::vector<uint8_t> encode_png(const framebuffer& fb) {
+    std::vector<uint8_t> pixels;
+    resolve_8bit(fb, pixels);
+    const size_t stride = size_t(fb.width) * 3;
+
+    // Every row gets the filter that makes its bytes smallest (sum of
+    // absolute values as signed bytes), the usual PNG heuristic
+    std::vector<uint8_t> filtered;
+    filtered.reserve((stride + 1) * fb.height);
+    std::vector<uint8_t> candidate(stride), best(stride);
+    for (int y = 0; y < fb.height; y++) {
+        const uint8_t* row = &pixels[y * stride];
+        const uint8_t* up = y > 0 ? &pixels[(y - 1) * stride] : nullptr;
+        long best_score = -1;
+        uint8_t best_type = 0;
+        for (uint8_t type = 0; type < 5; type++) {
+            long score = 0;
+            for (size_t k = 0; k < stride; k++) {
+                int a = k >= 3 ? row[k - 3] : 0;
+                int b = up ? up[k] : 0;
+                int c = (up && k >= 3) ? up[k - 3] : 0;
+                int predict = 0;
+                if (type == 1) predict = a;
+                else if (type == 2) predict = b;
+                else if (type == 3) predict = (a + b) / 2;
+                else if (type == 4) {
+                    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                    predict = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                }
+                candidate[k] = static_cast<uint8_t>(row[k] - predict);
+                score += abs(static_cast<int8_t>(candidate[k]));
+            }
+            if (best_score < 0 || score < best_score) {
+                best_score = score;
+                best_type = type;
+                best.swap(candidate);
+            }
+        }
+        filtered.push_back(best_type);
+        filtered.insert(filtered.end(), best.begin(), best.end());
+    }
+
+    std::vector<uint8_t> zlib;
+    // zlib header, deflate with a 32K window, no dictionary
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    deflate_fixed(filtered, zlib);
+    append_be32(zlib, adler32(filtered.data(), filtered.size()));
+
+    std::vector<uint8_t> ihdr;
+    append_be32(ihdr, fb.width);
+    append_be32(ihdr, fb.height);
+    // 8 bit depth, truecolor rgb, deflate, adaptive filtering, no interlace
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+
+    std::vector<uint8_t> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    append_png_chunk(out, "IHDR", ihdr);
+    append_png_chunk(out, "IDAT", zlib);
+    append_png_chunk(out, "IEND", {});
+    return out;
+}
+
+std::vector<uint8_t> encode_image(const framebuffer& fb, image_format format) {
+    switch (format) {
+        case image_format::png: return encode_png(fb);
+        case image_format::pfm: return encode_pfm(fb);
+        default:                return encode_ppm(fb);
+    }
+}
+
+// Writes the encoded image with one fwrite, "-" means stdout.
+// Returns false if the file can't be written.
+bool write_image(const framebuffer& fb, const std::string& path, image_format format) {
+    std::vector<uint8_t> bytes = encode_image(fb, format);
+    FILE* f = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    if (f == stdout) ok = fflush(f) == 0 && ok;
+    else ok = fclose(f) == 0 && ok;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How paths find the emissive spheres of a scene:
+//
+//   bsdf   only by bouncing into them, the renderer as it always was.
+//          Small bright lights take thousands of spp to converge.
+//   nee    next event estimation: every diffuse hit also sends a shadow
+//          ray toward a point on a light and adds what gets through.
+//          Light found by bouncing off a diffuse surface is dropped, the
+//          shadow ray already counted it.
+//   mis    both, combined with the power heuristic (Veach): each gets
+//          weighed by how likely it was to find that light from that
+//          spot, so big lights seen up close come from bouncing and small
+//          far ones from the shadow rays.
+//
+// Scenes without lights render the same in every mode.
+enum class light_sampling { bsdf, nee, mis };
+
+inline bool light_sampling_from_name(const std::string& name, light_sampling& mode) {
+    if (name == "bsdf") mode = light_sampling::bsdf;
+    else if (name == "nee") mode = light_sampling::nee;
+    else if (name == "mis") mode = light_sampling::mis;
+    else return false;
+    return true;
+}
+
+// Weight of a strategy that drew with pdf a against another with pdf b
+inline real power_heuristic(real a, real b) {
+    a *= a;
+    b *= b;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+struct sphere_light {
+    point3 center;
+    real radius;            // magnitude, hollow spheres emit from the outside too
+    uint32_t material_id;
+    color emission;
+};
+
+// A direction from a shading point to a point on a light
+struct light_sample {
+    vec3 direction;         // unit
+    real distance;          // to the light's surface along direction
+    real pdf;               // per solid angle, picking the light included
+    color emission;
+};
+
+// The emissive spheres of a scene, for sampling them directly. Lights are
+// picked in proportion to their power, then a direction is drawn
+// uniformly from the cone the sphere fills as seen from the shading
+// point, which never wastes a sample on the far side of the sphere.
+class light_list {
+    public:
+        light_list() {}
+
+        // Adds the sphere if its material is emissive, false if it isn't.
+        // Every light needs a material of its own, that is how a hit finds
+        // its light again, scene::add_sphere sees to it.
+        bool add(const point3& center, real radius, uint32_t material_id, const material_table& materials) {
+            const material& m = materials[material_id];
+            if (m.kind != material_kind::emissive) return false;
+            lights.push_back({center, std::fabs(radius), material_id, m.emission});
+            total_power += power(lights.back());
+            cdf.push_back(total_power);
+            map_material(material_id, lights.size() - 1);
+            return true;
+        }
+
+        // Puts the lights in a fixed order, by position, and rebuilds the
+        // cdf. The scene cache stores spheres in BVH leaf order, this way
+        // a scene picks the same lights however its spheres were loaded.
+        void sort() {
+            std::sort(lights.begin(), lights.end(), [](const sphere_light& a, const sphere_light& b) {
+                if (a.center.x() != b.center.x()) return a.center.x() < b.center.x();
+                if (a.center.y() != b.center.y()) return a.center.y() < b.center.y();
+                if (a.center.z() != b.center.z()) return a.center.z() < b.center.z();
+                if (a.radius != b.radius) return a.radius < b.radius;
+                return a.material_id < b.material_id;
+            });
+            cdf.clear();
+            total_power = 0;
+            light_of_material.clear();
+            for (size_t k = 0; k < lights.size(); k++) {
+                total_power += power(lights[k]);
+                cdf.push_back(total_power);
+                map_material(lights[k].material_id, k);
+            }
+        }
+
+        bool empty() const { return lights.empty(); }
+        bool uses_material(uint32_t material_id) const {
+            return material_id < light_of_material.size() && light_of_material[material_id] != no_light;
+        }
+        size_t size() const { return lights.size(); }
+
+        // Picks a light with pick and a direction toward it with u and v,
+        // all uniform in [0,1). False if p is inside the light.
+        bool sample(const point3& p, double pick, double u, double v, light_sample& out) const {
+            size_t k = std::upper_bound(cdf.begin(), cdf.end(), pick * total_power) - cdf.begin();
+            if (k >= lights.size()) k = lights.size() - 1;
+            const sphere_light& l = lights[k];
+            vec3 to_center = l.center - p;
+            real distance_squared = to_center.length_squared();
+            real sin2_max = l.radius * l.radius / distance_squared;
+            if (sin2_max >= 1) return false;
+            real one_minus_cos_max = one_minus_cos(sin2_max);
+
+            vec3 w = to_center / std::sqrt(distance_squared);
+            vec3 tangent, bitangent;
+            orthonormal_basis(w, tangent, bitangent);
+            vec3 local = square_to_cone(u, v, one_minus_cos_max);
+            out.direction = local.x() * tangent + local.y() * bitangent + local.z() * w;
+            // Near root of the sphere along the direction, theta is the angle to w
+            real sin2 = local.x() * local.x() + local.y() * local.y();
+            real cos_theta = local.z();
+            out.distance = std::sqrt(distance_squared) * cos_theta -
+                           std::sqrt(std::fmax(real(0), l.radius * l.radius - distance_squared * sin2));
+            out.pdf = select_pdf(k) / (2 * pi * one_minus_cos_max);
+            out.emission = l.emission;
+            return true;
+        }
+
+        // pdf sample() had of drawing the direction from origin that
+        // ended up hitting a light at rec, whose material says which light
+        // it was
+        real pdf(const point3& origin, const hit_record& rec) const {
+            if (rec.material_id >= light_of_material.size()) return 0;
+            uint32_t k = light_of_material[rec.material_id];
+            if (k == no_light) return 0;
+            const sphere_light& l = lights[k];
+            real sin2_max = l.radius * l.radius / (l.center - origin).length_squared();
+            if (sin2_max >= 1) return 0;
+            return select_pdf(k) / (2 * pi * one_minus_cos(sin2_max));
+        }
+
+    public:
+        std::vector<sphere_light> lights;
+        light_sampling mode = light_sampling::mis;
+
+    private:
+        static constexpr uint32_t no_light = UINT32_MAX;
+
+        void map_material(uint32_t material_id, size_t k) {
+            if (material_id >= light_of_material.size()) light_of_material.resize(material_id + 1, no_light);
+            light_of_material[material_id] = static_cast<uint32_t>(k);
+        }
+
+        // Emitted power goes as luminance times surface area
+        static real power(const sphere_light& l) {
+            const color& e = l.emission;
+            real luminance = 0.2126 * e.x() + 0.7152 * e.y() + 0.0722 * e.z();
+            return std::fmax(luminance, real(1e-6)) * l.radius * l.radius;
+        }
+
+        real select_pdf(size_t k) const {
+            return (cdf[k] - (k ? cdf[k - 1] : 0)) / total_power;
+        }
+
+        // 1 - cos from sin^2 without the cancellation for small cones
+        static real one_minus_cos(real sin2) {
+            return sin2 / (1 + std::sqrt(1 - sin2));
+        }
+
+    private:
+        std::vector<real> cdf;      // running sum of the light powers
+        real total_power = 0;
+        std::vector<uint32_t> light_of_material;    // light index by material id, no_light for the rest
+};
+
+#endif
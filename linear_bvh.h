@@ -0,0 +1,524 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// One node of a flattened BVH, exactly 32 bytes so two nodes share a
+// cache line. Bounds are floats rounded outwards so the box never
+// shrinks compared to the double precision one it came from.
+struct alignas(32) linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    // Interior node: index of the right child (left child is always the
+    // next node). Leaf: index of its first primitive.
+    uint32_t offset;
+    // Number of primitives, 0 for interior nodes
+    uint16_t count;
+    // Axis the node was split along, picks the near child first
+    uint8_t axis;
+    uint8_t pad;
+
+    bool hit(const point3& origin, const vec3& inv_dir, real t_min, real t_max) const {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (bounds_min[a] - origin[a]) * inv_dir[a];
+            auto t1 = (bounds_max[a] - origin[a]) * inv_dir[a];
+            if (inv_dir[a] < 0.0) std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max <= t_min) return false;
+        }
+        return true;
+    }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes");
+
+// Traversal stack depth, the builder switches to median splits early
+// enough that no branch gets this deep
+const int linear_bvh_stack_size = 64;
+
+// linear_bvh_node::hit() for every lane of a packet at once, branch free
+// so it vectorizes, with an AVX2 clone picked at load time
+__attribute__((target_clones("avx2", "default")))
+static void linear_bvh_packet_slabs(const linear_bvh_node& node, const ray_packet& packet,
+                                    const real* __restrict inv_dx, const real* __restrict inv_dy,
+                                    const real* __restrict inv_dz, real t_min,
+                                    const real* __restrict t_max, bool* __restrict lane_hit) {
+    const real min_x = node.bounds_min[0], min_y = node.bounds_min[1], min_z = node.bounds_min[2];
+    const real max_x = node.bounds_max[0], max_y = node.bounds_max[1], max_z = node.bounds_max[2];
+    for (int l = 0; l < ray_packet::size; l++) {
+        auto tx0 = (min_x - packet.ox[l]) * inv_dx[l], tx1 = (max_x - packet.ox[l]) * inv_dx[l];
+        auto ty0 = (min_y - packet.oy[l]) * inv_dy[l], ty1 = (max_y - packet.oy[l]) * inv_dy[l];
+        auto tz0 = (min_z - packet.oz[l]) * inv_dz[l], tz1 = (max_z - packet.oz[l]) * inv_dz[l];
+        auto near = t_min;
+        near = tx0 < tx1 ? (tx0 > near ? tx0 : near) : (tx1 > near ? tx1 : near);
+        near = ty0 < ty1 ? (ty0 > near ? ty0 : near) : (ty1 > near ? ty1 : near);
+        near = tz0 < tz1 ? (tz0 > near ? tz0 : near) : (tz1 > near ? tz1 : near);
+        auto far = t_max[l];
+        far = tx0 < tx1 ? (tx1 < far ? tx1 : far) : (tx0 < far ? tx0 : far);
+        far = ty0 < ty1 ? (ty1 < far ? ty1 : far) : (ty0 < far ? ty0 : far);
+        far = tz0 < tz1 ? (tz1 < far ? tz1 : far) : (tz0 < far ? tz0 : far);
+        lane_hit[l] = near < far;
+    }
+}
+
+// Closest hit walk over a flattened BVH, shared by every structure that
+// stores linear_bvh_nodes. leaf(first, count, closest_so_far) tests the
+// primitives of one leaf, shrinks closest_so_far to any hit it finds and
+// returns whether it found one. Walks with a small fixed stack and visits
+// the child nearer to the ray first.
+template <typename leaf_fn>
+bool linear_bvh_traverse(const linear_bvh_node* nodes, const ray& r, real t_min, real t_max, leaf_fn&& leaf) {
+    const point3 origin = r.origin();
+    const vec3 dir = r.direction();
+    const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+
+    uint32_t stack[linear_bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(bvh_nodes);
+        if (node.hit(origin, inv_dir, t_min, closest_so_far)) {
+            if (node.count > 0) {
+                // Leaf, test its packed primitives
+                if (leaf(node.offset, uint32_t(node.count), closest_so_far)) hit_anything = true;
+            } else {
+                // Visit the near child now and push the far one, for a ray
+                // going in the negative direction the right child is nearer
+                if (dir[node.axis] < 0) {
+                    stack[stack_top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_top == 0) break;
+        current = stack[--stack_top];
+    }
+
+    return hit_anything;
+}
+
+// Any hit walk over a flattened BVH for occlusion queries. leaf(first,
+// count) returns whether anything in the leaf blocks the ray, and the
+// walk stops at the first leaf that does. The near child still goes
+// first: blockers close to the origin are the likely ones.
+template <typename leaf_fn>
+bool linear_bvh_occluded(const linear_bvh_node* nodes, const ray& r, real t_min, real t_max, leaf_fn&& leaf) {
+    const point3 origin = r.origin();
+    const vec3 dir = r.direction();
+    const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+
+    uint32_t stack[linear_bvh_stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(bvh_nodes);
+        if (node.hit(origin, inv_dir, t_min, t_max)) {
+            if (node.count > 0) {
+                if (leaf(node.offset, uint32_t(node.count))) return true;
+            } else {
+                if (dir[node.axis] < 0) {
+                    stack[stack_top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_top == 0) return false;
+        current = stack[--stack_top];
+    }
+}
+
+// BVH laid out in one contiguous array in depth first order with the
+// primitives of every leaf packed next to each other. Traversal walks the
+// array with a small fixed stack instead of chasing shared_ptrs, and visits
+// the child nearer to the ray first so far subtrees get culled by the
+// closest hit found so far.
+class linear_bvh: public hittable {
+    public:
+        linear_bvh() {}
+        linear_bvh(const hittable_list& list): linear_bvh(list.objects) {}
+        linear_bvh(const std::vector<shared_ptr<hittable>>& src_objects);
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+        virtual void hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const override;
+
+        // Builds the tree again from scratch over objects
+        void rebuild(const std::vector<shared_ptr<hittable>>& src_objects);
+
+        // Catches up with the objects in list.dirty having moved, list has
+        // to be the one the tree was built from. The boxes of their leaves
+        // and every box above them are refitted bottom up, the tree's shape
+        // stays. Refitted boxes overlap more and more as objects wander, so
+        // once the SAH cost has grown past rebuild_growth times its cost
+        // after the last build the tree is rebuilt instead. Clears the dirty
+        // set, returns true if it rebuilt.
+        bool refit(hittable_list& list);
+
+        // Expected node visits plus primitive tests for a ray that hits the
+        // root box, from the node areas relative to the root's
+        double sah_cost() const;
+
+    public:
+        std::vector<linear_bvh_node> nodes;
+        // Raw pointers in leaf order, owners keeps them alive
+        std::vector<const hittable*> primitives;
+        std::vector<shared_ptr<hittable>> owners;
+        // Index of every primitive in the list the tree was built from
+        std::vector<uint32_t> source_indices;
+
+        double built_cost = 0;
+        double rebuild_growth = 1.5;
+
+    private:
+        // Leaves hold at most this many primitives
+        static const int max_leaf_size = 4;
+        // Cost of visiting a node relative to one primitive test
+        static constexpr double traversal_cost = 1.0;
+        // Whether a branch of count primitives at depth can still be
+        // finished with median splits, which add ceil(log2(count)) levels
+        // at most, without a leaf going deeper than stack_size - 2. SAH
+        // splits are only taken while their children would still fit, so
+        // traversal, which stacks one node per level, never overflows.
+        static const int stack_size = linear_bvh_stack_size;
+        static bool fits_stack(int depth, size_t count) {
+            int levels = 0;
+            while ((size_t(1) << levels) < count) levels++;
+            return depth + levels < stack_size - 1;
+        }
+
+        uint32_t build(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth);
+        uint32_t make_leaf(std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& box);
+        static void store_bounds(linear_bvh_node& node, const aabb& box);
+
+        // Area of a node's box weighted by what visiting it costs
+        double weighted_area(const linear_bvh_node& node) const;
+        // Recomputes node i's box from its primitives or children, false
+        // if it came out the same
+        bool refit_node(uint32_t i);
+
+    private:
+        // Sum of weighted_area() over all nodes, kept up to date by refits
+        double weighted_area_sum = 0;
+        // Filled in by the first refit: parent of every node, leaf of every
+        // primitive and primitive of every object in the source list
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> leaf_of_primitive;
+        std::vector<uint32_t> primitive_of_source;
+};
+
+linear_bvh::linear_bvh(const std::vector<shared_ptr<hittable>>& src_objects) {
+    rebuild(src_objects);
+}
+
+void linear_bvh::rebuild(const std::vector<shared_ptr<hittable>>& src_objects) {
+    nodes.clear();
+    primitives.clear();
+    owners.clear();
+    source_indices.clear();
+    parents.clear();
+    leaf_of_primitive.clear();
+    primitive_of_source.clear();
+    weighted_area_sum = 0;
+    built_cost = 0;
+
+    std::vector<bvh_primitive> prims;
+    prims.reserve(src_objects.size());
+    for (size_t i = 0; i < src_objects.size(); i++) {
+        aabb b;
+        if (!src_objects[i]->bounding_box(b)) {
+            std::cerr << "No bounding box in linear_bvh constructor.\n";
+            continue;
+        }
+        if (!box_is_finite(b)) {
+            std::cerr << "Non-finite bounding box in linear_bvh constructor.\n";
+            continue;
+        }
+        prims.push_back({src_objects[i], b, b.centroid(), static_cast<uint32_t>(i)});
+    }
+    if (prims.empty()) return;
+
+    // A binary tree with at least one primitive per leaf
+    // has fewer than 2N nodes
+    nodes.reserve(2 * prims.size());
+    primitives.reserve(prims.size());
+    owners.reserve(prims.size());
+    source_indices.reserve(prims.size());
+    build(prims, 0, prims.size(), 0);
+
+    for (const linear_bvh_node& node : nodes) weighted_area_sum += weighted_area(node);
+    built_cost = sah_cost();
+}
+
+double linear_bvh::weighted_area(const linear_bvh_node& node) const {
+    double dx = double(node.bounds_max[0]) - node.bounds_min[0];
+    double dy = double(node.bounds_max[1]) - node.bounds_min[1];
+    double dz = double(node.bounds_max[2]) - node.bounds_min[2];
+    double area = 2 * (dx * dy + dy * dz + dz * dx);
+    return area * (node.count > 0 ? node.count : traversal_cost);
+}
+
+double linear_bvh::sah_cost() const {
+    if (nodes.empty()) return 0;
+    double root_area = weighted_area(nodes[0]) / (nodes[0].count > 0 ? nodes[0].count : traversal_cost);
+    return root_area > 0 ? weighted_area_sum / root_area : 0;
+}
+
+bool linear_bvh::refit_node(uint32_t i) {
+    linear_bvh_node& node = nodes[i];
+    linear_bvh_node fitted = node;
+    if (node.count > 0) {
+        aabb box;
+        primitives[node.offset]->bounding_box(box);
+        for (uint32_t p = node.offset + 1; p < node.offset + node.count; p++) {
+            aabb b;
+            primitives[p]->bounding_box(b);
+            box = surrounding_box(box, b);
+        }
+        store_bounds(fitted, box);
+    } else {
+        // Children are already rounded outwards, their union needs no more
+        const linear_bvh_node& left = nodes[i + 1];
+        const linear_bvh_node& right = nodes[node.offset];
+        for (int a = 0; a < 3; a++) {
+            fitted.bounds_min[a] = std::min(left.bounds_min[a], right.bounds_min[a]);
+            fitted.bounds_max[a] = std::max(left.bounds_max[a], right.bounds_max[a]);
+        }
+    }
+    if (!memcmp(fitted.bounds_min, node.bounds_min, sizeof(node.bounds_min)) &&
+        !memcmp(fitted.bounds_max, node.bounds_max, sizeof(node.bounds_max))) {
+        return false;
+    }
+    weighted_area_sum += weighted_area(fitted) - weighted_area(node);
+    node = fitted;
+    return true;
+}
+
+bool linear_bvh::refit(hittable_list& list) {
+    if (nodes.empty()) {
+        list.clear_dirty();
+        return false;
+    }
+    const uint32_t none = ~0u;
+    if (parents.empty()) {
+        parents.assign(nodes.size(), none);
+        leaf_of_primitive.assign(primitives.size(), none);
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].count > 0) {
+                for (uint32_t p = nodes[i].offset; p < nodes[i].offset + nodes[i].count; p++) leaf_of_primitive[p] = i;
+            } else {
+                parents[i + 1] = i;
+                parents[nodes[i].offset] = i;
+            }
+        }
+        primitive_of_source.assign(list.objects.size(), none);
+        for (uint32_t p = 0; p < source_indices.size(); p++) primitive_of_source[source_indices[p]] = p;
+    }
+
+    if (list.dirty.size() * 8 >= primitives.size()) {
+        // Most leaves moved, one sweep from the back refits children before
+        // their parents since nodes are stored depth first
+        for (uint32_t i = static_cast<uint32_t>(nodes.size()); i-- > 0;) refit_node(i);
+    } else {
+        // Walk up from each moved leaf. A box that comes out unchanged
+        // leaves everything above it as it was, as far as this leaf goes.
+        for (uint32_t index : list.dirty) {
+            if (index >= primitive_of_source.size() || primitive_of_source[index] == none) continue;
+            uint32_t i = leaf_of_primitive[primitive_of_source[index]];
+            while (refit_node(i) && i != 0) i = parents[i];
+        }
+    }
+    list.clear_dirty();
+
+    if (sah_cost() > rebuild_growth * built_cost) {
+        rebuild(list.objects);
+        return true;
+    }
+    return false;
+}
+
+void linear_bvh::store_bounds(linear_bvh_node& node, const aabb& box) {
+    for (int a = 0; a < 3; a++) {
+        // Round outwards so float bounds still contain the double box
+        node.bounds_min[a] = std::nextafter(static_cast<float>(box.min()[a]), -std::numeric_limits<float>::infinity());
+        node.bounds_max[a] = std::nextafter(static_cast<float>(box.max()[a]), std::numeric_limits<float>::infinity());
+    }
+}
+
+uint32_t linear_bvh::make_leaf(std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& box) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    linear_bvh_node& node = nodes.back();
+    store_bounds(node, box);
+    node.offset = static_cast<uint32_t>(primitives.size());
+    node.count = static_cast<uint16_t>(end - start);
+    node.axis = 0;
+    node.pad = 0;
+    for (size_t i = start; i < end; i++) {
+        primitives.push_back(prims[i].object.get());
+        owners.push_back(prims[i].object);
+        source_indices.push_back(prims[i].index);
+    }
+    return index;
+}
+
+uint32_t linear_bvh::build(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth) {
+    aabb box = prims[start].box;
+    for (size_t i = start + 1; i < end; i++) box = surrounding_box(box, prims[i].box);
+
+    size_t count = end - start;
+    if (count == 1) return make_leaf(prims, start, end, box);
+
+    size_t mid;
+    int axis;
+    if (fits_stack(depth + 1, count)) {
+        double split_cost;
+        mid = sah_split(prims, start, end, &split_cost, &axis);
+        // Stop splitting once testing every primitive in the leaf is no
+        // more expensive than a node visit plus the expected child tests
+        if (count <= max_leaf_size && count * box.surface_area() <= traversal_cost * box.surface_area() + split_cost) {
+            return make_leaf(prims, start, end, box);
+        }
+    } else {
+        // Too deep for the traversal stack, balance the rest of the branch
+        mid = start + count / 2;
+        axis = box.longest_axis();
+        std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+            [axis](const bvh_primitive& a, const bvh_primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    store_bounds(nodes[index], box);
+    nodes[index].count = 0;
+    nodes[index].axis = static_cast<uint8_t>(axis);
+    nodes[index].pad = 0;
+
+    // Left child lands right after us, so only the right one needs an offset
+    build(prims, start, mid, depth + 1);
+    uint32_t right = build(prims, mid, end, depth + 1);
+    nodes[index].offset = right;
+    return index;
+}
+
+bool linear_bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    if (nodes.empty()) return false;
+    return linear_bvh_traverse(nodes.data(), r, t_min, t_max,
+        [&](uint32_t first, uint32_t count, real& closest_so_far) {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->hit(r, t_min, closest_so_far, rec)) {
+                    hit_anything = true;
+                    closest_so_far = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+}
+
+bool linear_bvh::occluded(const ray& r, real t_min, real t_max) const {
+    if (nodes.empty()) return false;
+    return linear_bvh_occluded(nodes.data(), r, t_min, t_max,
+        [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->occluded(r, t_min, t_max)) return true;
+            }
+            return false;
+        });
+}
+
+void linear_bvh::hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const {
+    if (nodes.empty() || !active) return;
+
+    // Same walk as hit() but the whole packet goes down together, a node
+    // is visited with the mask of lanes that hit its box. Coherent rays
+    // share most of their nodes so one node fetch serves many rays.
+    real inv_dx[ray_packet::size], inv_dy[ray_packet::size], inv_dz[ray_packet::size];
+    for (int l = 0; l < ray_packet::size; l++) {
+        inv_dx[l] = 1.0 / packet.dx[l];
+        inv_dy[l] = 1.0 / packet.dy[l];
+        inv_dz[l] = 1.0 / packet.dz[l];
+    }
+    // Near child order is picked from one representative lane
+    const int lead = first_lane(active);
+    const real lead_dir[3] = {packet.dx[lead], packet.dy[lead], packet.dz[lead]};
+
+    uint32_t node_stack[stack_size];
+    uint64_t mask_stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    uint64_t mask = active;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        uint64_t node_mask = 0;
+        if (__builtin_popcountll(mask) >= ray_packet::size / 4) {
+            // Dense mask, slab test every lane in one vectorized pass
+            bool lane_hit[ray_packet::size];
+            linear_bvh_packet_slabs(node, packet, inv_dx, inv_dy, inv_dz, t_min, recs.t_max, lane_hit);
+            for (int l = 0; l < ray_packet::size; l++) node_mask |= uint64_t(lane_hit[l]) << l;
+            node_mask &= mask;
+        } else {
+            for (uint64_t m = mask; m; m &= m - 1) {
+                int l = first_lane(m);
+                point3 origin(packet.ox[l], packet.oy[l], packet.oz[l]);
+                vec3 inv_dir(inv_dx[l], inv_dy[l], inv_dz[l]);
+                if (node.hit(origin, inv_dir, t_min, recs.t_max[l])) node_mask |= lane_bit(l);
+            }
+        }
+        if (node_mask) {
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    primitives[i]->hit_packet(packet, node_mask, t_min, recs);
+                }
+            } else {
+                uint32_t near = current + 1, far = node.offset;
+                if (lead_dir[node.axis] < 0) std::swap(near, far);
+                node_stack[stack_top] = far;
+                mask_stack[stack_top++] = node_mask;
+                current = near;
+                mask = node_mask;
+                continue;
+            }
+        }
+        if (stack_top == 0) break;
+        current = node_stack[--stack_top];
+        mask = mask_stack[stack_top];
+    }
+}
+
+bool linear_bvh::bounding_box(aabb& output_box) const {
+    if (nodes.empty()) return false;
+    const linear_bvh_node& root = nodes[0];
+    output_box = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                      point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+    return true;
+}
+
+#endif
@@ -1,124 +1,566 @@
 #include "rtweekend.h"
 
+#include "adaptive.h"
+#include "animation.h"
+#include "bvh.h"
 #include "color.h"
+#include "distributed.h"
+#include "framebuffer.h"
 #include "hittable_list.h"
+#include "image_writer.h"
+#include "lights.h"
+#include "linear_bvh.h"
 #include "sphere.h"
+#include "sphere_soa.h"
 #include "camera.h"
+#include "checkpoint.h"
 #include "material.h"
+#include "ray_packet.h"
+#include "render.h"
+#include "render_server.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "thread_pool.h"
+#include "wavefront.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
 
-color ray_color(const ray &r, const hittable& world, int depth) {
-    // Information of where our ray hit our object
-    hit_record rec;
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0) {
-        return color(0, 0, 0);
-    }
-    // Go through our worlds object list
-    // and check what we hit
-    // Our hit record is set for our ray r which gives us the point
-    // our ray hit and the normal from that point
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            // This recursive ray color calculation keeps going until our
-            // ray stops hitting a and object in our world, falling
-            // past our if statement, attenuation is our color which (always)
-            // being less than 1 for x, y, z will slowly decrease our color
-            // on each recursive call acting like shading
-            // Since this is recursive eventually the ray will fall through
-            // not hitting any object leading the color to be decided by
-            // the code below which makes our sky, this is what shades
-            // our world object with sky color UNLESS we exceed our depth 
-            // which leads to getting the black color which could lead to black 
-            // spots this is probably what happens in blender in glass!!
-            return attenuation * ray_color(scattered, world, depth - 1);
-        }
-        // Happens in metal when normal and scattered direction
-        // are not similar meaning the ray is bouncing inwards?
-        // so make it black?
-        return color(0, 0, 0);
-    }
-    // Unit vector is normalized direction
-    vec3 unit_direction = unit_vector(r.direction());
-    // Makes t go from 0 to 1 since y is between -1 & 1
-    // since y is a unit vector (between -1 & 1)!!
-    auto t = 0.5 * (unit_direction.y() + 1.0);
-    // Interpolation simple 1.0 - t * v1 + t * v2
-    // think dijkstras algorithm (bezier curves)
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+// Wraps the world in the acceleration structure picked on the command line
+shared_ptr<hittable> make_accelerator(const std::string& kind, const hittable_list& world) {
+    if (kind == "linear_bvh") return make_shared<linear_bvh>(world);
+    if (kind == "bvh") return make_shared<bvh_node>(world);
+    if (kind == "soa") return make_shared<sphere_soa>(world);
+    if (kind == "list") return make_shared<hittable_list>(world);
+    return nullptr;
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--threads N] [--seed S] [--accel linear_bvh|bvh|soa|list] [--packets | --wavefront]\n"
+              << "       [--output FILE] [--format ppm|png|pfm] [--spp N] [--adaptive [--noise T]]\n"
+              << "       [--sampler independent|sobol|halton|blue_noise] [--lights bsdf|nee|mis]\n"
+              << "       [--scene FILE] [--cache FILE] [--roulette N [--roulette-threshold T]]\n"
+              << "       [--workers N [--split tiles|samples]] [--checkpoint FILE [--checkpoint-interval S] [--resume]]\n"
+              << "       [--frames FILE] [--serve PORT] [--profile] [--trace FILE]\n";
 }
 
 // x is horizontal, y is vertical, z is depth
-int main() {
+int main(int argc, char** argv) {
+
+    // Options
+    int thread_count = thread_pool::default_thread_count();
+    uint64_t seed = 0;
+    std::string accel_kind = "linear_bvh";
+    bool packets = false;
+    bool wavefront = false;
+    // "-" is stdout, the format comes from the file extension unless given
+    std::string output_path = "-";
+    std::string format_name;
+    // Overrides the scene's spp, with --adaptive it is the most samples any pixel gets
+    int samples_per_pixel = 0;
+    std::string scene_path;
+    std::string cache_path;
+    bool adaptive = false;
+    adaptive_settings adaptive_opts;
+    sampler_kind sampler = sampler_kind::independent;
+    // How paths find the scene's emissive spheres
+    light_sampling light_mode = light_sampling::mis;
+    // Russian roulette after N bounces, off unless given
+    roulette_settings roulette;
+    // Worker processes for the render, 0 renders on this process's threads
+    int worker_count = 0;
+    split_mode split = split_mode::tiles;
+    // Finished tiles are saved to the checkpoint every interval seconds
+    std::string checkpoint_path;
+    double checkpoint_interval = 30;
+    bool resume = false;
+    // Camera path, renders one image per frame with --output as the name pattern
+    std::string frames_path;
+    // Keeps the scene loaded and renders jobs sent over HTTP, see render_server.h
+    int serve_port = -1;
+    // Counters and Chrome trace spans, only in builds with -DRT_PROFILE
+    bool profile = false;
+    std::string trace_path;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--threads") && a + 1 < argc) {
+            thread_count = atoi(argv[++a]);
+        } else if (!strcmp(argv[a], "--seed") && a + 1 < argc) {
+            seed = strtoull(argv[++a], nullptr, 10);
+        } else if (!strcmp(argv[a], "--accel") && a + 1 < argc) {
+            accel_kind = argv[++a];
+        } else if (!strcmp(argv[a], "--packets")) {
+            packets = true;
+        } else if (!strcmp(argv[a], "--wavefront")) {
+            wavefront = true;
+        } else if (!strcmp(argv[a], "--output") && a + 1 < argc) {
+            output_path = argv[++a];
+        } else if (!strcmp(argv[a], "--format") && a + 1 < argc) {
+            format_name = argv[++a];
+        } else if (!strcmp(argv[a], "--spp") && a + 1 < argc) {
+            samples_per_pixel = atoi(argv[++a]);
+            if (samples_per_pixel < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--scene") && a + 1 < argc) {
+            scene_path = argv[++a];
+        } else if (!strcmp(argv[a], "--cache") && a + 1 < argc) {
+            cache_path = argv[++a];
+        } else if (!strcmp(argv[a], "--adaptive")) {
+            adaptive = true;
+        } else if (!strcmp(argv[a], "--noise") && a + 1 < argc) {
+            adaptive_opts.noise_threshold = atof(argv[++a]);
+        } else if (!strcmp(argv[a], "--sampler") && a + 1 < argc) {
+            if (!sampler_from_name(argv[++a], sampler)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--lights") && a + 1 < argc) {
+            if (!light_sampling_from_name(argv[++a], light_mode)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--roulette") && a + 1 < argc) {
+            roulette.min_bounces = atoi(argv[++a]);
+            if (roulette.min_bounces < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--roulette-threshold") && a + 1 < argc) {
+            roulette.threshold = atof(argv[++a]);
+            if (!(roulette.threshold > 0)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--workers") && a + 1 < argc) {
+            worker_count = atoi(argv[++a]);
+            if (worker_count < 1) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--split") && a + 1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "tiles")) split = split_mode::tiles;
+            else if (!strcmp(argv[a], "samples")) split = split_mode::samples;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--checkpoint") && a + 1 < argc) {
+            checkpoint_path = argv[++a];
+        } else if (!strcmp(argv[a], "--checkpoint-interval") && a + 1 < argc) {
+            checkpoint_interval = atof(argv[++a]);
+        } else if (!strcmp(argv[a], "--resume")) {
+            resume = true;
+        } else if (!strcmp(argv[a], "--frames") && a + 1 < argc) {
+            frames_path = argv[++a];
+        } else if (!strcmp(argv[a], "--serve") && a + 1 < argc) {
+            serve_port = atoi(argv[++a]);
+            if (serve_port < 0 || serve_port > 65535) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[a], "--profile")) {
+            profile = true;
+        } else if (!strcmp(argv[a], "--trace") && a + 1 < argc) {
+            trace_path = argv[++a];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    image_format format = image_format_for_path(output_path);
+    // Adaptive sampling and worker processes drive the one ray at a time path
+    // Checkpoints are kept per tile of a fixed spp render on this process
+    // Animations render every frame on this process, without checkpoints
+    // The scene cache always holds a linear_bvh
+    // The server renders its jobs progressively on this process's threads
+    if ((adaptive && (packets || wavefront)) || (!cache_path.empty() && accel_kind != "linear_bvh") ||
+        (worker_count > 0 && (adaptive || packets || wavefront)) ||
+        (resume && checkpoint_path.empty()) || (!checkpoint_path.empty() && (adaptive || worker_count > 0)) ||
+        (!frames_path.empty() && (worker_count > 0 || !checkpoint_path.empty())) ||
+        (serve_port >= 0 && (adaptive || packets || wavefront || worker_count > 0 || !checkpoint_path.empty() ||
+                             !frames_path.empty()))) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!format_name.empty() && !image_format_from_name(format_name, format)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+#ifndef RT_PROFILE
+    if (profile || !trace_path.empty()) {
+        std::cerr << "--profile and --trace need a build with -DRT_PROFILE (make main_profile)\n";
+        return 1;
+    }
+#endif
+    profile_counting = profile;
+    profile_tracing = !trace_path.empty();
+
+    // Scene, from --scene or the three spheres from the book. With --cache
+    // a cache built from the same source is mapped instead, which skips
+    // both parsing and the BVH build.
+    scene sc;
+    shared_ptr<hittable> accel;
+    scene_cache cache;
+    // Identifies the scene source for the cache and checkpoints
+    uint64_t source_stamp = 0;
+    if (!cache_path.empty() || !checkpoint_path.empty()) {
+        if (scene_path.empty()) {
+            source_stamp = scene_text_stamp(default_scene);
+        } else if (!scene_source_stamp(scene_path, source_stamp)) {
+            std::cerr << scene_path << ": cannot open " << scene_path << "\n";
+            return 1;
+        }
+    }
+    auto load_start = std::chrono::steady_clock::now();
+    if (!cache_path.empty()) {
+        std::string why;
+        RT_SPAN("map scene cache");
+        if (cache.open(cache_path, source_stamp, why)) {
+            cache.apply_settings(sc);
+            accel = cache.accelerator();
+            double map_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+            std::cerr << "Mapped " << cache.sphere_count() << " spheres from " << cache_path << " in "
+                      << map_seconds << " s, peak RSS " << peak_rss_mib() << " MiB\n";
+        } else {
+            std::cerr << "Scene cache " << cache_path << " " << why << ", rebuilding\n";
+        }
+    }
+
+    if (!accel) {
+        RT_SPAN("load scene");
+        scene_loader loader(sc);
+        if (!(scene_path.empty() ? loader.load_string(default_scene) : loader.load_file(scene_path))) {
+            std::cerr << (scene_path.empty() ? "default scene" : scene_path) << ": " << loader.error << "\n";
+            return 1;
+        }
+        double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+        std::cerr << "Loaded " << sc.world.objects.size() << " objects, " << sc.materials.size()
+                  << " materials and " << sc.lights.size() << " lights in " << load_seconds << " s, arena " << sc.storage->bytes_used() / (1024.0 * 1024.0)
+                  << " MiB, peak RSS " << peak_rss_mib() << " MiB\n";
+
+        if (!cache_path.empty()) {
+            // Render from the fresh cache so both runs trace the same structure
+            std::string why;
+            if (write_scene_cache(cache_path, sc, source_stamp, why) && cache.open(cache_path, source_stamp, why)) {
+                accel = cache.accelerator();
+            } else {
+                std::cerr << "Scene cache " << cache_path << ": " << why << "\n";
+            }
+        }
+        // Acceleration structure over the world
+        if (!accel) {
+            RT_SPAN("build accelerator");
+            accel = make_accelerator(accel_kind, sc.world);
+        }
+        if (!accel) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!frames_path.empty()) {
+        scene_loader loader(sc, scene_statements::camera_path);
+        if (!loader.load_file(frames_path)) {
+            std::cerr << frames_path << ": " << loader.error << "\n";
+            return 1;
+        }
+        if (sc.frames.empty()) {
+            std::cerr << frames_path << ": no frames\n";
+            return 1;
+        }
+    }
+    // Scene loading and the accelerator build are paid once for all frames
+    double setup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
 
     // Image dimensions
-    const auto aspect_ratio = 16.0 / 9.0;
-    const int image_width = 400;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel = 100;
-    const int max_depth = 50;
-
-    // World
-    hittable_list world;
-
-    auto material_ground = make_shared<lambertian>(color(0.8, 0.8, 0.0));
-    auto material_center = make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto material_left   = make_shared<dielectric>(1.5);
-    auto material_right  = make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-
-    world.add(make_shared<sphere>(point3( 0.0, -100.5, -1.0), 100.0, material_ground));
-    world.add(make_shared<sphere>(point3( 0.0,    0.0, -1.0),   0.5, material_center));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0),   0.5, material_left));
-    world.add(make_shared<sphere>(point3(-1.0,    0.0, -1.0), -0.45, material_left));
-    world.add(make_shared<sphere>(point3( 1.0,    0.0, -1.0),   0.5, material_right));
-
-    // Camera
-    // Decides our camera's orientation to the look at point
-    // in it's local axes
-    vec3 vup = vec3(0, 1, 0);
-    // Where our camera is positioned in our scene
-    point3 lookfrom = point3(3, 3, 2);
-    // Where we are looking at in our scene
-    point3 lookat = point3(0, 0, -1);
-    // Distance from lookfrom to look at length
-    auto dist_to_focus = (lookfrom - lookat).length();
-    // Aperture
-    auto aperture = 2.0;
-    // Make our camera with fov 90 and aspect ratio
-    camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
-
-    // Start of PPM format requires P3 for color space
-    // and image width and height
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-
-    for (int j = image_height - 1; j >= 0; j--) {
-        // Print out to err to see progress
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; i++) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; s++) {
-                // random double 'swerves' u and v into neighboring pixel
-                // making our ray calculation blend surrounding pixels
-                // calculated ray colors
-                // u akin to moving along x values of image towards the right
-                auto u = double(i + random_double()) / (image_width - 1);
-                // v akin to moving along y values of image towards the bottom
-                auto v = double(j + random_double()) / (image_height - 1);
-                // Create our ray from our cameras origin using our images pixels
-                // to form our direction which we get from u and v
-                ray r = cam.get_ray(u, v);
-                // Adds to color by using unit direction and y coordinate to
-                // generate gradient between white and blue
-                // Also generates the shading for all of our hittable
-                // objects using normal shading
-                pixel_color += ray_color(r, world, max_depth);
+    const int image_width = sc.image_width;
+    const int image_height = sc.image_height();
+    if (samples_per_pixel < 1) samples_per_pixel = sc.samples_per_pixel;
+    const int max_depth = sc.max_depth;
+    const int tile_size = 16;
+    const material_table& materials = sc.materials;
+    sc.lights.mode = light_mode;
+    const light_list& lights = sc.lights;
+
+    sampler_mode = sampler;
+    sampler_image_width = image_width;
+    // Build the blue noise tile now rather than inside the first tile
+    if (sampler == sampler_kind::blue_noise) blue_noise_tile();
+
+    if (serve_port >= 0) {
+        // Jobs start from the scene's settings, --spp included
+        sc.samples_per_pixel = samples_per_pixel;
+        thread_pool pool(thread_count);
+        render_server server(sc, *accel, pool, seed, roulette);
+        std::string why;
+        if (!server.listen(serve_port, why)) {
+            std::cerr << "Cannot listen on port " << serve_port << ": " << why << "\n";
+            return 1;
+        }
+        std::cerr << "Set up in " << setup_seconds << " s, serving on http://127.0.0.1:" << server.bound_port
+                  << "/ with " << pool.size() << " threads\n";
+        server.serve();
+        return 1;
+    }
+
+    camera cam = sc.make_camera();
+
+    // Render
+    // Every tile writes its own pixels of the framebuffer so threads
+    // never touch the same memory, we only write the image out
+    // once everything is done
+    framebuffer fb(image_width, image_height);
+    std::vector<tile> tiles = make_tiles(image_width, image_height, tile_size);
+
+    // With --workers the frame is rendered by worker processes, which are
+    // forked before this process starts any threads of its own
+    if (worker_count > 0) {
+        RT_SPAN("render");
+        sample_fn sample = [&](int i, int j, int s) {
+            seed_pixel_sample(seed, j * image_width + i, s);
+            double du, dv;
+            sample_2d(du, dv);
+            auto u = double(i + du) / (image_width - 1);
+            auto v = double(j + dv) / (image_height - 1);
+            return ray_color(cam.get_ray(u, v), *accel, materials, lights, max_depth, roulette);
+        };
+        render_coordinator coordinator(tiles, sample, worker_count);
+        std::vector<render_task> tasks = make_render_tasks(static_cast<int>(tiles.size()), samples_per_pixel, split, worker_count);
+        distributed_stats ds = coordinator.render(tasks, fb, [](size_t left) {
+            std::cerr << "\rTasks remaining: " << left << ' ' << std::flush;
+        });
+        std::cerr << "\nWorkers: " << ds.workers_started << " started, " << ds.workers_lost << " lost, "
+                  << ds.tasks_reassigned << " tasks reassigned, " << ds.tasks_rendered_locally << " rendered locally";
+    }
+    thread_pool pool(worker_count > 0 ? 1 : thread_count);
+
+    // Tiles still to render, a resumed checkpoint already has some of them
+    std::vector<int> todo;
+    std::vector<uint8_t> tile_states(tiles.size(), checkpoint_file::tile_pending);
+    checkpoint_file checkpoint;
+    std::unique_ptr<checkpoint_saver> saver;
+    if (!checkpoint_path.empty()) {
+        checkpoint_header header = make_checkpoint_header(image_width, image_height, samples_per_pixel, max_depth, tile_size,
+                                                          static_cast<int>(tiles.size()), seed, source_stamp, roulette, accel_kind,
+                                                          sampler, light_mode);
+        std::string why;
+        bool resumed = resume && checkpoint.resume(checkpoint_path, header, tiles, fb, tile_states, why);
+        if (resume && !resumed && why != "missing") {
+            std::cerr << "Checkpoint " << checkpoint_path << " " << why << "\n";
+            return 1;
+        }
+        if (resumed) {
+            std::cerr << "Resuming from " << checkpoint_path << ", " << checkpoint.tiles_loaded << " of "
+                      << tiles.size() << " tiles done\n";
+        } else if (!checkpoint.create(checkpoint_path, header, why)) {
+            std::cerr << "Checkpoint " << why << "\n";
+            return 1;
+        }
+        saver.reset(new checkpoint_saver(checkpoint, tiles, fb, tile_states, checkpoint_interval));
+    }
+    for (int t = 0; t < static_cast<int>(tiles.size()); t++) {
+        if (tile_states[t] == checkpoint_file::tile_pending) todo.push_back(t);
+    }
+
+    std::mutex progress_mutex;
+    int tiles_remaining = static_cast<int>(todo.size());
+
+    // Wavefront scratch buffers and stage timings, one per worker
+    wavefront_tracer wavefront_engine(cam, *accel, materials, lights, image_width, image_height, samples_per_pixel,
+                                      max_depth, seed, roulette);
+    std::vector<wavefront_paths> worker_paths(wavefront ? pool.size() : 0);
+    std::vector<wavefront_stats> worker_stats(pool.size());
+    // Path length histograms, one per worker
+    std::vector<path_stats> worker_path_stats(pool.size());
+
+    // Fixed spp, every pixel of a tile gets all its samples at once
+    auto render_tile = [&](int t, int worker) {
+        RT_SPAN("tile");
+        const tile& tl = tiles[t];
+        if (wavefront) {
+            wavefront_engine.render(tl, fb, worker_paths[worker], worker_stats[worker], worker_path_stats[worker]);
+        } else if (packets) {
+            // 8x8 ray packets, all samples of a block accumulate in place
+            for (int y = tl.y0; y < tl.y1; y += 8) {
+                for (int x = tl.x0; x < tl.x1; x += 8) {
+                    color block[ray_packet::size];
+                    for (int s = 0; s < samples_per_pixel; s++) {
+                        trace_packet(x, y, s, image_width, image_height, seed, cam, *accel, materials, lights,
+                                     max_depth, roulette, worker_path_stats[worker], block);
+                    }
+                    for (int l = 0; l < ray_packet::size; l++) {
+                        int i = x + l % 8, j = y + l / 8;
+                        if (i < tl.x1 && j < tl.y1) fb.add(i, j, block[l], samples_per_pixel);
+                    }
+                }
+            }
+        } else {
+            for (int j = tl.y0; j < tl.y1; j++) {
+                for (int i = tl.x0; i < tl.x1; i++) {
+                    color pixel_color(0, 0, 0);
+                    for (int s = 0; s < samples_per_pixel; s++) {
+                        // Seed from the pixel and sample, not the thread, so the
+                        // image is the same however the tiles get scheduled
+                        seed_pixel_sample(seed, j * image_width + i, s);
+                        // The first two sample dimensions 'swerve' u and v into
+                        // neighboring pixel making our ray calculation blend
+                        // surrounding pixels calculated ray colors
+                        double du, dv;
+                        sample_2d(du, dv);
+                        // u akin to moving along x values of image towards the right
+                        auto u = double(i + du) / (image_width - 1);
+                        // v akin to moving along y values of image towards the bottom
+                        auto v = double(j + dv) / (image_height - 1);
+                        // Create our ray from our cameras origin using our images pixels
+                        // to form our direction which we get from u and v
+                        ray r = cam.get_ray(u, v);
+                        // Adds to color by using unit direction and y coordinate to
+                        // generate gradient between white and blue
+                        // Also generates the shading for all of our hittable
+                        // objects using normal shading
+                        pixel_color += ray_color(r, *accel, materials, lights, max_depth, roulette,
+                                                 &worker_path_stats[worker]);
+                    }
+                    fb.add(i, j, pixel_color, samples_per_pixel);
+                }
             }
-            // Formats for ppm and averages our samples
-            write_color(std::cout, pixel_color, samples_per_pixel);
         }
+        // Print out to err to see progress
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        std::cerr << "\rTiles remaining: " << --tiles_remaining << ' ' << std::flush;
+    };
+
+    // Renders the frame cam sees into fb, on this process's threads
+    auto render_frame = [&]() {
+        if (adaptive) {
+            // Progressive passes until the noise threshold or --spp is reached
+            adaptive_opts.max_samples = samples_per_pixel;
+            adaptive_opts.min_samples = std::min(adaptive_opts.min_samples, samples_per_pixel);
+            adaptive_renderer adaptive_engine(cam, *accel, materials, lights, image_width, image_height, max_depth,
+                                              seed, adaptive_opts, roulette);
+            RT_SPAN("render");
+            adaptive_stats as = adaptive_engine.render(pool, tiles, fb, worker_path_stats);
+            std::cerr << "\nAdaptive sampling: " << as.passes << " passes, " << as.samples << " of "
+                      << as.budget << " samples (" << 100.0 * (as.budget - as.samples) / as.budget
+                      << "% saved), " << as.converged_pixels << " pixels converged early";
+        } else {
+            RT_SPAN("render");
+            pool.run(static_cast<int>(todo.size()), [&](int k, int worker) {
+                render_tile(todo[k], worker);
+                if (saver) saver->tile_rendered(todo[k]);
+            });
+        }
+    };
+
+    if (sc.frames.empty()) {
+        if (worker_count == 0) render_frame();
+        if (saver && !saver->finish()) {
+            std::cerr << "\nCould not write checkpoint " << checkpoint_path;
+        }
+
+        // Encode the whole image in memory and write it out in one go
+        bool written;
+        {
+            RT_SPAN("write image");
+            written = write_image(fb, output_path, format);
+        }
+        if (!written) {
+            std::cerr << "\nCould not write " << output_path << "\n";
+            return 1;
+        }
+        // The image is out, the checkpoint has served its purpose
+        if (saver) {
+            std::cerr << "\nCheckpoints: " << saver->checkpoints << " written, " << saver->tiles_saved << " tiles saved";
+            checkpoint.remove();
+        }
+    } else {
+        // One image per frame of the camera path, every frame with the same
+        // seed so whatever stands still on screen doesn't flicker. Frame n
+        // is written on the writer thread while frame n + 1 renders.
+        frame_writer writer(format);
+        auto rays_so_far = [&]() {
+            uint64_t rays = 0;
+            for (const auto& ps : worker_path_stats) rays += ps.rays();
+            return rays;
+        };
+        const int frame_count = static_cast<int>(sc.frames.size());
+        uint64_t total_samples = 0;
+        uint64_t rays_before = rays_so_far();
+        auto batch_start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frame_count; f++) {
+            auto frame_start = std::chrono::steady_clock::now();
+            cam = sc.make_camera(sc.frames[f]);
+            tiles_remaining = static_cast<int>(todo.size());
+            render_frame();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+
+            uint64_t samples = 0;
+            for (uint32_t n : fb.samples) samples += n;
+            uint64_t rays = rays_so_far();
+            total_samples += samples;
+            std::cerr << "\nFrame " << f << ": " << seconds << " s, " << samples / seconds / 1e6 << " Msamples/s, "
+                      << (rays - rays_before) / seconds / 1e6 << " Mrays/s";
+            rays_before = rays;
+
+            fb = writer.write(std::move(fb), frame_output_path(output_path, f));
+            if (fb.width == 0) fb = framebuffer(image_width, image_height);
+            else fb.clear();
+        }
+        if (!writer.finish()) {
+            std::cerr << "\nCould not write " << writer.failed_path << "\n";
+            return 1;
+        }
+        // Amortized over the whole batch, loading and building included
+        double batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_start).count();
+        double total_seconds = setup_seconds + batch_seconds;
+        std::cerr << "\nAnimation: " << frame_count << " frames in " << total_seconds << " s ("
+                  << setup_seconds << " s scene setup, once), " << frame_count / total_seconds << " frames/s, "
+                  << total_samples / total_seconds / 1e6 << " Msamples/s amortized"
+                  << "\nWriting: " << writer.write_seconds << " s, " << writer.wait_seconds
+                  << " s of it not hidden behind rendering";
+    }
+
+    if (wavefront) {
+        // Stage times summed over all threads
+        wavefront_stats total;
+        for (const auto& ws : worker_stats) total.add(ws);
+        std::cerr << "\nWavefront stages (thread seconds): generate " << total.generate
+                  << ", intersect " << total.intersect << ", sort " << total.sort
+                  << ", shade " << total.shade << ", compact " << total.compact
+                  << ", accumulate " << total.accumulate << ", rays " << total.rays;
+    }
+
+    // Path lengths in rays traced, how many paths ended at each length.
+    // Worker processes keep theirs.
+    path_stats lengths;
+    for (const auto& ps : worker_path_stats) lengths.add(ps);
+    if (lengths.paths() > 0) {
+        std::cerr << "\nPaths: " << lengths.paths() << ", mean length " << lengths.mean_length() << " rays";
+        if (roulette.enabled()) {
+            std::cerr << ", " << 100.0 * lengths.roulette_ended / lengths.paths() << "% ended by roulette";
+        }
+        std::cerr << "\nPath lengths:";
+        for (size_t n = 0; n < lengths.lengths.size(); n++) {
+            if (lengths.lengths[n]) std::cerr << " " << n << ":" << lengths.lengths[n];
+        }
+    }
+
+    if (profile) {
+        std::cerr << "\n" << std::flush;
+        profiler::instance().print_counters(stderr, max_depth);
+    }
+    if (!trace_path.empty() && !profiler::instance().write_chrome_trace(trace_path)) {
+        std::cerr << "\nCould not write " << trace_path << "\n";
+        return 1;
     }
 
     std::cerr << "\nDone.\n";
@@ -3,104 +3,159 @@
 
 #include "rtweekend.h"
 
-struct hit_record;
+#include "hittable.h"
 
-class material {
-    public:
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
-};
+#include <cstdint>
+#include <vector>
 
-class lambertian: public material {
-    public:
-        lambertian(const color& a): albedo(a) {}
-
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            // Our hit record gave us the normal of the hittable that
-            // our ray intersected with so we find a random point s 
-            // in the normals unit sphere, this record point is given
-            // by target = rec.p + rec.normal + random unit vector
-            // Then we generate a direction from our normal origin in the random
-            // direction created using our random target point this is
-            // S - P or target - rec.p so our scatter direction simplifies
-            // to this below
-            auto scatter_direction = rec.normal + random_unit_vector();
-            // Catch bad scatters near zero that could cause NaNs
-            if (scatter_direction.near_zero()) {
-                scatter_direction = rec.normal;
-            }
-            // Here we actually create the ray with its origin and direction
-            scattered = ray(rec.p, scatter_direction);
-            // Our color
-            attenuation = albedo;
-            return true;
-        }
-    
-    public:
-        color albedo;
-};
+// Which concrete material a material is, lets batch renderers
+// group hits by material before shading them
+enum class material_kind { lambertian, metal, dielectric, emissive };
+const int material_kind_count = 4;
 
-class metal: public material {
-    public:
-        metal(const color& a, double f): albedo(a), fuzz(f < 1 ? f : 1) {}
-    
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            // For our metal materials we need to get the reflected vector
-            vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            // Here we actually create the ray with its origin and direction
-            // here fuzziness double randomizes the reflected direction creates
-            // a 'fuzzy' effect on the reflection of our metal surface.
-            scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
-            // Our color
-            attenuation = albedo;
-            return (dot(scattered.direction(), rec.normal) > 0);
-        }
-    
-    public:
-        color albedo;
-        double fuzz;
+// Every material is one flat record tagged with its kind, the fields a
+// kind doesn't use are left at their defaults. Scenes keep their materials
+// in a material_table and hits refer to them by a 32 bit id, so finding a
+// hit's material is an array lookup with no reference counting and
+// scattering is a switch instead of a virtual call.
+struct material {
+    material_kind kind = material_kind::lambertian;
+    color albedo = color(0, 0, 0);
+    real fuzz = 0;
+    real ir = 1;
+    color emission = color(0, 0, 0);
 };
 
-class dielectric: public material {
+// Materials of a scene, stored contiguously and addressed by id
+class material_table {
     public:
-        dielectric(double index_of_refraction): ir(index_of_refraction) {}
-
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            // Glass is white
-            attenuation = color(1.0, 1.0, 1.0);
-            // Our refraction amount is dependent on our normal directions
-            double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
-            // Necessary for snells law calculation below
-            vec3 unit_direction = unit_vector(r_in.direction());
-
-            // Voodoo magic to see if we should refract this ray
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-            vec3 direction;
-            // Reflect or refract using schlick approx for second OR
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double()) {
-                // Reflect if we cannot refract
-                direction = reflect(unit_direction, rec.normal);
-            } else {
-                // Does some weird math im too lazy to understand right now to make 
-                // refracted ray direction
-                direction = refract(unit_direction, rec.normal, refraction_ratio);
-            }
-            // Make our ray
-            scattered = ray(rec.p, direction);
-            return true;
+        uint32_t add(const material& m) {
+            materials.push_back(m);
+            return static_cast<uint32_t>(materials.size() - 1);
         }
-    
+
+        const material& operator[](uint32_t id) const { return materials[id]; }
+        size_t size() const { return materials.size(); }
+
     public:
-        double ir;
-
-    private:
-        static double reflectance(double cosine, double ref_idx) {
-            // Use Schlick's approximation for reflectance.
-            auto r0 = (1 - ref_idx) / (1 + ref_idx);
-            r0 = r0 * r0;
-            return r0 + (1 - r0) * pow((1 - cosine), 5);
-        }
+        std::vector<material> materials;
 };
 
+// One maker per kind, they keep the book's material names
+inline material lambertian(const color& a) {
+    material m;
+    m.kind = material_kind::lambertian;
+    m.albedo = a;
+    return m;
+}
+
+inline material metal(const color& a, real f) {
+    material m;
+    m.kind = material_kind::metal;
+    m.albedo = a;
+    m.fuzz = f < 1 ? f : 1;
+    return m;
+}
+
+inline material dielectric(real index_of_refraction) {
+    material m;
+    m.kind = material_kind::dielectric;
+    m.ir = index_of_refraction;
+    return m;
+}
+
+// A light: gives off emission from its outside and absorbs whatever hits it
+inline material emissive(const color& emission) {
+    material m;
+    m.kind = material_kind::emissive;
+    m.emission = emission;
+    return m;
+}
+
+bool scatter_lambertian(const material& m, const hit_record& rec, color& attenuation, ray& scattered) {
+    // Our hit record gave us the normal of the hittable that
+    // our ray intersected with, the book went from there to a random
+    // point on the unit sphere around rec.p + rec.normal, which makes
+    // directions cosine weighted around the normal. We draw that
+    // distribution directly, it comes out unit length and can't
+    // degenerate to a zero vector like the sum could.
+    auto scatter_direction = sample_cosine_direction(rec.normal);
+    // Here we actually create the ray with its origin and direction
+    scattered = ray(rec.p, scatter_direction);
+    // Our color
+    attenuation = m.albedo;
+    return true;
+}
+
+bool scatter_metal(const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+    // For our metal materials we need to get the reflected vector,
+    // the incoming direction is unit length already
+    vec3 reflected = reflect(r_in.direction(), rec.normal);
+    // Here we actually create the ray with its origin and direction
+    // here fuzziness double randomizes the reflected direction creates
+    // a 'fuzzy' effect on the reflection of our metal surface.
+    // Normalized once here so the next bounce doesn't have to.
+    if (m.fuzz > 0) reflected = unit_vector(reflected + m.fuzz * sample_in_unit_sphere());
+    scattered = ray(rec.p, reflected);
+    // Our color
+    attenuation = m.albedo;
+    if (dot(scattered.direction(), rec.normal) > 0) return true;
+    RT_COUNT(metal_absorbed);
+    return false;
+}
+
+inline real reflectance(real cosine, real ref_idx) {
+    // Use Schlick's approximation for reflectance.
+    auto r0 = (1 - ref_idx) / (1 + ref_idx);
+    r0 = r0 * r0;
+    return r0 + (1 - r0) * schlick_weight(cosine);
+}
+
+bool scatter_dielectric(const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+    // Glass is white
+    attenuation = color(1.0, 1.0, 1.0);
+    // Our refraction amount is dependent on our normal directions
+    real refraction_ratio = rec.front_face ? (1.0 / m.ir) : m.ir;
+    // Necessary for snells law calculation below, rays come in unit length
+    vec3 unit_direction = r_in.direction();
+
+    // Voodoo magic to see if we should refract this ray
+    real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+    real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+    if (cannot_refract) RT_COUNT(total_internal_reflections);
+    vec3 direction;
+    // Reflect or refract using schlick approx for second OR
+    if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d()) {
+        // Reflect if we cannot refract
+        direction = reflect(unit_direction, rec.normal);
+    } else {
+        // Does some weird math im too lazy to understand right now to make
+        // refracted ray direction
+        direction = refract(unit_direction, rec.normal, refraction_ratio);
+    }
+    // Make our ray
+    scattered = ray(rec.p, direction);
+    return true;
+}
+
+// Scatters r_in off the hit with the hit's material. Returns false when
+// the ray gets absorbed. r_in's direction has to be unit length (camera
+// rays are) and scattered's comes out unit length too, so no material
+// normalizes what the last bounce already did.
+inline bool scatter(const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+    switch (m.kind) {
+        case material_kind::lambertian: return scatter_lambertian(m, rec, attenuation, scattered);
+        case material_kind::metal:      return scatter_metal(m, r_in, rec, attenuation, scattered);
+        case material_kind::dielectric: return scatter_dielectric(m, r_in, rec, attenuation, scattered);
+        case material_kind::emissive:   return false;
+    }
+    return false;
+}
+
+// Light the hit's material gives off toward the ray, only lights have any
+inline color emitted(const material& m, const hit_record& rec) {
+    return rec.front_face ? m.emission : color(0, 0, 0);
+}
+
 #endif
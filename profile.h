@@ -0,0 +1,199 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Hot path instrumentation. Compiled in with -DRT_PROFILE and then
+// switched on at run time (main's --profile and --trace), without
+// RT_PROFILE every macro expands to nothing:
+//
+//   RT_COUNT(name)           adds one to a per thread counter
+//   RT_COUNT_N(name, n)      adds n
+//   RT_COUNT_DEPTH(depth)    one ray traced with depth bounces left
+//   RT_COUNT_DEPTH_N(depth, n)
+//   RT_SPAN("name")          times the enclosing scope as a trace event
+//
+// Every thread bumps its own block and the blocks are only added up once
+// the render is done, so threads never write to shared memory. Compiled
+// in but switched off, an event costs a load and a branch on a global.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct profile_counters {
+    static const int depth_bins = 64;
+
+    uint64_t rays = 0;                          // world.hit() calls from the tracers
+    uint64_t sphere_tests = 0;                  // ray/sphere intersection tests
+    uint64_t bvh_nodes = 0;                     // BVH boxes tested
+    uint64_t scatters = 0;                      // hits that bounced on
+    uint64_t metal_absorbed = 0;                // metal bounces below the surface
+    uint64_t total_internal_reflections = 0;    // dielectric hits that couldn't refract
+    uint64_t shadow_rays = 0;                   // next event estimation rays toward a light
+    uint64_t shadow_rays_blocked = 0;           // of them, ones that something was in the way of
+    uint64_t rays_by_depth[depth_bins] = {};    // indexed by bounces left, capped
+
+    void count_depth(int depth, uint64_t n) {
+        rays_by_depth[depth < depth_bins ? (depth > 0 ? depth : 0) : depth_bins - 1] += n;
+    }
+
+    void add(const profile_counters& o) {
+        rays += o.rays;
+        sphere_tests += o.sphere_tests;
+        bvh_nodes += o.bvh_nodes;
+        scatters += o.scatters;
+        metal_absorbed += o.metal_absorbed;
+        total_internal_reflections += o.total_internal_reflections;
+        shadow_rays += o.shadow_rays;
+        shadow_rays_blocked += o.shadow_rays_blocked;
+        for (int d = 0; d < depth_bins; d++) rays_by_depth[d] += o.rays_by_depth[d];
+    }
+};
+
+// One completed span, times in ns since the profiler started
+struct trace_event {
+    const char* name;
+    int64_t begin;
+    int64_t duration;
+};
+
+// Everything one thread records, on its own cache lines
+struct alignas(64) profile_thread {
+    int id;
+    profile_counters counters;
+    std::vector<trace_event> events;
+};
+
+// Switches read on every event, set them before the render starts
+inline bool profile_counting = false;
+inline bool profile_tracing = false;
+
+// Owns the blocks of every thread that recorded anything. Blocks outlive
+// their threads so pool workers can exit before the results are read.
+class profiler {
+    public:
+        static profiler& instance() {
+            static profiler p;
+            return p;
+        }
+
+        // The calling thread's block, registered on first use
+        profile_thread& thread_block() {
+            thread_local profile_thread* block = nullptr;
+            if (!block) {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.emplace_back(new profile_thread());
+                block = threads.back().get();
+                block->id = static_cast<int>(threads.size()) - 1;
+            }
+            return *block;
+        }
+
+        int64_t now() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Merged counters of all threads, call once the workers are idle
+        profile_counters totals();
+        void print_counters(FILE* f, int max_depth);
+        // Chrome trace event JSON, loads in chrome://tracing and Perfetto
+        bool write_chrome_trace(const std::string& path);
+
+    private:
+        profiler(): start(std::chrono::steady_clock::now()) {}
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<profile_thread>> threads;
+        std::chrono::steady_clock::time_point start;
+};
+
+profile_counters profiler::totals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    profile_counters sum;
+    for (const auto& t : threads) sum.add(t->counters);
+    return sum;
+}
+
+void profiler::print_counters(FILE* f, int max_depth) {
+    profile_counters c = totals();
+    double per_ray = c.rays ? 1.0 / c.rays : 0;
+    fprintf(f, "Profile: %llu rays, %llu sphere tests (%.1f per ray), %llu BVH nodes (%.1f per ray)\n",
+            (unsigned long long)c.rays, (unsigned long long)c.sphere_tests, c.sphere_tests * per_ray,
+            (unsigned long long)c.bvh_nodes, c.bvh_nodes * per_ray);
+    fprintf(f, "Profile: %llu scatters, %llu metal rays absorbed, %llu total internal reflections\n",
+            (unsigned long long)c.scatters, (unsigned long long)c.metal_absorbed,
+            (unsigned long long)c.total_internal_reflections);
+    if (c.shadow_rays) {
+        fprintf(f, "Profile: %llu shadow rays, %.1f%% blocked\n", (unsigned long long)c.shadow_rays,
+                100.0 * c.shadow_rays_blocked / c.shadow_rays);
+    }
+    // Bins count bounces left, turn them into bounces taken
+    fprintf(f, "Profile: rays per bounce:");
+    for (int bounce = 0; bounce < max_depth; bounce++) {
+        int depth = max_depth - bounce;
+        if (depth >= profile_counters::depth_bins) continue;
+        uint64_t n = c.rays_by_depth[depth];
+        if (n == 0) break;
+        fprintf(f, " %d:%llu", bounce, (unsigned long long)n);
+    }
+    fprintf(f, "\n");
+}
+
+bool profiler::write_chrome_trace(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (const auto& t : threads) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                first ? "" : ",\n", t->id, t->id);
+        first = false;
+        // Complete events, ts and dur are in microseconds
+        for (const trace_event& e : t->events) {
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    e.name, t->id, e.begin / 1000.0, e.duration / 1000.0);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+// Records the scope it lives in as one trace event when tracing is on
+class profile_span {
+    public:
+        explicit profile_span(const char* name): name(name), begin(profile_tracing ? profiler::instance().now() : -1) {}
+
+        ~profile_span() {
+            if (begin < 0) return;
+            profiler& p = profiler::instance();
+            int64_t end = p.now();
+            p.thread_block().events.push_back({name, begin, end - begin});
+        }
+
+        profile_span(const profile_span&) = delete;
+        profile_span& operator =(const profile_span&) = delete;
+
+    private:
+        const char* name;
+        int64_t begin;
+};
+
+#ifdef RT_PROFILE
+#define RT_COUNT_N(name, n) do { if (profile_counting) profiler::instance().thread_block().counters.name += (n); } while (0)
+#define RT_COUNT_DEPTH_N(depth, n) do { if (profile_counting) profiler::instance().thread_block().counters.count_depth(depth, n); } while (0)
+#define RT_SPAN_CONCAT(a, b) a##b
+#define RT_SPAN_NAME(line) RT_SPAN_CONCAT(rt_span_, line)
+#define RT_SPAN(name) profile_span RT_SPAN_NAME(__LINE__)(name)
+#else
+#define RT_COUNT_N(name, n) do {} while (0)
+#define RT_COUNT_DEPTH_N(depth, n) do {} while (0)
+#define RT_SPAN(name) do {} while (0)
+#endif
+#define RT_COUNT(name) RT_COUNT_N(name, 1)
+#define RT_COUNT_DEPTH(depth) RT_COUNT_DEPTH_N(depth, 1)
+
+#endif
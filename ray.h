@@ -3,6 +3,8 @@
 
 #include "vec3.h"
 
+#include <limits>
+
 class ray {
     public:
         ray() {}
@@ -12,7 +14,7 @@ class ray {
         point3 origin() const  { return orig; }
         vec3 direction() const { return dir; }
 
-        point3 at(double t) const {
+        point3 at(real t) const {
             // Point at t distance along our ray
             return orig + t * dir;
         }
@@ -21,4 +23,22 @@ class ray {
         vec3 dir;
 };
 
+// Smallest t a bounce may hit at, so a ray leaving a surface doesn't hit
+// that same surface again (shadow acne). The book's 0.001 works for the
+// packet paths, which share one t_min per packet.
+const real ray_epsilon = 0.001;
+
+// ray_epsilon, grown for rays that start far from the origin. A hit
+// point is only accurate to a few ulps of its coordinates, which in float
+// can exceed 0.001 in large scenes. t counts direction lengths, hence the
+// division. In double the bound never wins for any sane scene, so
+// results match the fixed epsilon.
+inline real ray_t_min(const ray& r) {
+    const point3 o = r.origin();
+    real scale = std::fmax(std::fabs(o.x()), std::fmax(std::fabs(o.y()), std::fabs(o.z())));
+    real bound = scale * 64 * std::numeric_limits<real>::epsilon();
+    real length_squared = r.direction().length_squared();
+    return bound * bound > ray_epsilon * ray_epsilon * length_squared ? bound / std::sqrt(length_squared) : ray_epsilon;
+}
+
 #endif
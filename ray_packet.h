@@ -0,0 +1,37 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+
+#include <cstdint>
+
+// A bundle of up to 64 rays (an 8x8 block of pixels) stored as one array
+// per component, so a loop over the lanes reads each component
+// contiguously and the compiler can vectorize it. Which lanes are still
+// alive is tracked outside the packet as a 64 bit mask, bit l for lane l.
+struct ray_packet {
+    static const int size = 64;
+
+    alignas(64) real ox[size], oy[size], oz[size];
+    alignas(64) real dx[size], dy[size], dz[size];
+
+    void set(int l, const ray& r) {
+        ox[l] = r.orig.x(); oy[l] = r.orig.y(); oz[l] = r.orig.z();
+        dx[l] = r.dir.x();  dy[l] = r.dir.y();  dz[l] = r.dir.z();
+    }
+
+    ray get(int l) const {
+        return ray(point3(ox[l], oy[l], oz[l]), vec3(dx[l], dy[l], dz[l]));
+    }
+};
+
+// Lane index of the lowest set bit, for walking a mask of active lanes
+inline int first_lane(uint64_t mask) {
+    return __builtin_ctzll(mask);
+}
+
+inline uint64_t lane_bit(int l) {
+    return uint64_t(1) << l;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "ray_packet.h"
+
+#include <algorithm>
+#include <vector>
+
+// Sky color for rays that escape the scene
+color background(const ray& r) {
+    // Camera and scattered rays are unit length already
+    vec3 unit_direction = r.direction();
+    // Makes t go from 0 to 1 since y is between -1 & 1
+    // since y is a unit vector (between -1 & 1)!!
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+    // Interpolation simple 1.0 - t * v1 + t * v2
+    // think dijkstras algorithm (bezier curves)
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+// Russian roulette. Once a path has taken min_bounces bounces it only
+// carries on with probability p = brightest throughput channel / threshold
+// (at most 1), and a survivor's throughput is divided by p. Dim paths end
+// early while the expected color stays the same. Paths brighter than the
+// threshold always survive, so white glass paths never get cut: with only
+// the sky as a light, ending one throws away its whole contribution. A
+// lower threshold only culls really dim paths and adds less noise.
+struct roulette_settings {
+    int min_bounces = -1;       // -1 turns roulette off
+    real threshold = 1;
+
+    bool enabled() const { return min_bounces >= 0; }
+
+    real survival(const color& throughput) const {
+        return std::fmin(std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())) / threshold, real(1));
+    }
+};
+
+// How long paths got, one per thread and merged after the render
+struct path_stats {
+    std::vector<uint64_t> lengths;      // paths by number of rays traced
+    uint64_t roulette_ended = 0;        // paths roulette cut short
+
+    void record(int length) {
+        if (length >= static_cast<int>(lengths.size())) lengths.resize(length + 1, 0);
+        lengths[length]++;
+    }
+
+    void add(const path_stats& o) {
+        if (o.lengths.size() > lengths.size()) lengths.resize(o.lengths.size(), 0);
+        for (size_t n = 0; n < o.lengths.size(); n++) lengths[n] += o.lengths[n];
+        roulette_ended += o.roulette_ended;
+    }
+
+    uint64_t paths() const {
+        uint64_t total = 0;
+        for (uint64_t n : lengths) total += n;
+        return total;
+    }
+
+    // Rays traced by all paths together
+    uint64_t rays() const {
+        uint64_t total = 0;
+        for (size_t n = 0; n < lengths.size(); n++) total += n * lengths[n];
+        return total;
+    }
+
+    double mean_length() const {
+        return paths() ? double(rays()) / paths() : 0;
+    }
+};
+
+// Light a diffuse hit gets straight from one light, through a shadow ray
+color direct_light(const material& m, const hit_record& rec, const hittable& world, const light_list& lights) {
+    // Drawn whether or not the shadow ray gets through, so every path
+    // uses its sample dimensions the same way
+    double pick = sample_1d();
+    double u, v;
+    sample_2d(u, v);
+    light_sample ls;
+    if (!lights.sample(rec.p, pick, u, v, ls)) return color(0, 0, 0);
+    real cosine = dot(ls.direction, rec.normal);
+    if (cosine <= 0) return color(0, 0, 0);
+    RT_COUNT(shadow_rays);
+    ray shadow(rec.p, ls.direction);
+    // Stop just short of the light so its own surface doesn't block it
+    if (world.occluded(shadow, ray_t_min(shadow), ls.distance * (1 - real(1e-4)))) {
+        RT_COUNT(shadow_rays_blocked);
+        return color(0, 0, 0);
+    }
+    // The lambertian BSDF is albedo / pi, times the cosine, over the pdf
+    real bsdf_pdf = cosine / pi;
+    real weight = lights.mode == light_sampling::mis ? power_heuristic(ls.pdf, bsdf_pdf) : 1;
+    return (weight * bsdf_pdf / ls.pdf) * m.albedo * ls.emission;
+}
+
+// What a path picks up at one hit and how it carries on from there
+struct path_vertex {
+    color radiance;         // emitted and direct light leaving the hit along the ray, before the path's throughput
+    color attenuation;
+    ray scattered;
+    real pdf = 0;           // solid angle pdf scattered was drawn with, 0 where that can't be evaluated
+    bool bounced = false;
+};
+
+// Shades the hit of r, shared by every tracer so they all agree.
+// incoming_pdf is the pdf the last hit drew r with (its path_vertex::pdf),
+// 0 for camera rays and after mirrors and glass, whose lights nothing
+// else could have found.
+path_vertex shade_hit(const material& m, const ray& r, const hit_record& rec, real incoming_pdf,
+                      const hittable& world, const light_list& lights) {
+    path_vertex v;
+    v.radiance = color(0, 0, 0);
+    if (m.kind == material_kind::emissive) {
+        v.radiance = emitted(m, rec);
+        // The last hit's shadow ray could have found this light too
+        if (incoming_pdf > 0 && lights.mode != light_sampling::bsdf) {
+            v.radiance *= lights.mode == light_sampling::mis ? power_heuristic(incoming_pdf, lights.pdf(r.origin(), rec)) : 0;
+        }
+        return v;
+    }
+    const bool diffuse = m.kind == material_kind::lambertian;
+    if (diffuse && lights.mode != light_sampling::bsdf && !lights.empty()) {
+        v.radiance = direct_light(m, rec, world, lights);
+    }
+    v.bounced = scatter(m, r, rec, v.attenuation, v.scattered);
+    // Cosine weighted, see scatter_lambertian()
+    if (v.bounced && diffuse) v.pdf = std::fmax(dot(v.scattered.direction(), rec.normal), real(0)) / pi;
+    return v;
+}
+
+// bounce, throughput and incoming_pdf describe the path so far, callers
+// leave them at their defaults. stats, when given, gets the path's length.
+color ray_color(const ray &r, const hittable& world, const material_table& materials, const light_list& lights, int depth,
+                const roulette_settings& roulette = roulette_settings(), path_stats* stats = nullptr,
+                int bounce = 0, color throughput = color(1, 1, 1), real incoming_pdf = 0) {
+    // Information of where our ray hit our object
+    hit_record rec;
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0) {
+        if (stats) stats->record(bounce);
+        return color(0, 0, 0);
+    }
+    RT_COUNT(rays);
+    RT_COUNT_DEPTH(depth);
+    // Go through our worlds object list
+    // and check what we hit
+    // Our hit record is set for our ray r which gives us the point
+    // our ray hit and the normal from that point
+    if (world.hit(r, ray_t_min(r), infinity, rec)) {
+        path_vertex v = shade_hit(materials[rec.material_id], r, rec, incoming_pdf, world, lights);
+        if (v.bounced) {
+            RT_COUNT(scatters);
+            color attenuation = v.attenuation;
+            color next_throughput = throughput * attenuation;
+            if (roulette.enabled() && bounce >= roulette.min_bounces) {
+                real p = roulette.survival(next_throughput);
+                if (sample_1d() >= p) {
+                    if (stats) {
+                        stats->record(bounce + 1);
+                        stats->roulette_ended++;
+                    }
+                    return v.radiance;
+                }
+                // Survivors make up for the paths that ended here
+                attenuation /= p;
+                next_throughput /= p;
+            }
+            // This recursive ray color calculation keeps going until our
+            // ray stops hitting a and object in our world, falling
+            // past our if statement, attenuation is our color which (always)
+            // being less than 1 for x, y, z will slowly decrease our color
+            // on each recursive call acting like shading
+            // Since this is recursive eventually the ray will fall through
+            // not hitting any object leading the color to be decided by
+            // the code below which makes our sky, this is what shades
+            // our world object with sky color UNLESS we exceed our depth 
+            // which leads to getting the black color which could lead to black 
+            // spots this is probably what happens in blender in glass!!
+            return v.radiance + attenuation * ray_color(v.scattered, world, materials, lights, depth - 1, roulette,
+                                                        stats, bounce + 1, next_throughput, v.pdf);
+        }
+        // Happens in metal when normal and scattered direction
+        // are not similar meaning the ray is bouncing inwards?
+        // so make it black? Lights end paths here too, with their
+        // emission.
+        if (stats) stats->record(bounce + 1);
+        return v.radiance;
+    }
+    if (stats) stats->record(bounce + 1);
+    return background(r);
+}
+
+// Packet version of ray_color for one camera sample of an 8x8 block of
+// pixels starting at (x0, y0). Rays bounce together, each pass intersects
+// the whole packet and lanes drop out of the active mask when they
+// escape to the sky or get absorbed. Every lane draws from its own pixel
+// and sample stream, so the result matches the one ray at a time path.
+void trace_packet(int x0, int y0, int sample, int image_width, int image_height, uint64_t seed,
+                  const camera& cam, const hittable& world, const material_table& materials, const light_list& lights,
+                  int max_depth, const roulette_settings& roulette, path_stats& stats, color* block) {
+    const int side = 8;
+    ray_packet packet;
+    hit_packet_record recs;
+    sample_stream lane_streams[ray_packet::size];
+    color throughput[ray_packet::size];
+    real incoming_pdf[ray_packet::size];
+    uint64_t active = 0;
+
+    // Primary rays, lanes past the image edge stay inactive
+    for (int l = 0; l < ray_packet::size; l++) {
+        int i = x0 + l % side, j = y0 + l / side;
+        if (i >= image_width || j >= image_height) continue;
+        seed_pixel_sample(seed, j * image_width + i, sample);
+        double du, dv;
+        sample_2d(du, dv);
+        auto u = real(i + du) / (image_width - 1);
+        auto v = real(j + dv) / (image_height - 1);
+        packet.set(l, cam.get_ray(u, v));
+        lane_streams[l] = thread_sample_stream();
+        throughput[l] = color(1, 1, 1);
+        incoming_pdf[l] = 0;
+        active |= lane_bit(l);
+    }
+
+    for (int depth = max_depth; depth > 0 && active; depth--) {
+        RT_COUNT_N(rays, __builtin_popcountll(active));
+        RT_COUNT_DEPTH_N(depth, __builtin_popcountll(active));
+        recs.reset(infinity);
+        world.hit_packet(packet, active, ray_epsilon, recs);
+
+        // Lanes that missed everything pick up the sky and are done
+        const int bounce = max_depth - depth;
+        for (uint64_t m = active & ~recs.hit; m; m &= m - 1) {
+            int l = first_lane(m);
+            block[l] += throughput[l] * background(packet.get(l));
+            stats.record(bounce + 1);
+        }
+        active &= recs.hit;
+
+        for (uint64_t m = active; m; m &= m - 1) {
+            int l = first_lane(m);
+            // Shade with this lane's own generator
+            std::swap(thread_sample_stream(), lane_streams[l]);
+            path_vertex v = shade_hit(materials[recs.rec[l].material_id], packet.get(l), recs.rec[l], incoming_pdf[l],
+                                      world, lights);
+            block[l] += throughput[l] * v.radiance;
+            bool bounced = v.bounced;
+            bool survived = true;
+            if (bounced) {
+                RT_COUNT(scatters);
+                throughput[l] = throughput[l] * v.attenuation;
+                if (roulette.enabled() && bounce >= roulette.min_bounces) {
+                    real p = roulette.survival(throughput[l]);
+                    survived = sample_1d() < p;
+                    throughput[l] /= p;
+                    if (!survived) stats.roulette_ended++;
+                }
+            }
+            std::swap(thread_sample_stream(), lane_streams[l]);
+            if (bounced && survived) {
+                packet.set(l, v.scattered);
+                incoming_pdf[l] = v.pdf;
+            } else {
+                // Absorbed or out of the roulette, contributes black
+                active &= ~lane_bit(l);
+                stats.record(bounce + 1);
+            }
+        }
+    }
+    // Lanes still active ran out of bounces and gather no light
+    for (uint64_t m = active; m; m &= m - 1) stats.record(max_depth);
+}
+
+// Square block of pixels that is rendered as one task, [x0, x1) by [y0, y1)
+struct tile {
+    int x0, y0, x1, y1;
+};
+
+std::vector<tile> make_tiles(int image_width, int image_height, int tile_size) {
+    std::vector<tile> tiles;
+    for (int y = 0; y < image_height; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            tiles.push_back({x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)});
+        }
+    }
+    return tiles;
+}
+
+#endif
@@ -0,0 +1,551 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "distributed.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "image_writer.h"
+#include "render.h"
+#include "sampler.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Long running render daemon. The scene is loaded and its accelerator
+// built once, then jobs render against them until the process is killed,
+// so an interactive preview pays for neither per image. HTTP/1.1 on
+// 127.0.0.1 only, one request per connection:
+//
+//   POST   /jobs?priority=P    body: camera and image statements in the
+//                              scene file syntax, on top of the served
+//                              scene's settings. Replies {"id": N}.
+//   GET    /jobs               status of every job, JSON
+//   GET    /jobs/N             status of job N
+//   GET    /jobs/N/image       latest snapshot, ?format=ppm|png|pfm
+//   GET    /jobs/N/stream      every snapshot as it comes, as a
+//                              multipart/x-mixed-replace stream of PNGs
+//                              (or ?format=), ends with the final image
+//   DELETE /jobs/N             cancels a queued or running job, forgets
+//                              a finished one
+//
+// e.g.  curl -d 'image width 200 spp 64' 'localhost:8080/jobs?priority=1'
+//       curl localhost:8080/jobs/1/image?format=png > preview.png
+//
+// One scheduler thread renders one job at a time on the whole pool, in
+// progressive passes of 1, 1, 2, 4, ... up to 16 samples per pixel, and
+// publishes a snapshot after every pass. Between passes it hands the
+// pool to a waiting job of higher priority (equal priorities go first
+// come, first served), the paused job picks up where it stopped. Sample
+// s of pixel p is seeded from (seed, p, s) as in the CLI, so a job's
+// final image matches a one shot render up to float summation order.
+
+enum class job_state { queued, rendering, done, cancelled };
+
+inline const char* job_state_name(job_state s) {
+    switch (s) {
+        case job_state::queued:    return "queued";
+        case job_state::rendering: return "rendering";
+        case job_state::done:      return "done";
+        default:                   return "cancelled";
+    }
+}
+
+struct render_job {
+    int id = 0;
+    int priority = 0;
+    scene settings;             // image, sampling and camera, no world
+    std::atomic<bool> cancel{false};
+
+    // Only the scheduler thread touches these
+    framebuffer fb;
+    int samples_done = 0;       // every pixel of fb has this many
+
+    // Guarded by render_server::mutex
+    job_state state = job_state::queued;
+    framebuffer snapshot;       // fb as of the last finished pass
+    int snapshot_samples = 0;
+    uint64_t snapshot_version = 0;
+    double render_seconds = 0;  // spent rendering so far, pauses excluded
+    std::chrono::steady_clock::time_point submitted;
+    double first_snapshot_seconds = -1;   // submission to first snapshot
+
+    bool finished() const { return state == job_state::done || state == job_state::cancelled; }
+};
+
+class render_server {
+    public:
+        // sc gives the default job settings, world and lights are what every
+        // job renders. All of them and pool have to outlive the server.
+        render_server(const scene& sc, const hittable& world, thread_pool& pool, uint64_t seed,
+                      const roulette_settings& roulette)
+            : sc(sc), world(world), pool(pool), seed(seed), roulette(roulette) {
+            scheduler = std::thread(&render_server::schedule, this);
+        }
+
+        ~render_server() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                for (auto& entry : jobs) entry.second->cancel = true;
+            }
+            changed.notify_all();
+            scheduler.join();
+            if (listen_fd >= 0) close(listen_fd);
+        }
+
+        render_server(const render_server&) = delete;
+        render_server& operator=(const render_server&) = delete;
+
+        // Binds 127.0.0.1:port, 0 picks a free port (see bound_port).
+        // False with error set if the port can't be had.
+        bool listen(int port, std::string& error);
+
+        // Accepts connections, each handled on a thread of its own, until
+        // accepting fails. Doesn't return while the server is healthy.
+        void serve();
+
+        // Queues a job with settings on top of the scene's, false with error
+        // set if they don't parse or ask for too much
+        bool submit(const std::string& statements, int priority, int& id, std::string& error);
+
+    public:
+        int bound_port = 0;
+        // Caps on what a job may ask for, at most what a scene file may.
+        // Every job renders through the recursive ray_color, so the depth
+        // cap is what keeps one job from overflowing the stack and taking
+        // the whole daemon down.
+        int max_image_side = scene_max_image_side;
+        int max_samples_per_pixel = scene_max_samples_per_pixel;
+        int max_depth = scene_max_depth;
+        int max_pass_samples = 16;
+
+    private:
+        void schedule();
+        // Renders the job until it finishes, is cancelled or a higher
+        // priority job is waiting. Scheduler thread only.
+        void render(render_job& job);
+        // Queued job to render next, null if none
+        shared_ptr<render_job> next_job() const;
+
+        void handle_connection(int fd);
+        void stream(int fd, shared_ptr<render_job> job, image_format format);
+        std::string status_json(const render_job& job) const;
+
+    private:
+        const scene& sc;
+        const hittable& world;
+        thread_pool& pool;
+        uint64_t seed;
+        roulette_settings roulette;
+        int listen_fd = -1;
+
+        // Guards jobs, next_id, stopping and the guarded fields of every job
+        mutable std::mutex mutex;
+        // Signalled when a job is queued, changes state or has a new snapshot
+        std::condition_variable changed;
+        std::map<int, shared_ptr<render_job>> jobs;
+        int next_id = 1;
+        bool stopping = false;
+        std::thread scheduler;
+};
+
+shared_ptr<render_job> render_server::next_job() const {
+    shared_ptr<render_job> best;
+    for (const auto& entry : jobs) {
+        const shared_ptr<render_job>& job = entry.second;
+        if (job->state != job_state::queued) continue;
+        // Map order is id order, so the oldest wins a tie
+        if (!best || job->priority > best->priority) best = job;
+    }
+    return best;
+}
+
+void render_server::schedule() {
+    while (true) {
+        shared_ptr<render_job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return stopping || next_job(); });
+            if (stopping) return;
+            job = next_job();
+            job->state = job_state::rendering;
+        }
+        changed.notify_all();
+        render(*job);
+    }
+}
+
+void render_server::render(render_job& job) {
+    const scene& js = job.settings;
+    const int image_width = js.image_width;
+    const int image_height = js.image_height();
+    if (job.fb.width == 0) job.fb = framebuffer(image_width, image_height);
+    const camera cam = js.make_camera();
+    const std::vector<tile> tiles = make_tiles(image_width, image_height, 16);
+    // The samplers index pixels with it, nothing else renders meanwhile
+    sampler_image_width = image_width;
+
+    auto start = std::chrono::steady_clock::now();
+    bool preempted = false;
+    while (job.samples_done < js.samples_per_pixel && !job.cancel && !preempted) {
+        // 1, 1, 2, 4, ... so the first snapshot comes quickly
+        const int first = job.samples_done;
+        const int count = std::min({std::max(first, 1), max_pass_samples, js.samples_per_pixel - first});
+        pool.run(static_cast<int>(tiles.size()), [&](int t, int) {
+            // A cancelled job drops the rest of the pass
+            if (job.cancel) return;
+            const tile& tl = tiles[t];
+            for (int j = tl.y0; j < tl.y1; j++) {
+                for (int i = tl.x0; i < tl.x1; i++) {
+                    color pixel_color(0, 0, 0);
+                    for (int s = first; s < first + count; s++) {
+                        seed_pixel_sample(seed, j * image_width + i, s);
+                        double du, dv;
+                        sample_2d(du, dv);
+                        auto u = double(i + du) / (image_width - 1);
+                        auto v = double(j + dv) / (image_height - 1);
+                        pixel_color += ray_color(cam.get_ray(u, v), world, sc.materials, sc.lights, js.max_depth, roulette);
+                    }
+                    job.fb.add(i, j, pixel_color, count);
+                }
+            }
+        });
+        if (job.cancel) break;
+        job.samples_done += count;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        job.snapshot = job.fb;
+        job.snapshot_samples = job.samples_done;
+        job.snapshot_version++;
+        auto now = std::chrono::steady_clock::now();
+        job.render_seconds += std::chrono::duration<double>(now - start).count();
+        start = now;
+        if (job.first_snapshot_seconds < 0) {
+            job.first_snapshot_seconds = std::chrono::duration<double>(now - job.submitted).count();
+        }
+        // Hand the pool over between passes, not in the middle of one
+        shared_ptr<render_job> waiting = next_job();
+        preempted = waiting && waiting->priority > job.priority;
+        changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.render_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (job.cancel) job.state = job_state::cancelled;
+        else if (job.samples_done >= js.samples_per_pixel) job.state = job_state::done;
+        else job.state = job_state::queued;
+        // Nothing reads fb once the job is over, the snapshot has it all
+        if (job.finished()) job.fb = framebuffer();
+    }
+    changed.notify_all();
+}
+
+bool render_server::submit(const std::string& statements, int priority, int& id, std::string& error) {
+    auto job = make_shared<render_job>();
+    job->priority = priority;
+    job->settings.copy_settings(sc);
+    scene_loader loader(job->settings, scene_statements::job);
+    if (!loader.load_string(statements)) {
+        error = loader.error;
+        return false;
+    }
+    const scene& js = job->settings;
+    if (js.image_width > max_image_side || js.image_height() > max_image_side) {
+        error = "image larger than " + std::to_string(max_image_side) + " pixels a side";
+        return false;
+    }
+    if (js.samples_per_pixel > max_samples_per_pixel) {
+        error = "more than " + std::to_string(max_samples_per_pixel) + " samples per pixel";
+        return false;
+    }
+    if (js.max_depth > max_depth) {
+        error = "depth over " + std::to_string(max_depth);
+        return false;
+    }
+    job->submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = job->id = next_id++;
+        jobs[id] = job;
+    }
+    changed.notify_all();
+    return true;
+}
+
+std::string render_server::status_json(const render_job& job) const {
+    const scene& js = job.settings;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+             "{\"id\": %d, \"state\": \"%s\", \"priority\": %d, \"width\": %d, \"height\": %d, \"spp\": %d, "
+             "\"samples_done\": %d, \"render_seconds\": %.3f, \"first_snapshot_seconds\": %.3f}",
+             job.id, job_state_name(job.state), job.priority, js.image_width, js.image_height(), js.samples_per_pixel,
+             job.snapshot_samples, job.render_seconds, job.first_snapshot_seconds);
+    return buffer;
+}
+
+inline bool send_response(int fd, int status, const char* reason, const char* content_type, const void* body, size_t n) {
+    std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nContent-Type: " + content_type +
+                       "\r\nContent-Length: " + std::to_string(n) + "\r\nConnection: close\r\n\r\n";
+    return send_all(fd, head.data(), head.size()) && send_all(fd, body, n);
+}
+
+inline bool send_text(int fd, int status, const char* reason, const std::string& text) {
+    std::string body = text + "\n";
+    const char* type = !text.empty() && (text[0] == '{' || text[0] == '[') ? "application/json" : "text/plain";
+    return send_response(fd, status, reason, type, body.data(), body.size());
+}
+
+// Value of key in a query string like "a=1&b=2", empty if it isn't there
+inline std::string query_value(const std::string& query, const std::string& key) {
+    size_t begin = 0;
+    while (begin <= query.size()) {
+        size_t end = query.find('&', begin);
+        if (end == std::string::npos) end = query.size();
+        std::string pair = query.substr(begin, end - begin);
+        if (pair.compare(0, key.size() + 1, key + "=") == 0) return pair.substr(key.size() + 1);
+        begin = end + 1;
+    }
+    return "";
+}
+
+inline const char* image_content_type(image_format format) {
+    switch (format) {
+        case image_format::png: return "image/png";
+        case image_format::pfm: return "application/octet-stream";
+        default:                return "image/x-portable-pixmap";
+    }
+}
+
+void render_server::stream(int fd, shared_ptr<render_job> job, image_format format) {
+    const char* head = "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=snapshot\r\n"
+                       "Cache-Control: no-cache\r\nConnection: close\r\n\r\n";
+    if (!send_all(fd, head, strlen(head))) return;
+    uint64_t sent_version = 0;
+    while (true) {
+        framebuffer snapshot;
+        int samples;
+        bool last;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return stopping || job->snapshot_version != sent_version || job->finished(); });
+            if (stopping) return;
+            last = job->finished();
+            if (job->snapshot_version == sent_version) {
+                // Finished without a new snapshot, cancelled most likely
+                const char* end = "--snapshot--\r\n";
+                send_all(fd, end, strlen(end));
+                return;
+            }
+            snapshot = job->snapshot;
+            samples = job->snapshot_samples;
+            sent_version = job->snapshot_version;
+        }
+        // Encoded outside the lock, the scheduler needs it between passes
+        std::vector<uint8_t> bytes = encode_image(snapshot, format);
+        std::string part = std::string("--snapshot\r\nContent-Type: ") + image_content_type(format) +
+                           "\r\nContent-Length: " + std::to_string(bytes.size()) +
+                           "\r\nX-Samples-Per-Pixel: " + std::to_string(samples) + "\r\n\r\n";
+        if (!send_all(fd, part.data(), part.size()) || !send_all(fd, bytes.data(), bytes.size()) ||
+            !send_all(fd, "\r\n", 2)) {
+            return;
+        }
+        if (last) {
+            const char* end = "--snapshot--\r\n";
+            send_all(fd, end, strlen(end));
+            return;
+        }
+    }
+}
+
+void render_server::handle_connection(int fd) {
+    // Read the head, then as much body as Content-Length says
+    std::string request;
+    const size_t max_request = 1 << 16;
+    size_t head_end;
+    char buffer[4096];
+    while ((head_end = request.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0 || request.size() + got > max_request) return;
+        request.append(buffer, got);
+    }
+    size_t body_length = 0;
+    {
+        std::string head = request.substr(0, head_end);
+        for (char& c : head) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        size_t at = head.find("\r\ncontent-length:");
+        if (at != std::string::npos) body_length = strtoul(head.c_str() + at + 17, nullptr, 10);
+    }
+    if (body_length > max_request) {
+        send_text(fd, 413, "Payload Too Large", "request body too large");
+        return;
+    }
+    while (request.size() < head_end + 4 + body_length) {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return;
+        request.append(buffer, got);
+    }
+    const std::string body = request.substr(head_end + 4, body_length);
+
+    // Request line: METHOD /path?query HTTP/1.1
+    size_t method_end = request.find(' ');
+    size_t target_end = method_end == std::string::npos ? method_end : request.find(' ', method_end + 1);
+    if (target_end == std::string::npos || target_end > head_end) {
+        send_text(fd, 400, "Bad Request", "bad request line");
+        return;
+    }
+    const std::string method = request.substr(0, method_end);
+    std::string path = request.substr(method_end + 1, target_end - method_end - 1);
+    std::string query;
+    size_t question = path.find('?');
+    if (question != std::string::npos) {
+        query = path.substr(question + 1);
+        path.resize(question);
+    }
+
+    if (path == "/jobs" && method == "POST") {
+        int id;
+        std::string error;
+        std::string priority = query_value(query, "priority");
+        if (!submit(body, priority.empty() ? 0 : atoi(priority.c_str()), id, error)) {
+            send_text(fd, 400, "Bad Request", error);
+            return;
+        }
+        send_text(fd, 201, "Created", "{\"id\": " + std::to_string(id) + "}");
+        return;
+    }
+    if (path == "/jobs" && method == "GET") {
+        std::string list = "[";
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : jobs) list += (list.size() > 1 ? ",\n " : "") + status_json(*entry.second);
+        send_text(fd, 200, "OK", list + "]");
+        return;
+    }
+
+    // Everything else is /jobs/N[/image|/stream]
+    int id = 0;
+    char rest[32] = "";
+    if (sscanf(path.c_str(), "/jobs/%d%31s", &id, rest) < 1) {
+        send_text(fd, 404, "Not Found", "no such resource");
+        return;
+    }
+    shared_ptr<render_job> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = jobs.find(id);
+        if (it != jobs.end()) job = it->second;
+    }
+    if (!job) {
+        send_text(fd, 404, "Not Found", "no such job");
+        return;
+    }
+    image_format format = image_format::ppm;
+    std::string format_name = query_value(query, "format");
+    if (!format_name.empty() && !image_format_from_name(format_name, format)) {
+        send_text(fd, 400, "Bad Request", "unknown format " + format_name);
+        return;
+    }
+
+    if (!strcmp(rest, "") && method == "GET") {
+        std::lock_guard<std::mutex> lock(mutex);
+        send_text(fd, 200, "OK", status_json(*job));
+    } else if (!strcmp(rest, "") && method == "DELETE") {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (job->finished()) {
+            jobs.erase(id);
+            lock.unlock();
+            send_text(fd, 200, "OK", "forgot job " + std::to_string(id));
+            return;
+        }
+        job->cancel = true;
+        // A queued job never gets to the scheduler, a running one is
+        // marked cancelled once its current pass stops
+        if (job->state == job_state::queued) job->state = job_state::cancelled;
+        lock.unlock();
+        changed.notify_all();
+        send_text(fd, 200, "OK", "cancelled job " + std::to_string(id));
+    } else if (!strcmp(rest, "/image") && method == "GET") {
+        framebuffer snapshot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshot = job->snapshot;
+        }
+        if (snapshot.width == 0) {
+            send_text(fd, 409, "Conflict", "no snapshot yet");
+            return;
+        }
+        std::vector<uint8_t> bytes = encode_image(snapshot, format);
+        send_response(fd, 200, "OK", image_content_type(format), bytes.data(), bytes.size());
+    } else if (!strcmp(rest, "/stream") && method == "GET") {
+        stream(fd, job, format_name.empty() ? image_format::png : format);
+    } else {
+        send_text(fd, 404, "Not Found", "no such resource");
+    }
+}
+
+bool render_server::listen(int port, std::string& error) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // Loopback only, there is no authentication
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    socklen_t length = sizeof(address);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listen_fd, 64) != 0 ||
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        error = strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    bound_port = ntohs(address.sin_port);
+    return true;
+}
+
+void render_server::serve() {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        // Streams block for as long as a job renders, so every connection
+        // gets a thread, they spend nearly all their time waiting
+        std::thread([this, fd] {
+            handle_connection(fd);
+            close(fd);
+        }).detach();
+    }
+}
+
+#endif
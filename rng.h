@@ -0,0 +1,144 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// Small, fast generators for the render hot path. Each one has the
+// same interface (seed, next_u32, next_double) so the one used by
+// random_double() can be swapped at build time:
+//   -DRT_RNG_XOSHIRO   xoshiro256++
+//   (default)          PCG32
+
+// SplitMix64 step, used to turn (seed, pixel, sample) keys into well
+// mixed generator states so neighbouring keys don't give correlated streams
+inline uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t hash_key(uint64_t a, uint64_t b) {
+    uint64_t x = a ^ (b * 0xd1342543de82ef95ull);
+    return splitmix64(x);
+}
+
+// 53 random bits into a double in [0,1)
+inline double bits_to_double(uint64_t bits) {
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// PCG-XSH-RR 64/32 (O'Neill), 16 bytes of state, selectable stream
+class pcg32 {
+    public:
+        pcg32() { seed(0, 0); }
+
+        void seed(uint64_t init_state, uint64_t stream) {
+            state = 0;
+            inc = (stream << 1) | 1u;
+            next_u32();
+            state += init_state;
+            next_u32();
+        }
+
+        uint32_t next_u32() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ull + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            uint32_t rot = static_cast<uint32_t>(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        double next_double() {
+            // Two outputs so doubles keep their full 53 bits of precision
+            uint64_t hi = next_u32();
+            return bits_to_double((hi << 32) | next_u32());
+        }
+
+    public:
+        uint64_t state;
+        uint64_t inc;
+};
+
+// xoshiro256++ (Blackman & Vigna), 32 bytes of state, one output per double
+class xoshiro256pp {
+    public:
+        xoshiro256pp() { seed(0, 0); }
+
+        void seed(uint64_t init_state, uint64_t stream) {
+            uint64_t x = hash_key(init_state, stream);
+            for (int i = 0; i < 4; i++) s[i] = splitmix64(x);
+        }
+
+        uint64_t next_u64() {
+            uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+            uint64_t t = s[1] << 17;
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+            return result;
+        }
+
+        uint32_t next_u32() { return static_cast<uint32_t>(next_u64() >> 32); }
+
+        double next_double() { return bits_to_double(next_u64()); }
+
+    public:
+        uint64_t s[4];
+
+    private:
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+};
+
+#ifdef RT_RNG_XOSHIRO
+using rng = xoshiro256pp;
+#else
+using rng = pcg32;
+#endif
+
+// Random state of one camera sample: the generator, plus where the
+// sample is and how many of its dimensions the sampler (sampler.h) has
+// handed out. Tracers that interleave paths swap whole streams in and out.
+struct sample_stream {
+    rng generator;
+    uint64_t seed = 0;
+    uint64_t pixel = 0;
+    uint64_t key = 0;           // hash of seed and pixel
+    uint32_t sample = 0;
+    uint32_t dimension = 0;
+};
+
+inline sample_stream& thread_sample_stream() {
+    // Every thread gets its own generator so rendering threads
+    // never share (or fight over) random state
+    static thread_local sample_stream stream;
+    return stream;
+}
+
+inline rng& thread_rng() {
+    return thread_sample_stream().generator;
+}
+
+inline void seed_random(uint64_t seed, uint64_t stream) {
+    thread_rng().seed(hash_key(seed, stream), stream);
+}
+
+// Every camera sample of every pixel draws from its own stream, so a pixel
+// comes out the same no matter which thread, tile or pass renders it
+inline void seed_pixel_sample(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    sample_stream& stream = thread_sample_stream();
+    uint64_t key = hash_key(seed, pixel);
+    stream.generator.seed(hash_key(key, sample), pixel);
+    stream.seed = seed;
+    stream.pixel = pixel;
+    stream.key = key;
+    stream.sample = static_cast<uint32_t>(sample);
+    stream.dimension = 0;
+}
+
+#endif
@@ -6,14 +6,25 @@
 #include <memory>
 #include <cstdlib>
 
+#include "profile.h"
+#include "rng.h"
+
 
 // Usings
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Scalar type of all the geometry (vectors, rays, hits, cameras), double
+// unless built with -DRT_FLOAT to trace in single precision
+#ifdef RT_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
+const real infinity = std::numeric_limits<real>::infinity();
 const double pi = 3.1415926535897932385;
 
 // Utility Functions
@@ -22,8 +33,8 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1) from this thread's generator.
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -40,5 +51,7 @@ inline double clamp(double x, double min, double max) {
 // Common Headers
 #include "ray.h"
 #include "vec3.h"
+#include "sampling.h"
+#include "sampler.h"
 
 #endif
\ No newline at end of file
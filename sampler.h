@@ -0,0 +1,309 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where the random numbers of a camera sample come from. Every number a
+// path draws (pixel jitter, lens position, bounce directions, glass
+// reflect or refract, roulette) is the next dimension of its sample,
+// handed out in order by sample_1d() and sample_2d():
+//
+//   independent   uniform numbers from the sample's own generator, the
+//                 renderer as it always was
+//   sobol         Sobol points, every pair of dimensions with its own
+//                 Owen scrambling and per pixel shuffle of the sample
+//                 index (Burley, Practical Hash-based Owen Scrambling)
+//   halton        Halton points, a prime base per dimension, shifted
+//                 per pixel (Cranley-Patterson rotation)
+//   blue_noise    golden ratio and R2 sequences over the samples, shifted
+//                 per pixel by a blue noise tile, so what error is left
+//                 at low spp is fine grained instead of clumpy
+//
+// The low discrepancy samplers spread the first few spp of a pixel over
+// the square evenly instead of by chance, which is where they win. Set
+// the mode before rendering, like the profiler switches.
+enum class sampler_kind { independent, sobol, halton, blue_noise };
+
+inline sampler_kind sampler_mode = sampler_kind::independent;
+// Blue noise looks pixels up by their coordinates, streams only have an index
+inline int sampler_image_width = 1;
+
+inline bool sampler_from_name(const std::string& name, sampler_kind& kind) {
+    if (name == "independent") kind = sampler_kind::independent;
+    else if (name == "sobol") kind = sampler_kind::sobol;
+    else if (name == "halton") kind = sampler_kind::halton;
+    else if (name == "blue_noise") kind = sampler_kind::blue_noise;
+    else return false;
+    return true;
+}
+
+inline uint32_t reverse_bits32(uint32_t x) {
+    x = __builtin_bswap32(x);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling as a hash (Laine and Karras, Burley's constants) on a
+// bit reversed value: every bit gets flipped or not depending on the seed
+// and the bits below it only, which are the bits above it once reversed
+// back. A scrambled (0,m,2) net stays one.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits32(laine_karras_permutation(reverse_bits32(x), seed));
+}
+
+// Second Sobol dimension with its bits reversed, the first one reversed
+// is just the index. Reversed is what the scrambling wants anyway. Its
+// generator matrix is Pascal's triangle mod 2, so bit i of the result
+// is the xor of every index bit k whose bits contain i's: a superset
+// xor done five bits at a time with no branches for the random index
+// bits to mispredict.
+inline uint32_t sobol_second_reversed(uint32_t index) {
+    index ^= (index >> 1) & 0x55555555u;
+    index ^= (index >> 2) & 0x33333333u;
+    index ^= (index >> 4) & 0x0f0f0f0fu;
+    index ^= (index >> 8) & 0x00ff00ffu;
+    index ^= index >> 16;
+    return index;
+}
+
+// Decorrelates one 32 bit seed into another (lowbias32)
+inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline double u32_to_unit(uint32_t x) {
+    return x * (1.0 / 4294967296.0);
+}
+
+const int halton_dimensions = 32;
+const uint32_t halton_primes[halton_dimensions] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+    59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+
+inline double radical_inverse(uint32_t base, uint32_t index) {
+    if (base == 2) return u32_to_unit(reverse_bits32(index));
+    const double inv_base = 1.0 / base;
+    double scale = inv_base, result = 0;
+    while (index) {
+        result += (index % base) * scale;
+        index /= base;
+        scale *= inv_base;
+    }
+    return result;
+}
+
+// Wraps x + shift back into [0,1), both already in [0,1)
+inline double toroidal_shift(double x, double shift) {
+    double v = x + shift;
+    return v < 1 ? v : v - 1;
+}
+
+// Fractional part of a non negative x, without a call to floor
+inline double fractional(double x) {
+    return x - static_cast<double>(static_cast<uint64_t>(x));
+}
+
+const int blue_noise_size = 64;
+
+// Void and cluster (Ulichney 1993) on a wrapping tile: spread a few
+// points evenly, rank them by taking the tightest clusters away, then
+// rank the rest by filling the largest voids. Each texel's rank over the
+// texel count is a value in [0,1) whose neighbours are as different from
+// it as they can be.
+std::vector<float> make_blue_noise_tile(int size) {
+    const int n = size * size;
+    // Gaussian energy a point adds to every texel, wrapping around
+    const double sigma = 1.5;
+    std::vector<double> kernel(n);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int dx = std::min(x, size - x), dy = std::min(y, size - y);
+            kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+        }
+    }
+    std::vector<uint8_t> on(n, 0);
+    std::vector<double> energy(n, 0.0);
+    auto toggle = [&](int p, bool set) {
+        on[p] = set;
+        const int px = p % size, py = p / size;
+        const double sign = set ? 1.0 : -1.0;
+        for (int y = 0; y < size; y++) {
+            const double* row = &kernel[((y - py + size) % size) * size];
+            for (int x = 0; x < size; x++) energy[y * size + x] += sign * row[(x - px + size) % size];
+        }
+    };
+    // Highest energy point and lowest energy gap, callers make sure there is one
+    auto tightest_cluster = [&]() {
+        int best = static_cast<int>(std::find(on.begin(), on.end(), 1) - on.begin());
+        for (int p = best + 1; p < n; p++) if (on[p] && energy[p] > energy[best]) best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = static_cast<int>(std::find(on.begin(), on.end(), 0) - on.begin());
+        for (int p = best + 1; p < n; p++) if (!on[p] && energy[p] < energy[best]) best = p;
+        return best;
+    };
+
+    // Its own generator, the tile is the same whatever the render seed
+    pcg32 generator;
+    generator.seed(0xb1e5eed, 1);
+    const int initial = n / 10;
+    for (int placed = 0; placed < initial;) {
+        int p = static_cast<int>(generator.next_u32() % n);
+        if (!on[p]) {
+            toggle(p, true);
+            placed++;
+        }
+    }
+    // Move the tightest point into the largest void until that changes nothing
+    while (true) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        int hole = largest_void();
+        toggle(hole, true);
+        if (hole == cluster) break;
+    }
+
+    std::vector<int> rank(n);
+    std::vector<uint8_t> prototype = on;
+    std::vector<double> prototype_energy = energy;
+    for (int r = initial - 1; r >= 0; r--) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+    on = prototype;
+    energy = prototype_energy;
+    for (int r = initial; r < n; r++) {
+        int hole = largest_void();
+        toggle(hole, true);
+        rank[hole] = r;
+    }
+
+    std::vector<float> tile(n);
+    for (int p = 0; p < n; p++) tile[p] = (rank[p] + 0.5f) / n;
+    return tile;
+}
+
+// Built on first use, a few tens of milliseconds
+inline const std::vector<float>& blue_noise_tile() {
+    static const std::vector<float> tile = make_blue_noise_tile(blue_noise_size);
+    return tile;
+}
+
+// Blue noise value of pixel (x, y), with the tile moved by a different
+// offset for every dimension so dimensions don't correlate
+inline double blue_noise_shift(const sample_stream& s, int x, int y, uint32_t d) {
+    uint64_t key = hash_key(s.seed, d);
+    const int mask = blue_noise_size - 1;
+    x += static_cast<int>(key & mask);
+    y += static_cast<int>((key >> 8) & mask);
+    return blue_noise_tile()[(y & mask) * blue_noise_size + (x & mask)];
+}
+
+// Next dimension of the thread's current sample
+inline double sample_1d() {
+    sample_stream& s = thread_sample_stream();
+    if (sampler_mode == sampler_kind::independent) return s.generator.next_double();
+    const uint32_t d = s.dimension++;
+    const uint64_t key = hash_key(s.key, d);
+    switch (sampler_mode) {
+        case sampler_kind::sobol: {
+            // Van der Corput of the shuffled index, scrambled
+            uint32_t index = nested_uniform_scramble(s.sample, static_cast<uint32_t>(key));
+            return u32_to_unit(reverse_bits32(laine_karras_permutation(index, static_cast<uint32_t>(key >> 32))));
+        }
+        case sampler_kind::halton:
+            // Past the table the bases get large enough to correlate, go random
+            if (d >= static_cast<uint32_t>(halton_dimensions)) return s.generator.next_double();
+            return toroidal_shift(radical_inverse(halton_primes[d], s.sample), bits_to_double(key));
+        default: {
+            const uint32_t pixel = static_cast<uint32_t>(s.pixel), width = sampler_image_width;
+            return toroidal_shift(fractional(s.sample * 0.6180339887498949),
+                                  blue_noise_shift(s, pixel % width, pixel / width, d));
+        }
+    }
+}
+
+// Next two dimensions, as a well spread point of the unit square
+inline void sample_2d(double& x, double& y) {
+    sample_stream& s = thread_sample_stream();
+    if (sampler_mode == sampler_kind::independent) {
+        x = s.generator.next_double();
+        y = s.generator.next_double();
+        return;
+    }
+    if (sampler_mode == sampler_kind::halton) {
+        x = sample_1d();
+        y = sample_1d();
+        return;
+    }
+    const uint32_t d = s.dimension;
+    s.dimension += 2;
+    if (sampler_mode == sampler_kind::sobol) {
+        // Both coordinates from the same shuffled index keep the pair a (0,2) sequence
+        const uint64_t key = hash_key(s.key, d);
+        const uint32_t scramble = static_cast<uint32_t>(key >> 32);
+        uint32_t index = nested_uniform_scramble(s.sample, static_cast<uint32_t>(key));
+        x = u32_to_unit(reverse_bits32(laine_karras_permutation(index, scramble)));
+        y = u32_to_unit(reverse_bits32(laine_karras_permutation(sobol_second_reversed(index), hash32(scramble))));
+        return;
+    }
+    // R2, the two dimensional golden ratio sequence (Roberts)
+    const uint32_t pixel = static_cast<uint32_t>(s.pixel), width = sampler_image_width;
+    const int px = pixel % width, py = pixel / width;
+    x = toroidal_shift(fractional(s.sample * 0.7548776662466927), blue_noise_shift(s, px, py, d));
+    y = toroidal_shift(fractional(s.sample * 0.5698402909980532), blue_noise_shift(s, px, py, d + 1));
+}
+
+// The shapes paths sample, the current sample's next dimensions through
+// the closed form maps in sampling.h
+
+inline vec3 sample_in_unit_disk() {
+    double x, y;
+    sample_2d(x, y);
+    return square_to_disk(x, y);
+}
+
+inline vec3 sample_unit_vector() {
+    double x, y;
+    sample_2d(x, y);
+    return square_to_sphere(x, y);
+}
+
+inline vec3 sample_in_unit_sphere() {
+    double x, y;
+    sample_2d(x, y);
+    return square_to_ball(x, y, sample_1d());
+}
+
+// Cosine weighted around the unit normal n, unit length
+inline vec3 sample_cosine_direction(const vec3& n) {
+    double x, y;
+    sample_2d(x, y);
+    return cosine_direction(n, x, y);
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "rtweekend.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Closed form maps from the unit square to the shapes paths sample, and
+// the small math kernels scattering runs on every bounce. Every map takes
+// its uniform numbers as arguments and uses each one exactly once, with
+// no rejection loop: no draws get thrown away, there's no loop branch
+// to mispredict, and a well spread point set (sampler.h) stays well
+// spread after mapping.
+
+// sin and cos of t for |t| <= pi/4. Taylor polynomials to t^11 and t^12
+// are within 1e-11 of the library's over that range and cost a few
+// multiplies instead of a call with range reduction.
+inline void sincos_quarter(double t, double& s, double& c) {
+    const double t2 = t * t;
+    s = t * (1 + t2 * (-1.0 / 6 + t2 * (1.0 / 120 + t2 * (-1.0 / 5040 + t2 * (1.0 / 362880 + t2 * (-1.0 / 39916800))))));
+    c = 1 + t2 * (-1.0 / 2 + t2 * (1.0 / 24 + t2 * (-1.0 / 720 + t2 * (1.0 / 40320 + t2 * (-1.0 / 3628800 + t2 * (1.0 / 479001600))))));
+}
+
+// Cube root of w in [0,1] without a division or the library's call:
+// Newton's method for 1/cbrt(w), z' = z (4 - w z^3) / 3, from the float
+// bit trick's 1% guess. Four steps get to double precision.
+inline double cbrt_unit(double w) {
+    if (w <= 0) return 0;
+    const float wf = static_cast<float>(w);
+    uint32_t bits;
+    std::memcpy(&bits, &wf, sizeof(bits));
+    bits = 0x54a2fa8cu - bits / 3;
+    float guess;
+    std::memcpy(&guess, &bits, sizeof(guess));
+    double z = guess;
+    for (int step = 0; step < 4; step++) z = z * (4 - w * z * z * z) * (1.0 / 3);
+    return w * z * z;
+}
+
+// (1 - cosine)^5, the angle term of Schlick's approximation, as
+// multiplies instead of pow
+inline real schlick_weight(real cosine) {
+    const real m = 1 - cosine;
+    const real m2 = m * m;
+    return m2 * m2 * m;
+}
+
+// Concentric map (Shirley and Chiu) from the unit square to the unit
+// disk: squares around the center go to rings, so areas and neighbours
+// are kept. The octant picks which coordinate is the radius, both sides
+// are computed and selected so there's no branch on the random values.
+inline vec3 square_to_disk(double u, double v) {
+    const double a = 2 * u - 1, b = 2 * v - 1;
+    const bool wide = std::fabs(a) > std::fabs(b);
+    const double r = wide ? a : b;
+    const double other = wide ? b : a;
+    // |other| <= |r|, both are 0 at the center
+    const double t = (pi / 4) * (other / (r == 0 ? 1.0 : r));
+    double s, c;
+    sincos_quarter(t, s, c);
+    const double x = wide ? c : s, y = wide ? s : c;
+    return vec3(r * x, r * y, 0);
+}
+
+// Uniform on the unit sphere: the disk point lifted by Lambert's equal
+// area map, z = 1 - 2r^2 and the radius scaled by 2 sqrt(1 - r^2), so
+// no trigonometry past the disk's
+inline vec3 square_to_sphere(double u, double v) {
+    const vec3 d = square_to_disk(u, v);
+    const double r2 = d.x() * d.x() + d.y() * d.y();
+    const double scale = 2 * std::sqrt(std::fmax(0.0, 1 - r2));
+    return vec3(d.x() * scale, d.y() * scale, 1 - 2 * r2);
+}
+
+// Uniform in the unit ball, a sphere point at radius cbrt(w) since the
+// volume inside radius r grows as r^3
+inline vec3 square_to_ball(double u, double v, double w) {
+    return cbrt_unit(w) * square_to_sphere(u, v);
+}
+
+// Cosine weighted hemisphere around +z (Malley): the disk point lifted
+// straight up onto the hemisphere
+inline vec3 square_to_cosine_hemisphere(double u, double v) {
+    const vec3 d = square_to_disk(u, v);
+    return vec3(d.x(), d.y(), std::sqrt(std::fmax(0.0, 1 - d.x() * d.x() - d.y() * d.y())));
+}
+
+// Two unit vectors that make an orthonormal frame with the unit vector
+// n, Duff et al.'s branchless construction
+inline void orthonormal_basis(const vec3& n, vec3& tangent, vec3& bitangent) {
+    const real sign = std::copysign(real(1), n.z());
+    const real a = -1 / (sign + n.z());
+    const real b = n.x() * n.y() * a;
+    tangent = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+    bitangent = vec3(b, sign + n.y() * n.y() * a, -n.y());
+}
+
+// Cosine weighted direction around the unit vector n, the same
+// distribution as n + a random unit vector but already unit length and
+// never degenerate
+inline vec3 cosine_direction(const vec3& n, double u, double v) {
+    const vec3 l = square_to_cosine_hemisphere(u, v);
+    vec3 tangent, bitangent;
+    orthonormal_basis(n, tangent, bitangent);
+    return l.x() * tangent + l.y() * bitangent + l.z() * n;
+}
+
+// Uniform over the directions within a cone around +z, given as
+// 1 - cos of its half angle. cos theta is uniform in [1 - k, 1] like the
+// disk's r^2 is in [0, 1], and sin theta / r works out to
+// sqrt(k (2 - r^2 k)), so there's no division and no trigonometry.
+inline vec3 square_to_cone(double u, double v, double one_minus_cos_max) {
+    const vec3 d = square_to_disk(u, v);
+    const double r2 = d.x() * d.x() + d.y() * d.y();
+    const double k = one_minus_cos_max;
+    const double scale = std::sqrt(std::fmax(0.0, k * (2 - r2 * k)));
+    return vec3(d.x() * scale, d.y() * scale, 1 - r2 * k);
+}
+
+// The book's random shapes, drawn from the thread's generator through
+// the maps above
+
+inline vec3 random_in_unit_disk() {
+    const double u = random_double();
+    return square_to_disk(u, random_double());
+}
+
+inline vec3 random_unit_vector() {
+    const double u = random_double();
+    return square_to_sphere(u, random_double());
+}
+
+inline vec3 random_in_unit_sphere() {
+    const double u = random_double();
+    const double v = random_double();
+    return square_to_ball(u, v, random_double());
+}
+
+inline vec3 random_in_hemisphere(const vec3& normal) {
+    vec3 in_unit_sphere = random_in_unit_sphere();
+    if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
+        return in_unit_sphere;
+    else
+        return -in_unit_sphere;
+}
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <unordered_map>
+#include <vector>
+
+// Largest image and sampling a scene file may ask for
+const int scene_max_image_side = 16384;
+const int scene_max_samples_per_pixel = 1 << 20;
+const int scene_max_depth = 1024;
+
+// The camera keys of one frame of a camera path
+struct camera_frame {
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup;
+    double vfov;
+    double aperture;
+    double focus_dist;
+};
+
+// Everything needed to render an image: output size and sampling, the
+// camera, the materials, the objects and the lights among them. Objects live in the scene's
+// arena, the shared_ptrs in world share the arena's reference count
+// (aliasing constructor) so there is no allocation per object.
+struct scene {
+    int image_width = 400;
+    double aspect_ratio = 16.0 / 9.0;
+    int samples_per_pixel = 100;
+    int max_depth = 50;
+
+    point3 lookfrom = point3(0, 0, 0);
+    point3 lookat = point3(0, 0, -1);
+    vec3 vup = vec3(0, 1, 0);
+    double vfov = 90;
+    double aperture = 0;
+    double focus_dist = 0;      // 0 focuses on lookat
+
+    material_table materials;
+    hittable_list world;
+    light_list lights;          // the spheres of world with emissive materials
+    shared_ptr<arena> storage = make_shared<arena>();
+
+    // Camera path for an animation, one entry per frame, empty for a still
+    std::vector<camera_frame> frames;
+
+    int image_height() const { return static_cast<int>(image_width / aspect_ratio); }
+
+    camera make_camera() const {
+        return make_camera(camera_frame{lookfrom, lookat, vup, vfov, aperture, focus_dist});
+    }
+
+    camera make_camera(const camera_frame& f) const {
+        double focus = f.focus_dist > 0 ? f.focus_dist : (f.lookfrom - f.lookat).length();
+        return camera(f.lookfrom, f.lookat, f.vup, f.vfov, aspect_ratio, f.aperture, focus);
+    }
+
+    template <typename T, typename... Args>
+    void add(Args&&... args) {
+        T* object = storage->make<T>(std::forward<Args>(args)...);
+        world.add(shared_ptr<hittable>(storage, object));
+    }
+
+    // Everything but the world and its lights: image, sampling and camera
+    void copy_settings(const scene& o) {
+        image_width = o.image_width;
+        aspect_ratio = o.aspect_ratio;
+        samples_per_pixel = o.samples_per_pixel;
+        max_depth = o.max_depth;
+        lookfrom = o.lookfrom;
+        lookat = o.lookat;
+        vup = o.vup;
+        vfov = o.vfov;
+        aperture = o.aperture;
+        focus_dist = o.focus_dist;
+    }
+
+    // Adds a sphere, and a light for it if its material is emissive.
+    // Generators call lights.sort() once they are done.
+    void add_sphere(const point3& center, real radius, uint32_t material_id) {
+        // Lights sharing an emissive material get copies of it, a light
+        // is found from the material of its hit
+        if (materials[material_id].kind == material_kind::emissive && lights.uses_material(material_id)) {
+            material_id = materials.add(materials[material_id]);
+        }
+        add<sphere>(center, radius, material_id);
+        lights.add(center, radius, material_id, materials);
+    }
+};
+
+// Scene files are plain text, one statement per line, # starts a comment:
+//
+//   image width 400 aspect 16/9 spp 100 depth 50
+//   camera lookfrom 3 3 2 lookat 0 0 -1 vup 0 1 0 vfov 20 aperture 2.0 focus 3.4
+//   material glass dielectric 1.5
+//   material ground lambertian 0.8 0.8 0.0
+//   material gold metal 0.8 0.6 0.2 0.0
+//   material lamp emissive 30 30 30
+//   sphere 0 -100.5 -1 100 ground
+//
+// image and camera take any subset of their keys. Materials have to be
+// declared before the spheres that use them. Spheres with an emissive
+// material become lights the renderer can sample directly. The file is read in large
+// chunks and parsed line by line as it streams in, nothing is held
+// besides the scene itself.
+//
+// A camera path is a file of camera and frame statements, loaded on top
+// of a scene. frame takes the camera keys too and adds a frame with the
+// camera as it is after them, keys it doesn't give carry over:
+//
+//   camera vfov 20 aperture 0.1
+//   frame lookfrom 13 2 3 lookat 0 0 0
+//   frame lookfrom 12.9 2 3.4
+//
+// A render server job is camera and image statements applied to a copy
+// of the served scene's settings, the world stays the server's:
+//
+//   image width 200 spp 16
+//   camera lookfrom 3 3 2 vfov 30
+
+// Statements a file may contain
+enum class scene_statements { scene, camera_path, job };
+
+class scene_loader {
+    public:
+        explicit scene_loader(scene& sc, scene_statements allowed = scene_statements::scene): sc(sc), allowed(allowed) {}
+
+        bool load_file(const std::string& path);
+        bool load_string(const std::string& text);
+
+        // What went wrong, with the line number, after a failed load
+        std::string error;
+
+    private:
+        // Cursor over one null terminated line
+        struct tokens {
+            char* p;
+
+            bool word(const char*& begin, size_t& length) {
+                while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+                if (!*p) return false;
+                begin = p;
+                while (*p && *p != ' ' && *p != '\t' && *p != '\r') p++;
+                length = p - begin;
+                return true;
+            }
+
+            bool number(double& v) {
+                char* end;
+                v = strtod(p, &end);
+                if (end == p) return false;
+                p = end;
+                // a/b for aspect ratios like 16/9
+                if (*p == '/') {
+                    double d = strtod(p + 1, &end);
+                    if (end == p + 1 || d == 0) return false;
+                    v /= d;
+                    p = end;
+                }
+                return true;
+            }
+
+            bool vector(vec3& v) {
+                double x, y, z;
+                if (!number(x) || !number(y) || !number(z)) return false;
+                v = vec3(x, y, z);
+                return true;
+            }
+        };
+
+        bool parse_line(char* line);
+        bool parse_image(tokens& t);
+        bool parse_camera(tokens& t);
+        bool parse_frame(tokens& t);
+        bool parse_material(tokens& t);
+        bool parse_sphere(tokens& t);
+        bool fail(const std::string& message);
+
+        // Splits buffer[0, size) into lines and parses the complete ones.
+        // Returns how many bytes were consumed, the rest is a partial line.
+        bool parse_lines(char* buffer, size_t size, bool last, size_t& consumed);
+
+    private:
+        scene& sc;
+        scene_statements allowed;
+        long line_number = 0;
+        std::unordered_map<std::string, uint32_t> material_ids;
+        // Spheres mostly come in runs with the same material
+        std::string last_material;
+        uint32_t last_material_id = 0;
+};
+
+static bool word_is(const char* begin, size_t length, const char* w) {
+    return length == strlen(w) && !memcmp(begin, w, length);
+}
+
+bool scene_loader::fail(const std::string& message) {
+    error = "line " + std::to_string(line_number) + ": " + message;
+    return false;
+}
+
+bool scene_loader::parse_image(tokens& t) {
+    const char* key;
+    size_t n;
+    while (t.word(key, n)) {
+        double v;
+        if (!t.number(v)) return fail("image: missing value");
+        // Ranges are checked before the casts, the negated tests catch NaN
+        if (word_is(key, n, "width")) {
+            if (!(v >= 2 && v <= scene_max_image_side)) return fail("image: width out of range");
+            sc.image_width = static_cast<int>(v);
+        } else if (word_is(key, n, "aspect")) {
+            if (!(v > 0 && v < infinity)) return fail("image: aspect out of range");
+            sc.aspect_ratio = v;
+        } else if (word_is(key, n, "spp")) {
+            if (!(v >= 1 && v <= scene_max_samples_per_pixel)) return fail("image: spp out of range");
+            sc.samples_per_pixel = static_cast<int>(v);
+        } else if (word_is(key, n, "depth")) {
+            // ray_color recurses once per bounce, deep paths overflow the stack
+            if (!(v >= 1 && v <= scene_max_depth)) return fail("image: depth out of range");
+            sc.max_depth = static_cast<int>(v);
+        } else {
+            return fail("image: unknown key " + std::string(key, n));
+        }
+    }
+    // The height comes from width and aspect, which may be given apart
+    double height = sc.image_width / sc.aspect_ratio;
+    if (!(height >= 2 && height < scene_max_image_side + 1)) return fail("image: height out of range");
+    return true;
+}
+
+bool scene_loader::parse_camera(tokens& t) {
+    const char* key;
+    size_t n;
+    while (t.word(key, n)) {
+        bool ok;
+        if (word_is(key, n, "lookfrom")) ok = t.vector(sc.lookfrom);
+        else if (word_is(key, n, "lookat")) ok = t.vector(sc.lookat);
+        else if (word_is(key, n, "vup")) ok = t.vector(sc.vup);
+        else if (word_is(key, n, "vfov")) ok = t.number(sc.vfov);
+        else if (word_is(key, n, "aperture")) ok = t.number(sc.aperture);
+        else if (word_is(key, n, "focus")) ok = t.number(sc.focus_dist);
+        else return fail("camera: unknown key " + std::string(key, n));
+        if (!ok) return fail("camera: bad value for " + std::string(key, n));
+    }
+    return true;
+}
+
+bool scene_loader::parse_frame(tokens& t) {
+    if (!parse_camera(t)) return false;
+    sc.frames.push_back({sc.lookfrom, sc.lookat, sc.vup, sc.vfov, sc.aperture, sc.focus_dist});
+    return true;
+}
+
+bool scene_loader::parse_material(tokens& t) {
+    const char* name;
+    const char* kind;
+    size_t name_length, kind_length;
+    if (!t.word(name, name_length) || !t.word(kind, kind_length)) return fail("material: expected name and kind");
+
+    material m;
+    vec3 albedo;
+    double v;
+    if (word_is(kind, kind_length, "lambertian")) {
+        if (!t.vector(albedo)) return fail("lambertian: expected r g b");
+        m = lambertian(albedo);
+    } else if (word_is(kind, kind_length, "metal")) {
+        if (!t.vector(albedo) || !t.number(v)) return fail("metal: expected r g b fuzz");
+        m = metal(albedo, v);
+    } else if (word_is(kind, kind_length, "dielectric")) {
+        if (!t.number(v)) return fail("dielectric: expected index of refraction");
+        m = dielectric(v);
+    } else if (word_is(kind, kind_length, "emissive")) {
+        if (!t.vector(albedo)) return fail("emissive: expected r g b");
+        m = emissive(albedo);
+    } else {
+        return fail("material: unknown kind " + std::string(kind, kind_length));
+    }
+    // Redefining a name points it at the new material from here on
+    material_ids[std::string(name, name_length)] = sc.materials.add(m);
+    last_material.clear();
+    return true;
+}
+
+bool scene_loader::parse_sphere(tokens& t) {
+    vec3 center;
+    double radius;
+    const char* name;
+    size_t n;
+    if (!t.vector(center) || !t.number(radius) || !t.word(name, n)) return fail("sphere: expected x y z radius material");
+    // NaN and inf would reach the accelerator builds, negative radii are
+    // the hollow insides of glass spheres
+    if (!std::isfinite(center.x()) || !std::isfinite(center.y()) || !std::isfinite(center.z())) {
+        return fail("sphere: center is not finite");
+    }
+    if (!std::isfinite(radius) || radius == 0) return fail("sphere: radius is zero or not finite");
+
+    if (last_material.empty() || !word_is(name, n, last_material.c_str())) {
+        auto it = material_ids.find(std::string(name, n));
+        if (it == material_ids.end()) return fail("sphere: unknown material " + std::string(name, n));
+        last_material.assign(name, n);
+        last_material_id = it->second;
+    }
+    sc.add_sphere(center, radius, last_material_id);
+    return true;
+}
+
+bool scene_loader::parse_line(char* line) {
+    line_number++;
+    if (char* comment = strchr(line, '#')) *comment = '\0';
+    tokens t{line};
+    const char* keyword;
+    size_t n;
+    if (!t.word(keyword, n)) return true;
+
+    bool ok;
+    // A camera path only moves the camera and a job only picks the view
+    // and the image, the world is already built
+    if (allowed == scene_statements::camera_path) {
+        if (word_is(keyword, n, "frame")) ok = parse_frame(t);
+        else if (word_is(keyword, n, "camera")) ok = parse_camera(t);
+        else return fail("not allowed in a camera path: " + std::string(keyword, n));
+    } else if (allowed == scene_statements::job) {
+        if (word_is(keyword, n, "camera")) ok = parse_camera(t);
+        else if (word_is(keyword, n, "image")) ok = parse_image(t);
+        else return fail("not allowed in a job: " + std::string(keyword, n));
+    } else if (word_is(keyword, n, "sphere")) ok = parse_sphere(t);
+    else if (word_is(keyword, n, "material")) ok = parse_material(t);
+    else if (word_is(keyword, n, "camera")) ok = parse_camera(t);
+    else if (word_is(keyword, n, "image")) ok = parse_image(t);
+    else return fail("unknown statement " + std::string(keyword, n));
+    if (!ok) return false;
+
+    const char* extra;
+    if (t.word(extra, n)) return fail("unexpected " + std::string(extra, n));
+    return true;
+}
+
+bool scene_loader::parse_lines(char* buffer, size_t size, bool last, size_t& consumed) {
+    consumed = 0;
+    while (consumed < size) {
+        char* begin = buffer + consumed;
+        char* newline = static_cast<char*>(memchr(begin, '\n', size - consumed));
+        if (!newline) {
+            if (!last) return true;
+            // Final line without a newline, the buffer has room for the terminator
+            buffer[size] = '\0';
+            consumed = size;
+            return parse_line(begin);
+        }
+        *newline = '\0';
+        consumed = newline + 1 - buffer;
+        if (!parse_line(begin)) return false;
+    }
+    return true;
+}
+
+bool scene_loader::load_file(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Read 1 MiB at a time, a line cut off at the end of a chunk is moved
+    // to the front and completed by the next read
+    std::vector<char> buffer(size_t(1) << 20);
+    size_t filled = 0;
+    bool ok = true;
+    for (;;) {
+        if (filled + 1 >= buffer.size()) buffer.resize(buffer.size() * 2);
+        size_t got = fread(buffer.data() + filled, 1, buffer.size() - filled - 1, f);
+        filled += got;
+        bool last = got == 0;
+        size_t consumed;
+        if (!parse_lines(buffer.data(), filled, last, consumed)) {
+            ok = false;
+            break;
+        }
+        memmove(buffer.data(), buffer.data() + consumed, filled - consumed);
+        filled -= consumed;
+        if (last) break;
+    }
+    if (ok && ferror(f)) {
+        error = "error reading " + path;
+        ok = false;
+    }
+    fclose(f);
+    if (ok) sc.lights.sort();
+    return ok;
+}
+
+bool scene_loader::load_string(const std::string& text) {
+    std::vector<char> buffer(text.begin(), text.end());
+    buffer.push_back('\0');
+    size_t consumed;
+    if (!parse_lines(buffer.data(), text.size(), true, consumed)) return false;
+    sc.lights.sort();
+    return true;
+}
+
+// Peak resident set size of this process so far, in MiB
+inline double peak_rss_mib() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "linear_bvh.h"
+#include "material.h"
+#include "scene.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// Binary scene cache. One file holds the render settings, the material
+// table, every sphere as a flat record in BVH leaf order and the nodes of
+// a linear_bvh built over them. Loading maps the file and traces straight
+// out of the mapping, nothing is parsed and the sphere and node arrays are
+// never copied.
+//
+// Layout: scene_cache_header, then the material, sphere and node arrays,
+// each starting on a 64 byte boundary at the offset the header gives.
+// Everything is in native byte order; the header records the byte order
+// and record sizes so a cache from a different build is rejected rather
+// than misread.
+
+const char scene_cache_magic[8] = {'R', 'T', 'S', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t scene_cache_version = 2;
+
+// One sphere, center and radius plus its material
+struct packed_sphere {
+    double center[3];
+    double radius;
+    uint32_t material_id;
+    uint32_t pad;
+};
+
+struct scene_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;            // 0x01020304 as written
+    uint32_t material_size, sphere_size, node_size, pad;
+    // Identifies the scene source the cache was built from
+    uint64_t source_stamp;
+    // Checksum of everything after the header
+    uint64_t payload_checksum;
+    uint64_t file_size;
+
+    int32_t image_width, samples_per_pixel, max_depth, pad2;
+    double aspect_ratio;
+    double lookfrom[3], lookat[3], vup[3];
+    double vfov, aperture, focus_dist;
+
+    uint64_t material_count, material_offset;
+    uint64_t sphere_count, sphere_offset;
+    uint64_t node_count, node_offset;
+};
+
+static_assert(std::is_trivially_copyable<material>::value, "materials are stored byte for byte");
+static_assert(std::is_trivially_copyable<linear_bvh_node>::value, "nodes are stored byte for byte");
+
+// 64 bit checksum, one multiply per 8 bytes so checking a large cache costs
+// a fraction of what rebuilding it would
+inline uint64_t checksum64(const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+    size_t words = n / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + 8 * i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (size_t i = words * 8; i < n; i++) {
+        h = (h ^ p[i]) * 0xc4ceb9fe1a85ec53ull;
+    }
+    return splitmix64(h);
+}
+
+// Stamp for a scene file, changes whenever the file is edited
+inline bool scene_source_stamp(const std::string& path, uint64_t& stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    stamp = hash_key(static_cast<uint64_t>(st.st_size),
+                     static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec);
+    return true;
+}
+
+// Stamp for a scene given as text
+inline uint64_t scene_text_stamp(const std::string& text) {
+    return checksum64(text.data(), text.size());
+}
+
+// Read only mapping of a whole file, unmapped on destruction
+class mapped_file {
+    public:
+        mapped_file() {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file() {
+            if (data) munmap(const_cast<unsigned char*>(data), size);
+        }
+
+        bool open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return false;
+            }
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED) return false;
+            data = static_cast<const unsigned char*>(p);
+            size = st.st_size;
+            return true;
+        }
+
+    public:
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+};
+
+// linear_bvh traversal over the mapped node and sphere arrays. Spheres
+// sit in leaf order so a leaf's offset indexes them directly.
+class mapped_sphere_bvh: public hittable {
+    public:
+        mapped_sphere_bvh(shared_ptr<mapped_file> file, const linear_bvh_node* nodes, size_t node_count,
+                          const packed_sphere* spheres)
+            : file(file), nodes(nodes), node_count(node_count), spheres(spheres) {}
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override {
+            if (node_count == 0) return false;
+            return linear_bvh_traverse(nodes, r, t_min, t_max,
+                [&](uint32_t first, uint32_t count, real& closest_so_far) {
+                    bool hit_anything = false;
+                    for (uint32_t i = first; i < first + count; i++) {
+                        const packed_sphere& s = spheres[i];
+                        point3 center(s.center[0], s.center[1], s.center[2]);
+                        if (hit_sphere(center, s.radius, s.material_id, r, t_min, closest_so_far, rec)) {
+                            hit_anything = true;
+                            closest_so_far = rec.t;
+                        }
+                    }
+                    return hit_anything;
+                });
+        }
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override {
+            if (node_count == 0) return false;
+            return linear_bvh_occluded(nodes, r, t_min, t_max,
+                [&](uint32_t first, uint32_t count) {
+                    for (uint32_t i = first; i < first + count; i++) {
+                        const packed_sphere& s = spheres[i];
+                        if (sphere_occludes(point3(s.center[0], s.center[1], s.center[2]), s.radius, r, t_min, t_max)) {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+        }
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            if (node_count == 0) return false;
+            const linear_bvh_node& root = nodes[0];
+            output_box = aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                              point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+            return true;
+        }
+
+    private:
+        shared_ptr<mapped_file> file;
+        const linear_bvh_node* nodes;
+        size_t node_count;
+        const packed_sphere* spheres;
+};
+
+inline uint64_t scene_cache_align(uint64_t offset) {
+    return (offset + 63) & ~uint64_t(63);
+}
+
+// Builds a linear_bvh over sc and writes it with everything needed to
+// render to path. Written to a temporary file and renamed into place so
+// a crash never leaves a half written cache behind. Only spheres can be
+// cached, returns false with error set otherwise.
+bool write_scene_cache(const std::string& path, const scene& sc, uint64_t source_stamp, std::string& error) {
+    linear_bvh bvh(sc.world);
+
+    std::vector<packed_sphere> spheres;
+    spheres.reserve(bvh.primitives.size());
+    for (const hittable* object : bvh.primitives) {
+        auto s = dynamic_cast<const sphere*>(object);
+        if (!s) {
+            error = "only spheres can be cached";
+            return false;
+        }
+        packed_sphere p;
+        p.center[0] = s->center.x();
+        p.center[1] = s->center.y();
+        p.center[2] = s->center.z();
+        p.radius = s->radius;
+        p.material_id = s->material_id;
+        p.pad = 0;
+        spheres.push_back(p);
+    }
+
+    scene_cache_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, scene_cache_magic, sizeof(h.magic));
+    h.version = scene_cache_version;
+    h.byte_order = 0x01020304;
+    h.material_size = sizeof(material);
+    h.sphere_size = sizeof(packed_sphere);
+    h.node_size = sizeof(linear_bvh_node);
+    h.source_stamp = source_stamp;
+    h.image_width = sc.image_width;
+    h.samples_per_pixel = sc.samples_per_pixel;
+    h.max_depth = sc.max_depth;
+    h.aspect_ratio = sc.aspect_ratio;
+    for (int a = 0; a < 3; a++) {
+        h.lookfrom[a] = sc.lookfrom[a];
+        h.lookat[a] = sc.lookat[a];
+        h.vup[a] = sc.vup[a];
+    }
+    h.vfov = sc.vfov;
+    h.aperture = sc.aperture;
+    h.focus_dist = sc.focus_dist;
+
+    h.material_count = sc.materials.size();
+    h.material_offset = scene_cache_align(sizeof(h));
+    h.sphere_count = spheres.size();
+    h.sphere_offset = scene_cache_align(h.material_offset + h.material_count * sizeof(material));
+    h.node_count = bvh.nodes.size();
+    h.node_offset = scene_cache_align(h.sphere_offset + h.sphere_count * sizeof(packed_sphere));
+    h.file_size = h.node_offset + h.node_count * sizeof(linear_bvh_node);
+
+    std::vector<unsigned char> bytes(h.file_size, 0);
+    if (h.material_count) memcpy(&bytes[h.material_offset], sc.materials.materials.data(), h.material_count * sizeof(material));
+    if (h.sphere_count) memcpy(&bytes[h.sphere_offset], spheres.data(), h.sphere_count * sizeof(packed_sphere));
+    if (h.node_count) memcpy(&bytes[h.node_offset], bvh.nodes.data(), h.node_count * sizeof(linear_bvh_node));
+    h.payload_checksum = checksum64(&bytes[sizeof(h)], bytes.size() - sizeof(h));
+    memcpy(&bytes[0], &h, sizeof(h));
+
+    std::string temp_path = path + ".tmp";
+    FILE* f = fopen(temp_path.c_str(), "wb");
+    if (!f) {
+        error = "cannot write " + temp_path;
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+// A mapped cache file, checked against the scene source it should match
+class scene_cache {
+    public:
+        // Maps path and checks it. Fails with error set if the file is
+        // missing, from another build or version, corrupt, or was built
+        // from a different source_stamp (stale).
+        bool open(const std::string& path, uint64_t source_stamp, std::string& error) {
+            file = make_shared<mapped_file>();
+            if (!file->open(path)) return fail("missing", error);
+            if (file->size < sizeof(scene_cache_header)) return fail("truncated", error);
+            // Map offsets are page aligned, so the header can be read in place
+            header = reinterpret_cast<const scene_cache_header*>(file->data);
+            if (memcmp(header->magic, scene_cache_magic, sizeof(header->magic)) != 0) return fail("not a scene cache", error);
+            if (header->version != scene_cache_version) return fail("version " + std::to_string(header->version), error);
+            if (header->byte_order != 0x01020304 || header->material_size != sizeof(material) ||
+                header->sphere_size != sizeof(packed_sphere) || header->node_size != sizeof(linear_bvh_node)) {
+                return fail("written by an incompatible build", error);
+            }
+            if (header->file_size != file->size) return fail("truncated", error);
+            if (header->source_stamp != source_stamp) return fail("stale", error);
+            if (header->material_offset + header->material_count * sizeof(material) > file->size ||
+                header->sphere_offset + header->sphere_count * sizeof(packed_sphere) > file->size ||
+                header->node_offset + header->node_count * sizeof(linear_bvh_node) > file->size) {
+                return fail("corrupt", error);
+            }
+            if (checksum64(file->data + sizeof(scene_cache_header), file->size - sizeof(scene_cache_header)) != header->payload_checksum) {
+                return fail("checksum mismatch", error);
+            }
+            return true;
+        }
+
+        // Copies the settings, the (small) material table and the lights into sc
+        void apply_settings(scene& sc) const {
+            sc.image_width = header->image_width;
+            sc.samples_per_pixel = header->samples_per_pixel;
+            sc.max_depth = header->max_depth;
+            sc.aspect_ratio = header->aspect_ratio;
+            sc.lookfrom = point3(header->lookfrom[0], header->lookfrom[1], header->lookfrom[2]);
+            sc.lookat = point3(header->lookat[0], header->lookat[1], header->lookat[2]);
+            sc.vup = vec3(header->vup[0], header->vup[1], header->vup[2]);
+            sc.vfov = header->vfov;
+            sc.aperture = header->aperture;
+            sc.focus_dist = header->focus_dist;
+            const material* m = reinterpret_cast<const material*>(file->data + header->material_offset);
+            sc.materials.materials.assign(m, m + header->material_count);
+
+            // The lights, scanning the spheres only when something emits
+            sc.lights = light_list();
+            bool any_emissive = false;
+            for (const material& mat : sc.materials.materials) any_emissive |= mat.kind == material_kind::emissive;
+            if (!any_emissive) return;
+            const packed_sphere* s = reinterpret_cast<const packed_sphere*>(file->data + header->sphere_offset);
+            for (size_t i = 0; i < header->sphere_count; i++) {
+                sc.lights.add(point3(s[i].center[0], s[i].center[1], s[i].center[2]), s[i].radius, s[i].material_id,
+                              sc.materials);
+            }
+            sc.lights.sort();
+        }
+
+        // Accelerator that traces straight from the mapping
+        shared_ptr<hittable> accelerator() const {
+            return make_shared<mapped_sphere_bvh>(file,
+                reinterpret_cast<const linear_bvh_node*>(file->data + header->node_offset), header->node_count,
+                reinterpret_cast<const packed_sphere*>(file->data + header->sphere_offset));
+        }
+
+        size_t sphere_count() const { return header->sphere_count; }
+
+    private:
+        bool fail(const std::string& why, std::string& error) {
+            error = why;
+            file.reset();
+            header = nullptr;
+            return false;
+        }
+
+    private:
+        shared_ptr<mapped_file> file;
+        const scene_cache_header* header = nullptr;
+};
+
+#endif
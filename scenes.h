@@ -0,0 +1,145 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include "material.h"
+#include "scene.h"
+#include "sphere.h"
+
+#include <cstdint>
+
+// Built in scenes, the text one main renders when no --scene is given
+// and generated ones that are too big or too random to write out by
+// hand. Generators draw from seed_random(seed) so the same seed always
+// gives the same scene.
+
+const char* default_scene = R"(# Three spheres from Ray Tracing in One Weekend, the middle glass one hollow
+image width 400 aspect 16/9 spp 100 depth 50
+camera lookfrom 3 3 2 lookat 0 0 -1 vup 0 1 0 vfov 20 aperture 2.0
+
+material ground lambertian 0.8 0.8 0.0
+material center lambertian 0.1 0.2 0.5
+material left dielectric 1.5
+material right metal 0.8 0.6 0.2 0.0
+
+sphere  0.0 -100.5 -1.0  100.0  ground
+sphere  0.0    0.0 -1.0    0.5  center
+sphere -1.0    0.0 -1.0    0.5  left
+sphere -1.0    0.0 -1.0  -0.45  left
+sphere  1.0    0.0 -1.0    0.5  right
+)";
+
+// A closed room lit only by two small sphere lights, no sky gets in.
+// Bouncing rays rarely find lights this small, the scene for comparing
+// the --lights modes.
+const char* lit_room_scene = R"(# Diffuse, glass and metal spheres in a room lit by two small lamps
+image width 400 aspect 16/9 spp 100 depth 50
+camera lookfrom 0 2.5 8 lookat 0 1 0 vup 0 1 0 vfov 40
+
+material walls lambertian 0.7 0.7 0.7
+material floor lambertian 0.5 0.45 0.4
+material red lambertian 0.7 0.15 0.1
+material glass dielectric 1.5
+material steel metal 0.8 0.8 0.85 0.1
+material lamp emissive 100 95 85
+material ember emissive 120 70 30
+
+sphere  0.0     0.0  0.0  14.0  walls
+sphere  0.0 -1000.0  0.0  1000  floor
+sphere -2.2     1.0  0.0   1.0  red
+sphere  0.0     1.0  0.0   1.0  glass
+sphere  2.2     1.0  0.0   1.0  steel
+sphere  0.0     5.0  1.0   0.3  lamp
+sphere -4.0     3.0  3.0   0.2  ember
+)";
+
+// The book's final cover image: a huge ground sphere, a 22x22 grid of
+// small random spheres and three big ones (glass, diffuse and metal)
+void final_scene(scene& sc, uint64_t seed) {
+    seed_random(seed, 0);
+    sc.image_width = 400;
+    sc.aspect_ratio = 16.0 / 9.0;
+    sc.lookfrom = point3(13, 2, 3);
+    sc.lookat = point3(0, 0, 0);
+    sc.vup = vec3(0, 1, 0);
+    sc.vfov = 20;
+    sc.aperture = 0.1;
+    sc.focus_dist = 10;
+
+    sc.add<sphere>(point3(0, -1000, 0), 1000, sc.materials.add(lambertian(color(0.5, 0.5, 0.5))));
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            if ((center - point3(4, 0.2, 0)).length() <= 0.9) continue;
+            material m;
+            if (choose_mat < 0.8) m = lambertian(color::random() * color::random());
+            else if (choose_mat < 0.95) m = metal(color::random(0.5, 1), random_double(0, 0.5));
+            else m = dielectric(1.5);
+            sc.add<sphere>(center, 0.2, sc.materials.add(m));
+        }
+    }
+    sc.add<sphere>(point3(0, 1, 0), 1.0, sc.materials.add(dielectric(1.5)));
+    sc.add<sphere>(point3(-4, 1, 0), 1.0, sc.materials.add(lambertian(color(0.4, 0.2, 0.1))));
+    sc.add<sphere>(point3(4, 1, 0), 1.0, sc.materials.add(metal(color(0.7, 0.6, 0.5), 0.0)));
+}
+
+// n small spheres scattered through a cube around the origin, seen from
+// outside. Spheres share a small palette of materials so the table stays
+// tiny however big n gets.
+void random_sphere_scene(scene& sc, int n, uint64_t seed) {
+    seed_random(seed, 0);
+    // Keep the density about constant as n grows
+    double extent = cbrt(static_cast<double>(n)) * 2.0;
+    sc.image_width = 400;
+    sc.aspect_ratio = 16.0 / 9.0;
+    sc.lookfrom = point3(1.2 * extent, 0.8 * extent, 1.6 * extent);
+    sc.lookat = point3(0, 0, 0);
+    sc.vup = vec3(0, 1, 0);
+    sc.vfov = 40;
+    sc.aperture = 0;
+    sc.focus_dist = 0;
+
+    const int palette_size = 16;
+    uint32_t palette[palette_size];
+    for (int k = 0; k < palette_size; k++) {
+        palette[k] = sc.materials.add(k % 4 == 3 ? metal(color::random(0.5, 1), random_double(0, 0.3))
+                                                 : lambertian(color::random() * color::random()));
+    }
+    for (int i = 0; i < n; i++) {
+        point3 center = vec3::random(-extent, extent);
+        sc.add<sphere>(center, random_double(0.2, 0.6), palette[i % palette_size]);
+    }
+}
+
+// Mostly glass: a grid of solid and hollow dielectric spheres over a
+// diffuse floor, so paths refract and bounce for a long time
+void glass_scene(scene& sc, uint64_t seed) {
+    seed_random(seed, 0);
+    sc.image_width = 400;
+    sc.aspect_ratio = 16.0 / 9.0;
+    sc.lookfrom = point3(0, 4, 9);
+    sc.lookat = point3(0, 0.5, 0);
+    sc.vup = vec3(0, 1, 0);
+    sc.vfov = 35;
+    sc.aperture = 0;
+    sc.focus_dist = 0;
+
+    sc.add<sphere>(point3(0, -1000, 0), 1000, sc.materials.add(lambertian(color(0.6, 0.6, 0.6))));
+    uint32_t glass = sc.materials.add(dielectric(1.5));
+    uint32_t dense_glass = sc.materials.add(dielectric(2.4));
+    for (int a = -4; a <= 4; a++) {
+        for (int b = -4; b <= 4; b++) {
+            point3 center(a + 0.3 * random_double(-1, 1), 0.4, b + 0.3 * random_double(-1, 1));
+            uint32_t m = random_double() < 0.5 ? glass : dense_glass;
+            sc.add<sphere>(center, 0.4, m);
+            // Every other sphere is a bubble, a negative radius flips its normals
+            if ((a + b) % 2 == 0) sc.add<sphere>(center, -0.35, m);
+        }
+    }
+    sc.add<sphere>(point3(0, 1.5, -2), 1.5, glass);
+    sc.add<sphere>(point3(0, 1.5, -2), -1.4, glass);
+}
+
+#endif
@@ -4,20 +4,32 @@
 #include "hittable.h"
 #include "vec3.h"
 
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
 class sphere: public hittable {
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m): center(cen), radius(r), mat_ptr(m) {}
+        sphere(point3 cen, real r, uint32_t m): center(cen), radius(r), material_id(m) {}
+
+        // Mark the sphere dirty in its list afterwards so accelerators refit
+        void move_to(const point3& c) { center = c; }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+    virtual bool bounding_box(aabb& output_box) const override;
+    virtual void hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const override;
 
     public:
         point3 center;
-        double radius;
-        shared_ptr<material> mat_ptr;
+        real radius;
+        uint32_t material_id;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+// Both t where the ray's line crosses the sphere, near first, false if
+// it misses. Shared by the closest hit and the occlusion test.
+inline bool sphere_roots(const point3& center, real radius, const ray& r, real& near_root, real& far_root) {
     // This math solves for t in this equation:
     // (A + tb - C) * (A + tb - C) = r^2 (equation of sphere)
     // A (origin), b (direction), C (center of sphere) are vectors
@@ -26,21 +38,48 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     // hit the sphere on its way to the viewport plane
     // Remember t is the distance along our ray from
     // the origin to the destination
+    RT_COUNT(sphere_tests);
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
     auto c = oc.length_squared() - radius * radius;
-    auto discriminant = half_b * half_b - a * c;
-    // No real roots meaning no solution
-    if (discriminant < 0) return false;
-    // Now we look at both of our roots (if we have 2
-    // and take the closest one)
-    auto sqrtd = sqrt(discriminant);
+    if (sizeof(real) < sizeof(double)) {
+        // In float half_b^2 - a*c cancels away to noise for small spheres
+        // far from the ray origin. Take the discriminant from f, the
+        // offset of the center from the ray's line, which is
+        // a * (r^2 - |f|^2), and get the near root from q without
+        // subtracting two large numbers (Ray Tracing Gems ch. 7)
+        vec3 f = oc - (half_b / a) * r.direction();
+        auto discriminant = a * (radius * radius - f.length_squared());
+        if (discriminant < 0) return false;
+        auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+        near_root = c / q;
+        far_root = q / a;
+        if (near_root > far_root) std::swap(near_root, far_root);
+    } else {
+        auto discriminant = half_b * half_b - a * c;
+        // No real roots meaning no solution
+        if (discriminant < 0) return false;
+        // Now we look at both of our roots (if we have 2
+        // and take the closest one)
+        auto sqrtd = sqrt(discriminant);
+        near_root = (-half_b - sqrtd) / a;
+        far_root = (-half_b + sqrtd) / a;
+    }
+    return true;
+}
+
+// Ray/sphere intersection on plain values, shared by sphere and the
+// flat sphere arrays of the scene cache
+inline bool hit_sphere(const point3& center, real radius, uint32_t material_id,
+                       const ray& r, real t_min, real t_max, hit_record& rec) {
+    real near_root, far_root;
+    if (!sphere_roots(center, radius, r, near_root, far_root)) return false;
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    auto root = near_root;
     if (root < t_min || t_max < root) {
         // Look if 'positive' root is in acceptable range
-        root = (-half_b + sqrtd) / a;
+        root = far_root;
         if (root < t_min || t_max < root) {
             // root aka 't' not in our min max range
             return false;
@@ -62,8 +101,99 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     // Sets rec.front_face and rec.normal
     rec.set_face_normal(r, outward_normal);
     // Set the material for our sphere
-    rec.mat_ptr = mat_ptr;
+    rec.material_id = material_id;
+
+    return true;
+}
+
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    return hit_sphere(center, radius, material_id, r, t_min, t_max, rec);
+}
+
+// Either root in range blocks the ray, no record, normal or material
+inline bool sphere_occludes(const point3& center, real radius, const ray& r, real t_min, real t_max) {
+    real near_root, far_root;
+    if (!sphere_roots(center, radius, r, near_root, far_root)) return false;
+    return (near_root >= t_min && near_root <= t_max) || (far_root >= t_min && far_root <= t_max);
+}
+
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+    return sphere_occludes(center, radius, r, t_min, t_max);
+}
+
+// Same math as sphere::hit() for every lane of a packet without early
+// outs, leaves the root at infinity for lanes that miss. Written branch
+// free over restrict pointers so the compiler vectorizes it, and cloned
+// for AVX2 with the best copy picked at load time.
+__attribute__((target_clones("avx2", "default")))
+static void sphere_packet_roots(const ray_packet& packet, const point3& center, real radius, real t_min,
+                                const real* __restrict t_max, real* __restrict root) {
+    const real cx = center.x(), cy = center.y(), cz = center.z();
+    const real rr = radius * radius;
+    for (int l = 0; l < ray_packet::size; l++) {
+        auto ocx = packet.ox[l] - cx;
+        auto ocy = packet.oy[l] - cy;
+        auto ocz = packet.oz[l] - cz;
+        auto a = packet.dx[l] * packet.dx[l] + packet.dy[l] * packet.dy[l] + packet.dz[l] * packet.dz[l];
+        auto half_b = ocx * packet.dx[l] + ocy * packet.dy[l] + ocz * packet.dz[l];
+        auto c = ocx * ocx + ocy * ocy + ocz * ocz - rr;
+        real discriminant, near_root, far_root;
+        if (sizeof(real) < sizeof(double)) {
+            // Cancellation free float form, see hit_sphere()
+            auto k = half_b / a;
+            auto fx = ocx - k * packet.dx[l], fy = ocy - k * packet.dy[l], fz = ocz - k * packet.dz[l];
+            discriminant = a * (rr - (fx * fx + fy * fy + fz * fz));
+            auto sqrtd = sqrt(discriminant > 0 ? discriminant : real(0));
+            auto q = -(half_b + std::copysign(sqrtd, half_b));
+            auto t0 = c / q, t1 = q / a;
+            near_root = std::fmin(t0, t1);
+            far_root = std::fmax(t0, t1);
+        } else {
+            discriminant = half_b * half_b - a * c;
+            auto sqrtd = sqrt(discriminant > 0 ? discriminant : 0.0);
+            near_root = (-half_b - sqrtd) / a;
+            far_root = (-half_b + sqrtd) / a;
+        }
+        // Bitwise & and | so there are no branches to vectorize around
+        bool near_ok = (near_root >= t_min) & (near_root <= t_max[l]);
+        bool far_ok = (far_root >= t_min) & (far_root <= t_max[l]);
+        auto r = near_ok ? near_root : far_root;
+        root[l] = ((discriminant >= 0) & (near_ok | far_ok)) ? r : infinity;
+    }
+}
+
+void sphere::hit_packet(const ray_packet& packet, uint64_t active, real t_min, hit_packet_record& recs) const {
+    // Mostly dead packets after a few bounces are cheaper lane by lane
+    if (__builtin_popcountll(active) < ray_packet::size / 4) {
+        hittable::hit_packet(packet, active, t_min, recs);
+        return;
+    }
+
+    RT_COUNT_N(sphere_tests, ray_packet::size);
+    real root[ray_packet::size];
+    sphere_packet_roots(packet, center, radius, t_min, recs.t_max, root);
+
+    // Only lanes that actually hit pay for the record
+    for (uint64_t m = active; m; m &= m - 1) {
+        int l = first_lane(m);
+        if (root[l] == infinity) continue;
+        hit_record& rec = recs.rec[l];
+        ray r = packet.get(l);
+        rec.t = root[l];
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        rec.material_id = material_id;
+        recs.t_max[l] = rec.t;
+        recs.hit |= lane_bit(l);
+    }
+}
 
+bool sphere::bounding_box(aabb& output_box) const {
+    // Radius can be negative (hollow glass trick) so
+    // use its magnitude for the extents
+    auto r = fabs(radius);
+    output_box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
     return true;
 }
 
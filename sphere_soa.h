@@ -0,0 +1,507 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "rtweekend.h"
+
+#include "aligned_allocator.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPHERE_SOA_X86 1
+#endif
+
+// Instruction sets sphere_soa can intersect with, picked at runtime
+enum class simd_isa { scalar, sse42, avx2, avx512 };
+
+inline const char* simd_isa_name(simd_isa isa) {
+    switch (isa) {
+        case simd_isa::sse42:  return "sse4.2";
+        case simd_isa::avx2:   return "avx2";
+        case simd_isa::avx512: return "avx512";
+        default:               return "scalar";
+    }
+}
+
+// Best instruction set this CPU supports. The RT_SIMD environment
+// variable (scalar, sse4.2, avx2, avx512) caps it, handy for comparing paths.
+inline simd_isa detect_simd_isa() {
+    simd_isa best = simd_isa::scalar;
+#ifdef SPHERE_SOA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) best = simd_isa::sse42;
+    if (__builtin_cpu_supports("avx2")) best = simd_isa::avx2;
+    if (__builtin_cpu_supports("avx512f")) best = simd_isa::avx512;
+#endif
+    const char* cap = getenv("RT_SIMD");
+    if (cap) {
+        for (simd_isa isa : {simd_isa::scalar, simd_isa::sse42, simd_isa::avx2, simd_isa::avx512}) {
+            if (!strcmp(cap, simd_isa_name(isa)) && isa < best) best = isa;
+        }
+    }
+    return best;
+}
+
+// Sphere data split into one array per field, padded to a multiple of
+// 8 with NaN spheres that can never be hit, so every kernel can run
+// full width with aligned loads and no remainder loop
+struct sphere_soa_arrays {
+    static const int lane_pad = 8;
+    using double_array = std::vector<double, aligned_allocator<double, 64>>;
+
+    double_array center_x, center_y, center_z, radius;
+    std::vector<uint32_t> material_id;
+    // Real sphere count, the arrays are padded up from this
+    int count = 0;
+
+    int padded_count() const { return static_cast<int>(radius.size()); }
+};
+
+// Kernel: index of the closest sphere with a root in [t_min, t_max], or -1.
+// The root is returned through t_hit.
+using sphere_soa_kernel = int (*)(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max, double& t_hit);
+
+// Occlusion kernel: true as soon as any sphere has a root in [t_min, t_max]
+using sphere_soa_any_kernel = bool (*)(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max);
+
+// Same math in the same order as sphere::hit, one sphere at a time
+inline int sphere_soa_hit_scalar(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max, double& t_hit) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    auto a = d.length_squared();
+    int best = -1;
+    auto closest = t_max;
+    for (int i = 0; i < s.count; i++) {
+        vec3 oc = o - point3(s.center_x[i], s.center_y[i], s.center_z[i]);
+        auto half_b = dot(oc, d);
+        auto c = oc.length_squared() - s.radius[i] * s.radius[i];
+        auto discriminant = half_b * half_b - a * c;
+        if (discriminant < 0) continue;
+        auto sqrtd = sqrt(discriminant);
+        auto root = (-half_b - sqrtd) / a;
+        if (root < t_min || closest < root) {
+            root = (-half_b + sqrtd) / a;
+            if (root < t_min || closest < root) continue;
+        }
+        closest = root;
+        best = i;
+    }
+    t_hit = closest;
+    return best;
+}
+
+inline bool sphere_soa_any_scalar(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    auto a = d.length_squared();
+    for (int i = 0; i < s.count; i++) {
+        vec3 oc = o - point3(s.center_x[i], s.center_y[i], s.center_z[i]);
+        auto half_b = dot(oc, d);
+        auto c = oc.length_squared() - s.radius[i] * s.radius[i];
+        auto discriminant = half_b * half_b - a * c;
+        if (discriminant < 0) continue;
+        auto sqrtd = sqrt(discriminant);
+        auto root1 = (-half_b - sqrtd) / a;
+        auto root2 = (-half_b + sqrtd) / a;
+        if ((root1 >= t_min && root1 <= t_max) || (root2 >= t_min && root2 <= t_max)) return true;
+    }
+    return false;
+}
+
+// Every lane keeps its own closest root and sphere index. Picking the
+// first root >= t_min and then the smallest over all spheres gives the
+// same sphere as the scalar loop, which narrows one shared closest value.
+// On ties the later sphere wins, like in hittable_list::hit.
+inline int sphere_soa_reduce(const double* lane_t, const double* lane_index, int lanes, double& t_hit) {
+    int best = -1;
+    for (int l = 0; l < lanes; l++) {
+        if (lane_index[l] < 0) continue;
+        int index = static_cast<int>(lane_index[l]);
+        if (best < 0 || lane_t[l] < t_hit || (lane_t[l] == t_hit && index > best)) {
+            t_hit = lane_t[l];
+            best = index;
+        }
+    }
+    return best;
+}
+
+#ifdef SPHERE_SOA_X86
+
+__attribute__((target("sse4.2")))
+inline int sphere_soa_hit_sse42(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max, double& t_hit) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m128d dx = _mm_set1_pd(d.x()), dy = _mm_set1_pd(d.y()), dz = _mm_set1_pd(d.z());
+    const __m128d ox = _mm_set1_pd(o.x()), oy = _mm_set1_pd(o.y()), oz = _mm_set1_pd(o.z());
+    const __m128d a = _mm_set1_pd(d.length_squared());
+    const __m128d tmin = _mm_set1_pd(t_min);
+    const __m128d zero = _mm_setzero_pd();
+    __m128d best_t = _mm_set1_pd(t_max);
+    __m128d best_index = _mm_set1_pd(-1.0);
+    __m128d index = _mm_set_pd(1.0, 0.0);
+    const __m128d step = _mm_set1_pd(2.0);
+
+    for (int i = 0; i < s.padded_count(); i += 2) {
+        __m128d ocx = _mm_sub_pd(ox, _mm_load_pd(&s.center_x[i]));
+        __m128d ocy = _mm_sub_pd(oy, _mm_load_pd(&s.center_y[i]));
+        __m128d ocz = _mm_sub_pd(oz, _mm_load_pd(&s.center_z[i]));
+        __m128d rad = _mm_load_pd(&s.radius[i]);
+        __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        __m128d c = _mm_sub_pd(
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)),
+            _mm_mul_pd(rad, rad));
+        __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+        __m128d has_roots = _mm_cmpge_pd(disc, zero);
+        // Skip the square roots and divides when no lane has a root
+        if (_mm_movemask_pd(has_roots) == 0) {
+            index = _mm_add_pd(index, step);
+            continue;
+        }
+        __m128d sqrtd = _mm_sqrt_pd(disc);
+        __m128d neg_b = _mm_sub_pd(zero, half_b);
+        __m128d root1 = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+        __m128d root2 = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+        __m128d ok1 = _mm_and_pd(_mm_cmpge_pd(root1, tmin), _mm_cmple_pd(root1, best_t));
+        __m128d ok2 = _mm_and_pd(_mm_cmpge_pd(root2, tmin), _mm_cmple_pd(root2, best_t));
+        __m128d root = _mm_blendv_pd(root2, root1, ok1);
+        __m128d take = _mm_and_pd(has_roots, _mm_or_pd(ok1, ok2));
+        best_t = _mm_blendv_pd(best_t, root, take);
+        best_index = _mm_blendv_pd(best_index, index, take);
+        index = _mm_add_pd(index, step);
+    }
+
+    alignas(16) double lane_t[2], lane_index[2];
+    _mm_store_pd(lane_t, best_t);
+    _mm_store_pd(lane_index, best_index);
+    t_hit = t_max;
+    return sphere_soa_reduce(lane_t, lane_index, 2, t_hit);
+}
+
+// The occlusion kernels test against the fixed t_max and return at the
+// first group of spheres with a root in range, no index or root kept
+__attribute__((target("sse4.2")))
+inline bool sphere_soa_any_sse42(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m128d dx = _mm_set1_pd(d.x()), dy = _mm_set1_pd(d.y()), dz = _mm_set1_pd(d.z());
+    const __m128d ox = _mm_set1_pd(o.x()), oy = _mm_set1_pd(o.y()), oz = _mm_set1_pd(o.z());
+    const __m128d a = _mm_set1_pd(d.length_squared());
+    const __m128d tmin = _mm_set1_pd(t_min), tmax = _mm_set1_pd(t_max);
+    const __m128d zero = _mm_setzero_pd();
+
+    for (int i = 0; i < s.padded_count(); i += 2) {
+        __m128d ocx = _mm_sub_pd(ox, _mm_load_pd(&s.center_x[i]));
+        __m128d ocy = _mm_sub_pd(oy, _mm_load_pd(&s.center_y[i]));
+        __m128d ocz = _mm_sub_pd(oz, _mm_load_pd(&s.center_z[i]));
+        __m128d rad = _mm_load_pd(&s.radius[i]);
+        __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+        __m128d c = _mm_sub_pd(
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)),
+            _mm_mul_pd(rad, rad));
+        __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+        __m128d has_roots = _mm_cmpge_pd(disc, zero);
+        if (_mm_movemask_pd(has_roots) == 0) continue;
+        __m128d sqrtd = _mm_sqrt_pd(disc);
+        __m128d neg_b = _mm_sub_pd(zero, half_b);
+        __m128d root1 = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+        __m128d root2 = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+        __m128d ok1 = _mm_and_pd(_mm_cmpge_pd(root1, tmin), _mm_cmple_pd(root1, tmax));
+        __m128d ok2 = _mm_and_pd(_mm_cmpge_pd(root2, tmin), _mm_cmple_pd(root2, tmax));
+        if (_mm_movemask_pd(_mm_and_pd(has_roots, _mm_or_pd(ok1, ok2)))) return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx2")))
+inline int sphere_soa_hit_avx2(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max, double& t_hit) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+    const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+    const __m256d a = _mm256_set1_pd(d.length_squared());
+    const __m256d tmin = _mm256_set1_pd(t_min);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d best_t = _mm256_set1_pd(t_max);
+    __m256d best_index = _mm256_set1_pd(-1.0);
+    __m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    const __m256d step = _mm256_set1_pd(4.0);
+
+    for (int i = 0; i < s.padded_count(); i += 4) {
+        __m256d ocx = _mm256_sub_pd(ox, _mm256_load_pd(&s.center_x[i]));
+        __m256d ocy = _mm256_sub_pd(oy, _mm256_load_pd(&s.center_y[i]));
+        __m256d ocz = _mm256_sub_pd(oz, _mm256_load_pd(&s.center_z[i]));
+        __m256d rad = _mm256_load_pd(&s.radius[i]);
+        __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        __m256d c = _mm256_sub_pd(
+            _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+            _mm256_mul_pd(rad, rad));
+        __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+        __m256d has_roots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+        // Skip the square roots and divides when no lane has a root
+        if (_mm256_movemask_pd(has_roots) == 0) {
+            index = _mm256_add_pd(index, step);
+            continue;
+        }
+        __m256d sqrtd = _mm256_sqrt_pd(disc);
+        __m256d neg_b = _mm256_sub_pd(zero, half_b);
+        __m256d root1 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+        __m256d root2 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+        __m256d ok1 = _mm256_and_pd(_mm256_cmp_pd(root1, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root1, best_t, _CMP_LE_OQ));
+        __m256d ok2 = _mm256_and_pd(_mm256_cmp_pd(root2, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root2, best_t, _CMP_LE_OQ));
+        __m256d root = _mm256_blendv_pd(root2, root1, ok1);
+        __m256d take = _mm256_and_pd(has_roots, _mm256_or_pd(ok1, ok2));
+        best_t = _mm256_blendv_pd(best_t, root, take);
+        best_index = _mm256_blendv_pd(best_index, index, take);
+        index = _mm256_add_pd(index, step);
+    }
+
+    alignas(32) double lane_t[4], lane_index[4];
+    _mm256_store_pd(lane_t, best_t);
+    _mm256_store_pd(lane_index, best_index);
+    t_hit = t_max;
+    return sphere_soa_reduce(lane_t, lane_index, 4, t_hit);
+}
+
+__attribute__((target("avx2")))
+inline bool sphere_soa_any_avx2(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()), dz = _mm256_set1_pd(d.z());
+    const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()), oz = _mm256_set1_pd(o.z());
+    const __m256d a = _mm256_set1_pd(d.length_squared());
+    const __m256d tmin = _mm256_set1_pd(t_min), tmax = _mm256_set1_pd(t_max);
+    const __m256d zero = _mm256_setzero_pd();
+
+    for (int i = 0; i < s.padded_count(); i += 4) {
+        __m256d ocx = _mm256_sub_pd(ox, _mm256_load_pd(&s.center_x[i]));
+        __m256d ocy = _mm256_sub_pd(oy, _mm256_load_pd(&s.center_y[i]));
+        __m256d ocz = _mm256_sub_pd(oz, _mm256_load_pd(&s.center_z[i]));
+        __m256d rad = _mm256_load_pd(&s.radius[i]);
+        __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+        __m256d c = _mm256_sub_pd(
+            _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)),
+            _mm256_mul_pd(rad, rad));
+        __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+        __m256d has_roots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+        if (_mm256_movemask_pd(has_roots) == 0) continue;
+        __m256d sqrtd = _mm256_sqrt_pd(disc);
+        __m256d neg_b = _mm256_sub_pd(zero, half_b);
+        __m256d root1 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+        __m256d root2 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+        __m256d ok1 = _mm256_and_pd(_mm256_cmp_pd(root1, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root1, tmax, _CMP_LE_OQ));
+        __m256d ok2 = _mm256_and_pd(_mm256_cmp_pd(root2, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root2, tmax, _CMP_LE_OQ));
+        if (_mm256_movemask_pd(_mm256_and_pd(has_roots, _mm256_or_pd(ok1, ok2)))) return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx512f")))
+inline int sphere_soa_hit_avx512(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max, double& t_hit) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m512d dx = _mm512_set1_pd(d.x()), dy = _mm512_set1_pd(d.y()), dz = _mm512_set1_pd(d.z());
+    const __m512d ox = _mm512_set1_pd(o.x()), oy = _mm512_set1_pd(o.y()), oz = _mm512_set1_pd(o.z());
+    const __m512d a = _mm512_set1_pd(d.length_squared());
+    const __m512d tmin = _mm512_set1_pd(t_min);
+    const __m512d zero = _mm512_setzero_pd();
+    __m512d best_t = _mm512_set1_pd(t_max);
+    __m512d best_index = _mm512_set1_pd(-1.0);
+    __m512d index = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+    const __m512d step = _mm512_set1_pd(8.0);
+
+    for (int i = 0; i < s.padded_count(); i += 8) {
+        __m512d ocx = _mm512_sub_pd(ox, _mm512_load_pd(&s.center_x[i]));
+        __m512d ocy = _mm512_sub_pd(oy, _mm512_load_pd(&s.center_y[i]));
+        __m512d ocz = _mm512_sub_pd(oz, _mm512_load_pd(&s.center_z[i]));
+        __m512d rad = _mm512_load_pd(&s.radius[i]);
+        __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+        __m512d c = _mm512_sub_pd(
+            _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz)),
+            _mm512_mul_pd(rad, rad));
+        __m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(a, c));
+        __mmask8 has_roots = _mm512_cmp_pd_mask(disc, zero, _CMP_GE_OQ);
+        if (has_roots == 0) {
+            index = _mm512_add_pd(index, step);
+            continue;
+        }
+        __m512d sqrtd = _mm512_sqrt_pd(disc);
+        __m512d neg_b = _mm512_sub_pd(zero, half_b);
+        __m512d root1 = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), a);
+        __m512d root2 = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), a);
+        __mmask8 ok1 = _mm512_cmp_pd_mask(root1, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(root1, best_t, _CMP_LE_OQ);
+        __mmask8 ok2 = _mm512_cmp_pd_mask(root2, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(root2, best_t, _CMP_LE_OQ);
+        __m512d root = _mm512_mask_blend_pd(ok1, root2, root1);
+        __mmask8 take = has_roots & (ok1 | ok2);
+        best_t = _mm512_mask_blend_pd(take, best_t, root);
+        best_index = _mm512_mask_blend_pd(take, best_index, index);
+        index = _mm512_add_pd(index, step);
+    }
+
+    alignas(64) double lane_t[8], lane_index[8];
+    _mm512_store_pd(lane_t, best_t);
+    _mm512_store_pd(lane_index, best_index);
+    t_hit = t_max;
+    return sphere_soa_reduce(lane_t, lane_index, 8, t_hit);
+}
+
+__attribute__((target("avx512f")))
+inline bool sphere_soa_any_avx512(const sphere_soa_arrays& s, const ray& r, double t_min, double t_max) {
+    const vec3 d = r.direction();
+    const point3 o = r.origin();
+    const __m512d dx = _mm512_set1_pd(d.x()), dy = _mm512_set1_pd(d.y()), dz = _mm512_set1_pd(d.z());
+    const __m512d ox = _mm512_set1_pd(o.x()), oy = _mm512_set1_pd(o.y()), oz = _mm512_set1_pd(o.z());
+    const __m512d a = _mm512_set1_pd(d.length_squared());
+    const __m512d tmin = _mm512_set1_pd(t_min), tmax = _mm512_set1_pd(t_max);
+    const __m512d zero = _mm512_setzero_pd();
+
+    for (int i = 0; i < s.padded_count(); i += 8) {
+        __m512d ocx = _mm512_sub_pd(ox, _mm512_load_pd(&s.center_x[i]));
+        __m512d ocy = _mm512_sub_pd(oy, _mm512_load_pd(&s.center_y[i]));
+        __m512d ocz = _mm512_sub_pd(oz, _mm512_load_pd(&s.center_z[i]));
+        __m512d rad = _mm512_load_pd(&s.radius[i]);
+        __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+        __m512d c = _mm512_sub_pd(
+            _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz)),
+            _mm512_mul_pd(rad, rad));
+        __m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(a, c));
+        __mmask8 has_roots = _mm512_cmp_pd_mask(disc, zero, _CMP_GE_OQ);
+        if (has_roots == 0) continue;
+        __m512d sqrtd = _mm512_sqrt_pd(disc);
+        __m512d neg_b = _mm512_sub_pd(zero, half_b);
+        __m512d root1 = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), a);
+        __m512d root2 = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), a);
+        __mmask8 ok1 = _mm512_cmp_pd_mask(root1, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(root1, tmax, _CMP_LE_OQ);
+        __mmask8 ok2 = _mm512_cmp_pd_mask(root2, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(root2, tmax, _CMP_LE_OQ);
+        if (has_roots & (ok1 | ok2)) return true;
+    }
+    return false;
+}
+
+#endif
+
+// Structure of arrays sphere storage, intersects one ray against 2, 4 or
+// 8 spheres per instruction depending on what the CPU supports. Meant for
+// batches of spheres (small scenes, or the spheres of one region) where the
+// closest hit is searched over all of them at once.
+class sphere_soa: public hittable {
+    public:
+        sphere_soa(): sphere_soa(detect_simd_isa()) {}
+        explicit sphere_soa(simd_isa isa) { set_isa(isa); }
+        sphere_soa(const hittable_list& list, simd_isa isa = detect_simd_isa()): sphere_soa(isa) {
+            for (const auto& object : list.objects) {
+                auto s = std::dynamic_pointer_cast<sphere>(object);
+                if (!s) {
+                    std::cerr << "sphere_soa only holds spheres, skipping object.\n";
+                    continue;
+                }
+                add(s->center, s->radius, s->material_id);
+            }
+        }
+
+        void add(const point3& center, double radius, uint32_t material_id);
+
+        simd_isa isa() const { return current_isa; }
+        void set_isa(simd_isa isa);
+
+        int size() const { return arrays.count; }
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+        virtual bool bounding_box(aabb& output_box) const override;
+
+    public:
+        sphere_soa_arrays arrays;
+
+    private:
+        simd_isa current_isa = simd_isa::scalar;
+        sphere_soa_kernel kernel = sphere_soa_hit_scalar;
+        sphere_soa_any_kernel any_kernel = sphere_soa_any_scalar;
+};
+
+void sphere_soa::set_isa(simd_isa isa) {
+    current_isa = isa;
+    kernel = sphere_soa_hit_scalar;
+    any_kernel = sphere_soa_any_scalar;
+#ifdef SPHERE_SOA_X86
+    if (isa == simd_isa::sse42) {
+        kernel = sphere_soa_hit_sse42;
+        any_kernel = sphere_soa_any_sse42;
+    }
+    if (isa == simd_isa::avx2) {
+        kernel = sphere_soa_hit_avx2;
+        any_kernel = sphere_soa_any_avx2;
+    }
+    if (isa == simd_isa::avx512) {
+        kernel = sphere_soa_hit_avx512;
+        any_kernel = sphere_soa_any_avx512;
+    }
+#else
+    current_isa = simd_isa::scalar;
+#endif
+}
+
+void sphere_soa::add(const point3& center, double radius, uint32_t material_id) {
+    // Drop the NaN padding, append, then pad back up to a full lane
+    int n = arrays.count;
+    arrays.center_x.resize(n);
+    arrays.center_y.resize(n);
+    arrays.center_z.resize(n);
+    arrays.radius.resize(n);
+
+    arrays.center_x.push_back(center.x());
+    arrays.center_y.push_back(center.y());
+    arrays.center_z.push_back(center.z());
+    arrays.radius.push_back(radius);
+    arrays.material_id.push_back(material_id);
+    arrays.count = n + 1;
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    while (arrays.radius.size() % sphere_soa_arrays::lane_pad != 0) {
+        arrays.center_x.push_back(nan);
+        arrays.center_y.push_back(nan);
+        arrays.center_z.push_back(nan);
+        arrays.radius.push_back(nan);
+    }
+}
+
+bool sphere_soa::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    RT_COUNT_N(sphere_tests, arrays.count);
+    double root;
+    int i = kernel(arrays, r, t_min, t_max, root);
+    if (i < 0) return false;
+
+    // Only the winning sphere pays for the hit record, same as sphere::hit
+    point3 center(arrays.center_x[i], arrays.center_y[i], arrays.center_z[i]);
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / arrays.radius[i];
+    rec.set_face_normal(r, outward_normal);
+    rec.material_id = arrays.material_id[i];
+    return true;
+}
+
+bool sphere_soa::occluded(const ray& r, real t_min, real t_max) const {
+    // Counted as the whole array like hit(), an early exit tests fewer
+    RT_COUNT_N(sphere_tests, arrays.count);
+    return any_kernel(arrays, r, t_min, t_max);
+}
+
+bool sphere_soa::bounding_box(aabb& output_box) const {
+    if (arrays.count == 0) return false;
+    output_box = aabb::empty();
+    for (int i = 0; i < arrays.count; i++) {
+        auto rad = fabs(arrays.radius[i]);
+        point3 center(arrays.center_x[i], arrays.center_y[i], arrays.center_z[i]);
+        output_box = surrounding_box(output_box, aabb(center - vec3(rad, rad, rad), center + vec3(rad, rad, rad)));
+    }
+    return true;
+}
+
+#endif
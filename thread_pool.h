@@ -0,0 +1,144 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that execute batches of integer-indexed
+// tasks. Every worker owns a deque of task indices, it pops work from the
+// back of its own deque and, once that runs dry, steals from the front of
+// the other workers' deques so that slow tiles (glass, lots of bounces)
+// don't leave the rest of the pool idle at the end of a frame.
+class thread_pool {
+    public:
+        // Task callback, gets the task index and the index of the worker
+        // running it (handy for per-thread scratch data)
+        using task_fn = std::function<void(int task, int worker)>;
+
+        explicit thread_pool(int thread_count) {
+            if (thread_count < 1) thread_count = default_thread_count();
+            for (int w = 0; w < thread_count; w++) {
+                queues.emplace_back(new worker_queue());
+            }
+            for (int w = 0; w < thread_count; w++) {
+                workers.emplace_back(&thread_pool::worker_loop, this, w);
+            }
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                stopping = true;
+            }
+            batch_start.notify_all();
+            for (auto& t : workers) t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator =(const thread_pool&) = delete;
+
+        int size() const { return static_cast<int>(workers.size()); }
+
+        static int default_thread_count() {
+            int n = static_cast<int>(std::thread::hardware_concurrency());
+            return n > 0 ? n : 1;
+        }
+
+        // Runs fn for every task in [0, task_count) and blocks until all
+        // of them have finished. Tasks are dealt round-robin over the worker
+        // deques so neighbouring tasks start out on different threads.
+        void run(int task_count, const task_fn& fn) {
+            if (task_count <= 0) return;
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            // A worker that woke up late for the previous batch may still be
+            // draining with that batch's job, let it leave before queueing
+            batch_done.wait(lock, [this] { return active == 0; });
+            for (int t = 0; t < task_count; t++) {
+                auto& q = *queues[t % queues.size()];
+                std::lock_guard<std::mutex> qlock(q.m);
+                q.tasks.push_back(t);
+            }
+            job = &fn;
+            remaining = task_count;
+            generation++;
+            batch_start.notify_all();
+            batch_done.wait(lock, [this] { return remaining == 0 && active == 0; });
+            job = nullptr;
+        }
+
+    private:
+        struct worker_queue {
+            std::mutex m;
+            std::deque<int> tasks;
+        };
+
+        // Own work is taken LIFO from the back
+        bool pop_local(int w, int& task) {
+            auto& q = *queues[w];
+            std::lock_guard<std::mutex> lock(q.m);
+            if (q.tasks.empty()) return false;
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+
+        // Stolen work is taken FIFO from the front of a victim, starting
+        // with our right hand neighbour so thieves spread out
+        bool steal(int thief, int& task) {
+            int n = static_cast<int>(queues.size());
+            for (int k = 1; k < n; k++) {
+                auto& q = *queues[(thief + k) % n];
+                std::lock_guard<std::mutex> lock(q.m);
+                if (q.tasks.empty()) continue;
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+        void worker_loop(int w) {
+            unsigned long seen = 0;
+            while (true) {
+                const task_fn* fn;
+                {
+                    std::unique_lock<std::mutex> lock(batch_mutex);
+                    batch_start.wait(lock, [&] { return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                    fn = job;
+                    active++;
+                }
+                // No tasks are added while a batch runs, so once every
+                // deque is empty this worker is done with the batch
+                int task;
+                while (pop_local(w, task) || steal(w, task)) {
+                    (*fn)(task, w);
+                    std::lock_guard<std::mutex> lock(batch_mutex);
+                    remaining--;
+                }
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                if (--active == 0) batch_done.notify_all();
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        std::vector<std::thread> workers;
+
+        std::mutex batch_mutex;
+        std::condition_variable batch_start;
+        std::condition_variable batch_done;
+        const task_fn* job = nullptr;
+        int remaining = 0;
+        int active = 0;
+        unsigned long generation = 0;
+        bool stopping = false;
+};
+
+#endif
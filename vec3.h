@@ -6,18 +6,26 @@
 
 using std::sqrt;
 
-class vec3 {
+// -DRT_VEC3_PADDED pads vec3 to four components, 16 bytes in float, so
+// every vector is one aligned SSE load
+#ifdef RT_VEC3_PADDED
+const int vec3_components = 4;
+#else
+const int vec3_components = 3;
+#endif
+
+class alignas(vec3_components == 4 ? 4 * sizeof(real) : alignof(real)) vec3 {
     public:
         vec3(): e{0, 0, 0} {}
-        vec3(double e0, double e1, double e2): e{e0, e1, e2} {}
+        vec3(real e0, real e1, real e2): e{e0, e1, e2} {}
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        real x() const { return e[0]; }
+        real y() const { return e[1]; }
+        real z() const { return e[2]; }
 
         vec3 operator -() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        real operator[](int i) const { return e[i]; }
+        real& operator[](int i) { return e[i]; }
 
         vec3& operator +=(const vec3 &v) {
             e[0] += v.e[0];
@@ -26,28 +34,30 @@ class vec3 {
             return *this;
         }
 
-        vec3& operator *=(const double t) {
+        vec3& operator *=(const real t) {
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
             return *this;
         }
 
-        vec3& operator /=(const double t) {
+        vec3& operator /=(const real t) {
             return *this *= 1 / t;
         }
 
-        double length() const {
+        real length() const {
             return sqrt(length_squared());
         }
 
-        double length_squared() const {
+        real length_squared() const {
             return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
         }
 
         bool near_zero() const {
             // Return true if the vector is close to zero in all dimensions.
-            const auto s = 1e-8;
+            // 1e-8 is below what float can resolve next to the unit
+            // vectors this gets used on, so float uses a larger bound.
+            const real s = sizeof(real) == sizeof(double) ? real(1e-8) : real(1e-5);
             return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
         }
 
@@ -55,12 +65,13 @@ class vec3 {
             return vec3(random_double(), random_double(), random_double());
         }
 
-        inline static vec3 random(double min, double max) {
+        inline static vec3 random(real min, real max) {
             return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
         }
 
     public:
-        double e[3];
+        // Only the first three are used, the padding one stays zero
+        real e[vec3_components];
 };
 
 // Type aliases for vec3
@@ -86,19 +97,19 @@ inline vec3 operator *(const vec3 &u, const vec3 &v) {
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator *(double t, const vec3 &v) {
+inline vec3 operator *(real t, const vec3 &v) {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator *(const vec3 &v, double t) {
+inline vec3 operator *(const vec3 &v, real t) {
     return t * v;
 }
 
-inline vec3 operator /(vec3 v, double t) {
+inline vec3 operator /(vec3 v, real t) {
     return (1 / t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
+inline real dot(const vec3 &u, const vec3 &v) {
     return u.e[0] * v.e[0]
          + u.e[1] * v.e[1]
          + u.e[2] * v.e[2];
@@ -114,39 +125,13 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
-inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
-}
-
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
-}
-
-inline vec3 random_in_hemisphere(const vec3& normal) {
-    vec3 in_unit_sphere = random_in_unit_sphere();
-    if (dot(in_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
-        return in_unit_sphere;
-    else
-        return -in_unit_sphere;
-}
-
-inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
-}
+// random_in_unit_sphere() and the other random shapes are in sampling.h
 
 inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
     auto cos_theta = fmin(dot(-uv, n), 1.0);
     vec3 r_out_perp =  etai_over_etat * (uv + cos_theta * n);
     vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
@@ -0,0 +1,241 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "material.h"
+#include "render.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Wall time spent in each stage of the wavefront loop
+struct wavefront_stats {
+    double generate = 0, intersect = 0, sort = 0, shade = 0, compact = 0, accumulate = 0;
+    long rays = 0;
+
+    void add(const wavefront_stats& o) {
+        generate += o.generate;
+        intersect += o.intersect;
+        sort += o.sort;
+        shade += o.shade;
+        compact += o.compact;
+        accumulate += o.accumulate;
+        rays += o.rays;
+    }
+};
+
+// Path state for every camera sample of a tile, one array per field so
+// each stage streams through just the fields it needs. Indexed by path id
+// (pixel in tile * samples + sample), the queues hold ids of live paths.
+struct wavefront_paths {
+    std::vector<real> ox, oy, oz, dx, dy, dz;
+    std::vector<real> tr, tg, tb;     // throughput
+    std::vector<real> pdf;              // pdf the last hit drew the ray with, see shade_hit()
+    std::vector<color> radiance;        // final color of the path
+    std::vector<sample_stream> streams; // each path's own random stream
+
+    std::vector<uint32_t> queue;        // live paths
+    std::vector<hit_record> recs;       // hit of queue[k]
+    std::vector<uint8_t> hit;           // did queue[k] hit anything
+    std::vector<uint32_t> sorted;       // queue slots grouped by material
+    std::vector<uint32_t> next_queue;   // survivors of this bounce
+
+    void resize(size_t n) {
+        for (auto* v : {&ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &pdf}) v->resize(n);
+        radiance.resize(n);
+        streams.resize(n);
+        queue.reserve(n);
+        recs.resize(n);
+        hit.resize(n);
+        sorted.resize(n);
+        next_queue.reserve(n);
+    }
+
+    ray get(uint32_t id) const {
+        return ray(point3(ox[id], oy[id], oz[id]), vec3(dx[id], dy[id], dz[id]));
+    }
+
+    void set(uint32_t id, const ray& r) {
+        ox[id] = r.orig.x(); oy[id] = r.orig.y(); oz[id] = r.orig.z();
+        dx[id] = r.dir.x();  dy[id] = r.dir.y();  dz[id] = r.dir.z();
+    }
+};
+
+// Iterative replacement for the recursive ray_color. Instead of following
+// one path to the end before starting the next, every bounce runs as a
+// sequence of stages over all live paths of a tile:
+//   generate   camera rays for every pixel and sample
+//   intersect  closest hit for every live path
+//   sort       group the hits by material kind
+//   shade      light and scatter every hit, one material kind at a time
+//   compact    drop finished paths from the queue
+// Each stage is a tight loop over one kind of work. Every path keeps its
+// own pixel/sample random stream so the image matches the recursive path.
+class wavefront_tracer {
+    public:
+        wavefront_tracer(const camera& cam, const hittable& world, const material_table& materials,
+                         const light_list& lights, int image_width, int image_height, int samples_per_pixel, int max_depth, uint64_t seed,
+                         const roulette_settings& roulette = roulette_settings())
+            : cam(cam), world(world), materials(materials), lights(lights), image_width(image_width), image_height(image_height),
+              samples_per_pixel(samples_per_pixel), max_depth(max_depth), seed(seed), roulette(roulette) {}
+
+        // Renders every sample of the tile's pixels into fb.
+        // paths is scratch space, one per thread, reused between tiles.
+        void render(const tile& tl, framebuffer& fb, wavefront_paths& paths, wavefront_stats& stats,
+                    path_stats& lengths) const;
+
+    private:
+        using stage_clock = std::chrono::steady_clock;
+
+        static double seconds_since(stage_clock::time_point& start) {
+            auto now = stage_clock::now();
+            double s = std::chrono::duration<double>(now - start).count();
+            start = now;
+            return s;
+        }
+
+    private:
+        const camera& cam;
+        const hittable& world;
+        const material_table& materials;
+        const light_list& lights;
+        int image_width, image_height;
+        int samples_per_pixel;
+        int max_depth;
+        uint64_t seed;
+        roulette_settings roulette;
+};
+
+void wavefront_tracer::render(const tile& tl, framebuffer& fb, wavefront_paths& paths, wavefront_stats& stats,
+                              path_stats& lengths) const {
+    const int tile_width = tl.x1 - tl.x0;
+    const size_t path_count = size_t(tile_width) * (tl.y1 - tl.y0) * samples_per_pixel;
+    paths.resize(path_count);
+    auto start = stage_clock::now();
+
+    // Generate
+    paths.queue.clear();
+    for (int j = tl.y0; j < tl.y1; j++) {
+        for (int i = tl.x0; i < tl.x1; i++) {
+            uint32_t first = static_cast<uint32_t>(((j - tl.y0) * tile_width + (i - tl.x0)) * samples_per_pixel);
+            for (int s = 0; s < samples_per_pixel; s++) {
+                uint32_t id = first + s;
+                seed_pixel_sample(seed, j * image_width + i, s);
+                double du, dv;
+                sample_2d(du, dv);
+                auto u = real(i + du) / (image_width - 1);
+                auto v = real(j + dv) / (image_height - 1);
+                paths.set(id, cam.get_ray(u, v));
+                paths.streams[id] = thread_sample_stream();
+                paths.tr[id] = paths.tg[id] = paths.tb[id] = 1.0;
+                paths.pdf[id] = 0;
+                paths.radiance[id] = color(0, 0, 0);
+                paths.queue.push_back(id);
+            }
+        }
+    }
+    stats.generate += seconds_since(start);
+
+    for (int depth = max_depth; depth > 0 && !paths.queue.empty(); depth--) {
+        const size_t live = paths.queue.size();
+        const int bounce = max_depth - depth;
+        stats.rays += live;
+        RT_COUNT_N(rays, live);
+        RT_COUNT_DEPTH_N(depth, live);
+
+        // Intersect
+        for (size_t k = 0; k < live; k++) {
+            ray r = paths.get(paths.queue[k]);
+            paths.hit[k] = world.hit(r, ray_t_min(r), infinity, paths.recs[k]);
+        }
+        stats.intersect += seconds_since(start);
+
+        // Sort, a counting sort of the hit slots by material kind. Misses
+        // pick up the sky here since they need no shading.
+        size_t bucket_start[material_kind_count + 1] = {};
+        for (size_t k = 0; k < live; k++) {
+            if (paths.hit[k]) {
+                bucket_start[static_cast<int>(materials[paths.recs[k].material_id].kind) + 1]++;
+            } else {
+                uint32_t id = paths.queue[k];
+                color sky = background(paths.get(id));
+                paths.radiance[id] += color(paths.tr[id], paths.tg[id], paths.tb[id]) * sky;
+                lengths.record(bounce + 1);
+            }
+        }
+        for (int b = 0; b < material_kind_count; b++) bucket_start[b + 1] += bucket_start[b];
+        const size_t hit_count = bucket_start[material_kind_count];
+        for (size_t k = 0; k < live; k++) {
+            if (paths.hit[k]) {
+                paths.sorted[bucket_start[static_cast<int>(materials[paths.recs[k].material_id].kind)]++] = static_cast<uint32_t>(k);
+            }
+        }
+        stats.sort += seconds_since(start);
+
+        // Shade, absorbed paths and lights are flagged dead by clearing hit
+        for (size_t n = 0; n < hit_count; n++) {
+            uint32_t k = paths.sorted[n];
+            uint32_t id = paths.queue[k];
+            std::swap(thread_sample_stream(), paths.streams[id]);
+            path_vertex v = shade_hit(materials[paths.recs[k].material_id], paths.get(id), paths.recs[k], paths.pdf[id],
+                                      world, lights);
+            paths.radiance[id] += color(paths.tr[id], paths.tg[id], paths.tb[id]) * v.radiance;
+            const color& attenuation = v.attenuation;
+            bool bounced = v.bounced;
+            if (bounced) {
+                RT_COUNT(scatters);
+                paths.tr[id] *= attenuation.x();
+                paths.tg[id] *= attenuation.y();
+                paths.tb[id] *= attenuation.z();
+                if (roulette.enabled() && bounce >= roulette.min_bounces) {
+                    real p = roulette.survival(color(paths.tr[id], paths.tg[id], paths.tb[id]));
+                    if (sample_1d() < p) {
+                        paths.tr[id] /= p;
+                        paths.tg[id] /= p;
+                        paths.tb[id] /= p;
+                    } else {
+                        bounced = false;
+                        lengths.roulette_ended++;
+                    }
+                }
+            }
+            std::swap(thread_sample_stream(), paths.streams[id]);
+            if (bounced) {
+                paths.set(id, v.scattered);
+                paths.pdf[id] = v.pdf;
+            } else {
+                paths.hit[k] = 0;
+                lengths.record(bounce + 1);
+            }
+        }
+        stats.shade += seconds_since(start);
+
+        // Compact, keep the survivors in their original order
+        paths.next_queue.clear();
+        for (size_t k = 0; k < live; k++) {
+            if (paths.hit[k]) paths.next_queue.push_back(paths.queue[k]);
+        }
+        paths.queue.swap(paths.next_queue);
+        stats.compact += seconds_since(start);
+    }
+    // Paths still queued ran out of bounces and gather no light
+    for (size_t k = 0; k < paths.queue.size(); k++) lengths.record(max_depth);
+
+    // Add samples to their pixels in sample order, same as ray_color's loop
+    for (int j = tl.y0; j < tl.y1; j++) {
+        for (int i = tl.x0; i < tl.x1; i++) {
+            uint32_t first = static_cast<uint32_t>(((j - tl.y0) * tile_width + (i - tl.x0)) * samples_per_pixel);
+            color pixel_color(0, 0, 0);
+            for (int s = 0; s < samples_per_pixel; s++) pixel_color += paths.radiance[first + s];
+            fb.add(i, j, pixel_color, samples_per_pixel);
+        }
+    }
+    stats.accumulate += seconds_since(start);
+}
+
+#endif